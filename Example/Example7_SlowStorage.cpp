@@ -0,0 +1,481 @@
+﻿/*
+ * Example 7 "SlowStorage" for OneSound.
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+// Headless streaming stress test: nothing is played on the audio device. The streams are real SoundStreams bound to
+// virtual voices, source voices without a device that play their queued buffers against the clock and report
+// the buffer ends to the SoundObject the way XAudio2 does, so the streams refill them as they refill real voices.
+// A voice that played all its buffers before the next one was queued had an underrun.
+// The library still starts XAudio2 and its mastering voice on the default device, so an audio endpoint is needed.
+//
+// Usage: Example7_SlowStorage [ssd|hdd|sd|optical] [streams] [seconds per configuration] [file]
+// Exits with 1 if no configuration survives the disk profile, with 4 if XAudio2 or its mastering voice can't be created.
+// The configurations go from the least memory to the most: double buffered refills on threads of their own,
+// then triple buffered refills through the IOScheduler, each with a growing stream head.
+// "lead" is the least data a voice still had queued when a refill arrived, "missed" counts the refills
+// the IOScheduler finished after their deadline.
+// "short" counts the times a stream had no refill running but fewer buffers queued than it keeps (two, three
+// with the IOScheduler), e.g. after a late refill; that's a bug of the stream, not of the disk, and exits with 3.
+
+#include "OneSound\OneSound.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <thread>
+
+using namespace std;
+using namespace onesnd;
+
+using Clock = IOScheduler::Clock;
+using Milliseconds = chrono::duration<double, milli>;
+
+// a source voice without a device, Process plays its buffers up to the current time
+class VirtualVoice : public IXAudio2SourceVoice
+{
+public:
+    VirtualVoice(IXAudio2VoiceCallback* callback, const WAVEFORMATEX& wf) :
+        callback(callback),
+        wf(wf)
+    { }
+
+    // reports the buffers that ended on the calling thread, it stands for the engine thread of XAudio2
+    void Process(Clock::time_point now)
+    {
+        for (;;)
+        {
+            void* context = nullptr;
+            auto streamEnd = false;
+            {
+                lock_guard<mutex> lock(queueMutex);
+                if (!flushed.empty())
+                {
+                    context = flushed.front(); // a flush ends its buffers as well
+                    flushed.pop_front();
+                }
+                else
+                {
+                    if (!playing || queue.empty())
+                    {
+                        clock = now; // nothing plays meanwhile
+                        return;
+                    }
+
+                    auto& front = queue.front();
+                    auto playable = (long long)(chrono::duration<double>(now - clock).count() * wf.nAvgBytesPerSec);
+                    if (played + playable < front.bytes)
+                    {
+                        played += int(playable);
+                        clock += timeOf(playable);
+                        return;
+                    }
+
+                    clock += timeOf(front.bytes - played);
+                    samplesPlayed += front.bytes / wf.nBlockAlign;
+                    context = front.context;
+                    streamEnd = front.streamEnd;
+                    queue.pop_front();
+                    played = 0;
+
+                    if (queue.empty() && !streamEnd)
+                    {
+                        dry = true;
+                        dryAt = clock;
+                    }
+                }
+            }
+
+            // without the lock, the callbacks queue the next buffers
+            callback->OnBufferEnd(context);
+            if (streamEnd)
+                callback->OnStreamEnd();
+        }
+    }
+
+    // fewer buffers queued than depth, unless the last one of the file is among them
+    bool IsShort(int depth)
+    {
+        lock_guard<mutex> lock(queueMutex);
+        return int(queue.size()) < depth && none_of(queue.begin(), queue.end(), [](const Entry& e) { return e.streamEnd; });
+    }
+
+    unsigned underruns = 0;
+    double gaps = 0.0;                                      // milliseconds of silence
+    double minLead = numeric_limits<double>::infinity();    // milliseconds queued when a refill arrived
+    double maxStartup = 0.0;                                // milliseconds from a start without data to the first buffer
+
+    // IXAudio2Voice
+    void __stdcall GetVoiceDetails(XAUDIO2_VOICE_DETAILS* details) override
+    {
+        details->CreationFlags = 0;
+        details->InputChannels = wf.nChannels;
+        details->InputSampleRate = wf.nSamplesPerSec;
+    }
+    HRESULT __stdcall SetOutputVoices(const XAUDIO2_VOICE_SENDS*) override { return S_OK; }
+    HRESULT __stdcall SetEffectChain(const XAUDIO2_EFFECT_CHAIN*) override { return S_OK; }
+    HRESULT __stdcall EnableEffect(UINT32, UINT32) override { return S_OK; }
+    HRESULT __stdcall DisableEffect(UINT32, UINT32) override { return S_OK; }
+    void __stdcall GetEffectState(UINT32, BOOL* enabled) override { *enabled = FALSE; }
+    HRESULT __stdcall SetEffectParameters(UINT32, const void*, UINT32, UINT32) override { return S_OK; }
+    HRESULT __stdcall GetEffectParameters(UINT32, void*, UINT32) override { return E_FAIL; }
+    HRESULT __stdcall SetFilterParameters(const XAUDIO2_FILTER_PARAMETERS*, UINT32) override { return S_OK; }
+    void __stdcall GetFilterParameters(XAUDIO2_FILTER_PARAMETERS* parameters) override { *parameters = { LowPassFilter, 1.0f, 1.0f }; }
+    HRESULT __stdcall SetOutputFilterParameters(IXAudio2Voice*, const XAUDIO2_FILTER_PARAMETERS*, UINT32) override { return S_OK; }
+    void __stdcall GetOutputFilterParameters(IXAudio2Voice*, XAUDIO2_FILTER_PARAMETERS* parameters) override { *parameters = { LowPassFilter, 1.0f, 1.0f }; }
+    HRESULT __stdcall SetVolume(float value, UINT32) override { volume = value; return S_OK; }
+    void __stdcall GetVolume(float* value) override { *value = volume; }
+    HRESULT __stdcall SetChannelVolumes(UINT32, const float*, UINT32) override { return S_OK; }
+    void __stdcall GetChannelVolumes(UINT32 channels, float* volumes) override { fill(volumes, volumes + channels, 1.0f); }
+    HRESULT __stdcall SetOutputMatrix(IXAudio2Voice*, UINT32, UINT32, const float*, UINT32) override { return S_OK; }
+    void __stdcall GetOutputMatrix(IXAudio2Voice*, UINT32 sources, UINT32 destinations, float* matrix) override
+    {
+        fill(matrix, matrix + sources * destinations, 1.0f);
+    }
+    void __stdcall DestroyVoice() override { } // owned by its VirtualSound
+
+    // IXAudio2SourceVoice
+    HRESULT __stdcall Start(UINT32, UINT32) override
+    {
+        lock_guard<mutex> lock(queueMutex);
+        if (!playing)
+        {
+            playing = true;
+            clock = Clock::now();
+            starting = queue.empty(); // a play or seek still decoding its first buffers
+        }
+        return S_OK;
+    }
+
+    HRESULT __stdcall Stop(UINT32, UINT32) override
+    {
+        lock_guard<mutex> lock(queueMutex);
+        playing = false;
+        starting = false;
+        dry = false;
+        return S_OK;
+    }
+
+    HRESULT __stdcall SubmitSourceBuffer(const XAUDIO2_BUFFER* buffer, const XAUDIO2_BUFFER_WMA*) override
+    {
+        // the buffer isn't read, only its length is played
+        auto bytes = buffer->PlayLength ? int(buffer->PlayLength * wf.nBlockAlign)
+                                        : int(buffer->AudioBytes - buffer->PlayBegin * wf.nBlockAlign);
+
+        lock_guard<mutex> lock(queueMutex);
+        auto now = Clock::now();
+        if (playing && dry)
+        {
+            ++underruns;
+            gaps += Milliseconds(now - dryAt).count();
+            minLead = 0.0;
+            dry = false;
+            clock = now;
+        }
+        else if (playing && starting)
+        {
+            maxStartup = max(maxStartup, Milliseconds(now - clock).count());
+            starting = false;
+            clock = now;
+        }
+        else if (playing)
+        {
+            auto queued = -played;
+            for (auto& entry : queue)
+                queued += entry.bytes;
+
+            auto lead = queued * 1000.0 / wf.nAvgBytesPerSec - Milliseconds(now - clock).count();
+            minLead = min(minLead, max(lead, 0.0));
+        }
+
+        queue.push_back({ bytes, buffer->pContext, (buffer->Flags & XAUDIO2_END_OF_STREAM) != 0 });
+        return S_OK;
+    }
+
+    HRESULT __stdcall FlushSourceBuffers() override
+    {
+        // a started voice keeps the buffer it plays
+        lock_guard<mutex> lock(queueMutex);
+        auto kept = playing && !queue.empty() ? 1 : 0;
+        for (auto i = size_t(kept); i < queue.size(); ++i)
+            flushed.push_back(queue[i].context);
+        queue.resize(kept);
+        if (!kept)
+            played = 0;
+        return S_OK;
+    }
+
+    HRESULT __stdcall Discontinuity() override { return S_OK; }
+    HRESULT __stdcall ExitLoop(UINT32) override { return S_OK; }
+
+    void __stdcall GetState(XAUDIO2_VOICE_STATE* state) override
+    {
+        lock_guard<mutex> lock(queueMutex);
+        state->pCurrentBufferContext = queue.empty() ? nullptr : queue.front().context;
+        state->BuffersQueued = UINT32(queue.size());
+        state->SamplesPlayed = samplesPlayed;
+    }
+
+    HRESULT __stdcall SetFrequencyRatio(float, UINT32) override { return S_OK; }
+    void __stdcall GetFrequencyRatio(float* ratio) override { *ratio = 1.0f; }
+    HRESULT __stdcall SetSourceSampleRate(UINT32) override { return S_OK; }
+
+private:
+    struct Entry
+    {
+        int bytes;
+        void* context;
+        bool streamEnd;
+    };
+
+    Clock::duration timeOf(long long bytes) const
+    {
+        return chrono::duration_cast<Clock::duration>(chrono::duration<double>(double(bytes) / wf.nAvgBytesPerSec));
+    }
+
+    IXAudio2VoiceCallback* callback;
+    WAVEFORMATEX wf;
+    float volume = 1.0f;
+
+    mutex queueMutex;           // the refills submit from the threads they decode on
+    deque<Entry> queue;
+    deque<void*> flushed;       // contexts of the flushed buffers, the next Process ends them
+    bool playing = false;
+    Clock::time_point clock;    // the playback is simulated up to this time
+    int played = 0;             // bytes of the front buffer played so far
+    UINT64 samplesPlayed = 0;
+
+    bool dry = false;           // the last buffer ended and nothing followed it yet
+    Clock::time_point dryAt;
+    bool starting = false;      // started without data
+};
+
+// a SoundObject on a VirtualVoice, bound to its stream the way setSound binds it to a real voice
+class VirtualSound : public SoundObject
+{
+public:
+    VirtualSound(const shared_ptr<SoundStream>& stream)
+    {
+        state = new SoundObjectState(this);
+        state->isLoopable = true; // a stream that ends starts over
+
+        voice = make_unique<VirtualVoice>(state, *stream->WaveFormat());
+        source = voice.get();
+
+        stream->BindSource(this);
+        sound = stream;
+    }
+
+    ~VirtualSound()
+    {
+        sound->UnbindSource(this); // waits for the refill still running, the voice goes right after
+        sound = nullptr;
+        source = nullptr;
+        delete state;
+    }
+
+    VirtualVoice& getVoice() { return *voice; }
+
+private:
+    unique_ptr<VirtualVoice> voice;
+};
+
+struct Configuration
+{
+    bool scheduled;     // refills through the IOScheduler, three buffers queued instead of two
+    int head;           // milliseconds of the stream head, see SoundStream::setStreamHead
+};
+
+struct Result
+{
+    unsigned underruns = 0;
+    double gaps = 0.0;
+    double minLead = numeric_limits<double>::infinity();
+    double maxStartup = 0.0;
+    unsigned shortfalls = 0;
+};
+
+static map<string, StorageProfile> profiles()
+{
+    //         latency jitter bandwidth         stall  stall ms
+    map<string, StorageProfile> p;
+    p["ssd"]     = { 0,  1,   500 * 1024 * 1024, 0.0f,   0    };
+    p["hdd"]     = { 10, 8,   60 * 1024 * 1024,  0.005f, 250  };
+    p["sd"]      = { 2,  15,  8 * 1024 * 1024,   0.01f,  600  };
+    p["optical"] = { 90, 60,  3 * 1024 * 1024,   0.02f,  1500 };
+    return p;
+}
+
+static Result run(const fs::path& file, int streams, int seconds, const Configuration& config)
+{
+    // the head is decoded by the load, the stream is loaded again for every configuration
+    SoundStream::setStreamHead(config.head);
+    auto stream = make_shared<SoundStream>();
+    if (!stream->Load(file))
+        throw runtime_error("Can't load stream: "s + file.string());
+
+    vector<unique_ptr<VirtualSound>> sounds;
+    for (auto i = 0; i < streams; ++i)
+    {
+        sounds.push_back(make_unique<VirtualSound>(stream));
+
+        // the sounds play spread over the file, so they don't read the same data
+        if (i)
+            stream->Seek(sounds.back().get(), stream->Size() / streams * i);
+    }
+
+    for (auto& sound : sounds)
+        sound->play();
+
+    Result result;
+    vector<bool> shortNow(sounds.size(), false);
+    auto depth = config.scheduled ? 3 : 2;
+    auto end = Clock::now() + chrono::seconds(seconds);
+    while (Clock::now() < end)
+    {
+        auto now = Clock::now();
+        for (auto i = size_t(0); i < sounds.size(); ++i)
+        {
+            auto& voice = sounds[i]->getVoice();
+            voice.Process(now);
+
+            // the buffer ends were just handled on this thread, a stream without a job running has refilled all of them
+            auto isShort = !stream->IsPending(sounds[i].get()) && voice.IsShort(depth);
+            if (isShort && !shortNow[i])
+                ++result.shortfalls; // once until the stream catches up again
+            shortNow[i] = isShort;
+        }
+        this_thread::sleep_for(2ms);
+    }
+
+    for (auto& sound : sounds)
+    {
+        auto& voice = sound->getVoice();
+        result.underruns += voice.underruns;
+        result.gaps += voice.gaps;
+        result.minLead = min(result.minLead, voice.minLead);
+        result.maxStartup = max(result.maxStartup, voice.maxStartup);
+    }
+
+    sounds.clear(); // unbinding waits for the refills still decoding
+    return result;
+}
+
+static int test(int argc, char* argv[])
+{
+    try
+    {
+        auto name = string(argc > 1 ? argv[1] : "hdd");
+        auto streams = argc > 2 ? max(atoi(argv[2]), 1) : 16;
+        auto seconds = argc > 3 ? max(atoi(argv[3]), 1) : 10;
+        auto file = fs::path(argc > 4 ? argv[4] : "Sound\\Crysis 1.ogg");
+
+        auto all = profiles();
+        if (!all.count(name))
+        {
+            cout << "Unknown disk profile: " << name << " (ssd, hdd, sd, optical)" << endl;
+            return 2;
+        }
+
+        const auto& profile = all[name];
+        cout << "Disk " << name << ": " << profile.latency << "ms latency, " << profile.jitter << "ms jitter, "
+             << profile.bandwidth / (1024 * 1024) << "MB/s, " << profile.stallChance * 100.0f << "% stalls of "
+             << profile.stallLength << "ms" << endl;
+        cout << streams << " streams of " << file << ", " << seconds << "s per configuration" << endl << endl;
+
+        vector<Configuration> configurations;
+        for (auto scheduled : { false, true })
+            for (auto head : { 100, 250, 500, 1000 })
+                configurations.push_back({ scheduled, head });
+
+        cout << setw(8) << "buffers" << setw(9) << "head ms" << setw(11) << "underruns" << setw(10) << "gaps ms"
+             << setw(10) << "lead ms" << setw(10) << "startup" << setw(13) << "avg refill" << setw(13) << "max refill"
+             << setw(8) << "missed" << setw(7) << "short" << endl;
+
+        const Configuration* survived = nullptr;
+        auto shortfalls = 0u;
+        for (const auto& config : configurations)
+        {
+            if (config.scheduled)
+                IOScheduler::instance().enable();
+            else
+                IOScheduler::instance().disable();
+
+            setSimulatedStorage(profile); // replays the same delays for every configuration
+            IOScheduler::instance().resetStats();
+
+            auto result = run(file, streams, seconds, config);
+
+            cout << fixed << setprecision(1)
+                 << setw(8) << (config.scheduled ? 3 : 2) << setw(9) << config.head
+                 << setw(11) << result.underruns << setw(10) << result.gaps
+                 << setw(10) << (isinf(result.minLead) ? 0.0 : result.minLead) << setw(10) << result.maxStartup;
+
+            // only the scheduler times the refills
+            if (config.scheduled)
+            {
+                auto stats = IOScheduler::instance().getStats();
+                cout << setw(13) << stats.averageLatency << setw(13) << stats.maxLatency << setw(8) << stats.missed;
+            }
+            else
+                cout << setw(13) << "-" << setw(13) << "-" << setw(8) << "-";
+            cout << setw(7) << result.shortfalls << endl;
+
+            shortfalls += result.shortfalls;
+
+            if (!result.underruns && !survived)
+                survived = &config;
+        }
+
+        auto storage = getStorageStatistics();
+        cout << endl << "Last run: " << storage.reads << " reads, " << storage.stalls << " stalls, slowest read "
+             << storage.maxDelay << "ms" << endl;
+
+        clearSimulatedStorage();
+        IOScheduler::instance().disable();
+
+        if (shortfalls)
+        {
+            cout << "The streams kept fewer buffers queued than they should " << shortfalls << " times." << endl;
+            return 3;
+        }
+
+        if (!survived)
+        {
+            cout << "No configuration survives this disk." << endl;
+            return 1;
+        }
+
+        cout << "Smallest configuration without underruns: " << (survived->scheduled ? 3 : 2) << " buffers, "
+             << survived->head << "ms head" << endl;
+    }
+    catch (const exception& e)
+    {
+        cout << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    // the streams create no voice on the engine, but initialize opens the default device for the mastering voice
+    auto& device = XAudio2Device::instance();
+    device.initialize();
+    if (!device.getEngine() || !device.getMaster())
+    {
+        cout << "Can't start XAudio2: the mastering voice needs an audio endpoint." << endl;
+        device.finalize();
+        return 4;
+    }
+
+    auto code = test(argc, argv);
+    device.finalize();
+    return code;
+}
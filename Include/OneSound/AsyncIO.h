@@ -0,0 +1,100 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#pragma once
+
+#include "OneSound\Export.h"
+
+#include "OneSound\Utility.h"
+
+#include "OneSound\StreamType\AudioIO.h"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+
+namespace onesnd
+{
+    struct AsyncFile;
+
+    /**
+    * Asynchronous file reading backend for the streams.
+    * Files opened through the service are read with overlapped I/O. Every file keeps a window
+    * of read-ahead blocks in flight, all completions are drained by a single thread
+    * through one I/O completion port, so the number of streams doesn't add threads.
+    * The read-ahead blocks are taken from one preallocated buffer pool.
+    *
+    * A read only waits if the data wasn't prefetched yet, so decoders keep running
+    * on the data that has already arrived while the disk works on the next blocks.
+    */
+    class ONE_SOUND_API AsyncIOService
+    {
+    public:
+        static AsyncIOService& instance()
+        {
+            static AsyncIOService service;
+            return service;
+        }
+
+       ~AsyncIOService();
+
+    public:
+        /**
+        * Enables the asynchronous backend for all the streams opened from disk.
+        * @param windowBlocks Number of blocks every file reads ahead (2 to 16)
+        * @param blockSize Size of a single read in bytes, rounded up to 4KB
+        * @param poolBlocks Number of blocks in the shared buffer pool
+        */
+        void enable(size_t windowBlocks = 4, size_t blockSize = 64 * 1024, size_t poolBlocks = 256);
+
+        /**
+        * Waits for the reads in flight and stops the completion thread.
+        * Files that are still open keep working with synchronous reads.
+        */
+        void disable();
+
+        /**
+        * @return TRUE if the streams read files through this service.
+        */
+        bool isEnabled() const { return port.load() != nullptr; }
+
+        /**
+        * Opens a file for asynchronous read-ahead.
+        * @param file Path of the file to open
+        * @return A valid AudioIO. Throws if the file can't be opened.
+        */
+        AudioIO open(const fs::path& file);
+
+        size_t getWindowBlocks() const { return windowBlocks; }
+        size_t getBlockSize() const { return blockSize; }
+
+    public: // [internal] used by the asynchronous files
+        char* acquireBlock();
+        void releaseBlock(char* block);
+
+        AudioIO openAsyncFile(const std::shared_ptr<void>& handle, unsigned long long size);
+        void closeAsyncFile(AsyncFile* file);
+
+    private:
+        AsyncIOService();
+
+        void completionLoop();
+
+        std::atomic<void*> port;        // I/O completion port shared by all the files
+        std::thread completionThread;
+
+        std::mutex filesMutex;          // held by enable, disable and while a file is opened or closed
+        std::vector<AsyncFile*> files; // open files, switched to synchronous reads by disable
+
+        size_t windowBlocks;
+        size_t blockSize;
+
+        std::mutex poolMutex;
+        char* pool;                     // one allocation for all the read-ahead blocks
+        size_t poolSize;
+        std::vector<char*> freeBlocks;
+    };
+}
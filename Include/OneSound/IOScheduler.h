@@ -0,0 +1,172 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#pragma once
+
+#include "OneSound\Export.h"
+
+#include "OneSound\Utility.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace onesnd
+{
+    /**
+    * Kind of the I/O a request does, the bandwidth cap only applies to Audio.
+    */
+    enum class IOClass
+    {
+        Audio,          // stream refills of the library
+        Application,    // reads of the application: textures, levels...
+    };
+
+    /**
+    * Counters of the IOScheduler, since the start or the last reset.
+    */
+    struct IOSchedulerStats
+    {
+        unsigned audioQueued = 0;               // requests waiting right now
+        unsigned applicationQueued = 0;
+        unsigned maxQueued = 0;                 // largest queue depth seen
+
+        unsigned long long completed = 0;
+        unsigned long long audioBytes = 0;
+        unsigned long long applicationBytes = 0;
+        unsigned long long missed = 0;          // requests that finished after their deadline
+        unsigned long long throttled = 0;       // audio requests that waited for the bandwidth cap
+        unsigned long long urgent = 0;          // audio requests that bypassed the cap because their deadline was close
+
+        double averageWait = 0.0;               // milliseconds from submit to start
+        double averageLatency = 0.0;            // milliseconds from submit to completion
+        double maxLatency = 0.0;
+    };
+
+    /**
+    * Handle of a submitted request.
+    */
+    struct IORequest
+    {
+        unsigned long long id = 0;      // 0 if the request was never queued
+        std::shared_future<void> done;  // ready when the work returned, holds its exception
+    };
+
+    /**
+    * Orders the reads of the streams and of the application by deadline, so they don't compete for the disk.
+    * The deadline of a stream refill is the time its voice runs out of queued data. Requests are served
+    * earliest deadline first by a few worker threads, the audio share of the bandwidth can be capped,
+    * and requests closer to their deadline than the urgent window skip the cap and go first,
+    * so a starving stream is always served before anything else.
+    *
+    * While the scheduler is disabled, submitted work runs on a thread of its own right away.
+    */
+    class ONE_SOUND_API IOScheduler
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using Work = std::function<size_t()>;   // does the I/O, returns the number of bytes it read from the disk
+
+        static IOScheduler& instance()
+        {
+            static IOScheduler scheduler;
+            return scheduler;
+        }
+
+       ~IOScheduler();
+
+    public:
+        /**
+        * Starts serving the requests. The streams opened from disk refill through the scheduler from now on.
+        * @param threads Number of requests served at once, 1 keeps the disk strictly in deadline order
+        */
+        void enable(unsigned threads = 1);
+
+        /**
+        * Serves the queued requests without the cap and stops the worker threads.
+        */
+        void disable();
+
+        bool isEnabled() const { return running; }
+
+        /**
+        * Caps the bandwidth of the Audio requests, urgent ones excepted.
+        * @param bytesPerSecond Disk bytes per second, 0 removes the cap
+        */
+        void setAudioBandwidth(size_t bytesPerSecond);
+        size_t getAudioBandwidth() const;
+
+        /**
+        * Sets how close to its deadline a request becomes urgent: it's served before all the others and ignores the cap.
+        * @param milliseconds Urgent window, 100ms by default
+        */
+        void setUrgentWindow(int milliseconds);
+        int getUrgentWindow() const;
+
+        /**
+        * Queues a request.
+        * @param cls Class of the request
+        * @param deadline Time the data must have arrived by
+        * @param work Does the I/O on a worker thread and returns the number of bytes read
+        * @param after [optional] The request isn't started before this one is ready
+        * @return Handle of the request.
+        */
+        IORequest submit(IOClass cls, Clock::time_point deadline, Work work, std::shared_future<void> after = std::shared_future<void>());
+
+        /**
+        * Moves a queued request to the front, e.g. when its caller has to wait for it.
+        * Does nothing if the request already started.
+        */
+        void expedite(unsigned long long id);
+
+        IOSchedulerStats getStats() const;
+        void resetStats();
+
+    private:
+        IOScheduler();
+
+        struct Request
+        {
+            unsigned long long id;
+            IOClass cls;
+            Clock::time_point submitted;
+            Clock::time_point deadline;
+            Work work;
+            std::shared_future<void> after;
+            std::shared_ptr<std::promise<void>> done;
+            bool throttled;
+        };
+        using Queue = std::multimap<Clock::time_point, Request>;   // keyed by deadline
+
+        // [lock held] the next request to serve, queue.end() if none can start before wake
+        Queue::iterator pick(Clock::time_point now, Clock::time_point& wake);
+        void refill(Clock::time_point now);
+        void workerLoop();
+
+        mutable std::mutex mutex;
+        std::condition_variable changed;
+        std::vector<std::thread> workers;
+        std::atomic<bool> running;
+
+        Queue queue;
+        unsigned long long nextId;
+
+        // token bucket of the audio bandwidth, negative while audio is over its share
+        size_t audioBandwidth;
+        double tokens;
+        Clock::time_point lastRefill;
+        Clock::duration urgentWindow;
+
+        IOSchedulerStats stats;
+        double waitSum;         // milliseconds
+        double latencySum;
+    };
+}
@@ -0,0 +1,65 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#pragma once
+
+#include "OneSound\Export.h"
+
+#include "OneSound\XAudio2Device.h"
+
+namespace onesnd
+{
+    /**
+    * Processing applied to the decoded data of a SoundBuffer when it's loaded.
+    * Every pass only changes the data when its analysis finds something to save,
+    * so the same settings can be used for a whole category of sounds.
+    */
+    struct LoadOptimization
+    {
+        bool trimSilence = false;           // cut the silence at the beginning and the end
+        float silenceThreshold = -60.0f;    // level in dBFS below which a sample counts as silence
+        int silencePadding = 5;             // milliseconds kept before the first and after the last audible sample
+
+        bool collapseMono = false;          // store stereo sounds with identical channels as mono
+        int monoTolerance = 0;              // largest difference of the left and right sample still taken as identical
+
+        int targetRate = 0;                 // downsample sounds above this rate, 0 keeps the rate
+
+        // store the data as float32 at the rate of the mastering voice, so XAudio2 neither converts
+        // nor resamples it while mixing; costs memory, worth it for short sounds played very often.
+        // XAudio2 only takes interleaved data, so there's no planar layout. Overrides targetRate.
+        bool preBake = false;
+
+        bool IsEnabled() const { return trimSilence || collapseMono || targetRate > 0 || preBake; }
+    };
+
+    /**
+    * What the optimization of a SoundBuffer did.
+    */
+    struct LoadReport
+    {
+        int originalBytes = 0;
+        int optimizedBytes = 0;
+        int trimmedFrames = 0;              // sample frames cut as silence
+        bool collapsedToMono = false;
+        int originalRate = 0;
+        int optimizedRate = 0;
+        bool preBaked = false;              // converted to float32 at the mixing rate
+
+        int BytesSaved() const { return originalBytes - optimizedBytes; } // negative if pre-baking spent memory
+    };
+
+    /**
+    * Runs the load-time optimization passes over a decoded buffer.
+    * Only 16-bit PCM is processed, other formats are left as they are.
+    * @note Pre-baking reads the rate of the mastering voice, the XAudio2Device must be initialized.
+    * @param ctx SoundBuffer the new buffer belongs to
+    * @param buffer Decoded data, destroyed and replaced if a pass changed it
+    * @param options Passes to run
+    * @return What the passes did.
+    */
+    ONE_SOUND_API LoadReport optimizeBuffer(SoundBuffer* ctx, XABuffer*& buffer, const LoadOptimization& options);
+}
@@ -0,0 +1,131 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#pragma once
+
+#include "OneSound\Export.h"
+
+#include "OneSound\Utility.h"
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+namespace onesnd
+{
+    class AudioStream;
+    struct XABuffer;
+
+    /**
+    * Loudness of a sound as defined by EBU R128 (ITU-R BS.1770).
+    */
+    struct LoudnessInfo
+    {
+        float integrated = -70.0f;  // gated integrated loudness in LUFS, -70 for silence
+        float peak = 0.0f;          // largest sample magnitude, 1.0 is full scale
+
+        bool IsValid() const { return integrated > -70.0f; }
+    };
+
+    /**
+    * Measures the integrated loudness of decoded data: K-weighting, 400ms blocks every 100ms,
+    * absolute gate at -70 LUFS and relative gate at -10 LU. Sounds shorter than a block count as one block.
+    * Long sounds are split between threads, each filters its part after a short pre-roll.
+    * @param buffer Decoded 8-bit, 16-bit or float data
+    * @param threads Number of threads for long sounds, 0 for the number of cores
+    */
+    ONE_SOUND_API LoudnessInfo measureLoudness(const XABuffer* buffer, unsigned threads = 0);
+
+    /**
+    * Measures the integrated loudness of a whole stream, see measureLoudness(const XABuffer*).
+    * Every thread decodes its part with its own cursor; decoders without cursors are read on one thread.
+    * @param strm Stream to measure, it's left at position 0
+    * @param threads Number of threads for long streams, 0 for the number of cores
+    */
+    ONE_SOUND_API LoudnessInfo measureLoudness(AudioStream* strm, unsigned threads = 0);
+
+    /**
+    * Normalizes the loudness of the loaded sounds to a common target.
+    * When enabled, SoundBuffer and SoundStream measure every loaded file once and the SoundObjects
+    * playing it apply the gain on top of their volume. The measurements are cached by the path,
+    * size and last write time of the file, in memory and optionally in a cache file, so a file is only measured again when it changes.
+    */
+    class ONE_SOUND_API LoudnessNormalizer
+    {
+    public:
+        static LoudnessNormalizer& instance()
+        {
+            static LoudnessNormalizer normalizer;
+            return normalizer;
+        }
+
+    public:
+        /**
+        * Enables the normalization for all the sounds loaded from now on.
+        * @param targetLUFS Loudness the sounds are brought to, e.g. -23 (EBU R128) or -16 for games
+        * @param maxBoost Largest gain in dB applied to quiet sounds, the peaks are never pushed above -1 dBFS
+        */
+        void enable(float targetLUFS = -23.0f, float maxBoost = 12.0f);
+
+        /**
+        * Disables the normalization for the sounds loaded from now on.
+        */
+        void disable();
+
+        bool isEnabled() const { return enabled; }
+
+        /**
+        * Keeps the measurements in the specified file, loads the ones it already holds.
+        */
+        void setCacheFile(const fs::path& file);
+
+        /**
+        * @return Cache key of a sound file (hash of its path, size and last write time), 0 if the file doesn't exist.
+        */
+        unsigned long long key(const fs::path& file) const;
+
+        /**
+        * @return Linear gain that brings a sound of the specified loudness to the target, 1.0 for silence.
+        */
+        float gainOf(const LoudnessInfo& info) const;
+
+        /**
+        * Returns the gain of a sound file, measures the decoded data only if the file isn't cached.
+        * @param file Sound file the data was decoded from
+        * @param buffer Decoded data of the file
+        * @return Linear normalization gain.
+        */
+        float analyze(const fs::path& file, const XABuffer* buffer);
+
+        /**
+        * Returns the gain of a sound file, decodes the whole stream only if the file isn't cached.
+        * @param file Sound file the stream was opened from
+        * @param strm Stream of the file, it's left at position 0
+        * @return Linear normalization gain.
+        */
+        float analyze(const fs::path& file, AudioStream* strm);
+
+        unsigned long long getHits() const { return hits; }
+        unsigned long long getMeasured() const { return measured; }
+
+    private:
+        LoudnessNormalizer();
+
+        bool lookup(unsigned long long key, LoudnessInfo& info);
+        void store(unsigned long long key, const LoudnessInfo& info);
+
+        std::atomic<bool> enabled;
+        float target;
+        float maxBoost;
+
+        std::mutex mutex;
+        std::unordered_map<unsigned long long, LoudnessInfo> cache;
+        fs::path cacheFile;
+
+        std::atomic<unsigned long long> hits;
+        std::atomic<unsigned long long> measured;
+    };
+}
@@ -10,9 +10,23 @@
 
 #include "OneSound\SoundType\SoundBuffer.h"
 #include "OneSound\SoundType\SoundStream.h"
+#include "OneSound\SoundType\PushStream.h"
 
 #include "OneSound\SoundType\Sound2D.h"
 
+#include "OneSound\VirtualFileSystem.h"
+#include "OneSound\AsyncIO.h"
+#include "OneSound\IOScheduler.h"
+#include "OneSound\PCMCache.h"
+#include "OneSound\ResidencyManager.h"
+#include "OneSound\SoundAsset.h"
+#include "OneSound\SoundCatalog.h"
+#include "OneSound\Loudness.h"
+#include "OneSound\Waveform.h"
+
+#include "OneSound\StreamType\DecoderRegistry.h"
+#include "OneSound\StreamType\MP3Stream.h"
+
 namespace onesnd
 {
     class ONE_SOUND_API OneSound
@@ -33,6 +47,11 @@ namespace onesnd
 
         XAUDIO2_PERFORMANCE_DATA getPerfomanceData() const;
 
+        // the mpg123 decoder the MP3 streams use and its throughput, measured by initialize();
+        // empty decoder, no candidates and 0 throughput if mpg123 isn't installed or no decoder ran the clip,
+        // the streams then open with the default decoder of mpg123
+        DecoderPerformance getDecoderPerformance() const;
+
         void finalize() const;
 
     public:
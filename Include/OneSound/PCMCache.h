@@ -0,0 +1,104 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#pragma once
+
+#include "OneSound\Export.h"
+
+#include "OneSound\Utility.h"
+
+#include <mutex>
+#include <atomic>
+
+namespace onesnd
+{
+    class SoundBuffer;
+    struct XABuffer;
+
+    /**
+    * On-disk cache of decoded PCM data for the compressed sound files.
+    * A SoundBuffer that loads an MP3 or OGG file looks the file up here first: on a hit
+    * the cached PCM is memory mapped and no decoder runs at all, on a miss the decoded
+    * data is stored for the next load.
+    *
+    * The entries are keyed by the hash of the path, size and last write time of the file and the decoder version,
+    * so a changed file or an updated decoder never hits a stale entry. The cache is trimmed to its size limit
+    * by removing the least recently used entries.
+    */
+    class ONE_SOUND_API PCMCache
+    {
+    public:
+        static PCMCache& instance()
+        {
+            static PCMCache cache;
+            return cache;
+        }
+
+    public:
+        /**
+        * Enables the cache for all the SoundBuffers loaded from now on.
+        * @param directory Cache directory, created if needed
+        * @param maxBytes Size limit of the cache directory in bytes
+        */
+        void enable(const fs::path& directory, unsigned long long maxBytes = 512ull * 1024 * 1024);
+
+        /**
+        * Disables the cache. The cache files are kept on disk.
+        */
+        void disable();
+
+        /**
+        * @return TRUE if the SoundBuffers are cached.
+        */
+        bool isEnabled() const { return enabled; }
+
+        /**
+        * Removes all the cache files that are not mapped by a loaded SoundBuffer.
+        */
+        void clear();
+
+        /**
+        * Removes the least recently used entries until the cache fits its size limit.
+        */
+        void trim();
+
+        /**
+        * @return Cache key of a sound file, 0 if the file is not worth caching (uncompressed) or can't be read.
+        */
+        unsigned long long key(const fs::path& file) const;
+
+        /**
+        * Maps the cached PCM data of a sound file.
+        * @param ctx SoundBuffer the created buffer belongs to
+        * @param key Cache key of the file, see key()
+        * @return A new XABuffer that reads straight from the mapped cache file, NULL on a miss.
+        */
+        XABuffer* load(SoundBuffer* ctx, unsigned long long key);
+
+        /**
+        * Stores decoded PCM data in the cache.
+        * @param key Cache key of the file, see key()
+        * @param buffer Decoded data of the file
+        */
+        void store(unsigned long long key, const XABuffer* buffer);
+
+        unsigned long long getHits() const { return hits; }
+        unsigned long long getMisses() const { return misses; }
+
+    private:
+        PCMCache();
+
+        fs::path entryPath(unsigned long long key) const;
+
+        std::atomic<bool> enabled;
+        fs::path directory;
+        unsigned long long maxBytes;
+        mutable std::mutex mutex;
+
+        std::atomic<unsigned long long> hits;
+        std::atomic<unsigned long long> misses;
+    };
+}
@@ -0,0 +1,95 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#pragma once
+
+#include "OneSound\Export.h"
+
+#include "OneSound\Utility.h"
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+namespace onesnd
+{
+    class SoundBuffer;
+
+    /**
+    * Statistics of the ResidencyManager, since the start.
+    */
+    struct ResidencyStatistics
+    {
+        unsigned long long evictions;       // number of buffers whose data was dropped
+        unsigned long long rehydrations;    // number of evicted buffers decoded again
+        unsigned long long evictedBytes;    // number of bytes freed by the evictions
+        unsigned long long residentBytes;   // decoded data held by all the buffers at the last update
+    };
+
+    /**
+    * Keeps the decoded data of the SoundBuffers within a memory budget.
+    * Buffers that are not bound to any SoundObject lose their data after being idle
+    * for the idle time, or earlier, least recently used first, when the decoded data
+    * exceeds the budget or the system runs low on memory. An evicted buffer keeps its
+    * format and decodes its file again the next time it's bound.
+    *
+    * @note Call update() from the thread that binds and plays the sounds, e.g. once a frame.
+    */
+    class ONE_SOUND_API ResidencyManager
+    {
+    public:
+        static ResidencyManager& instance()
+        {
+            static ResidencyManager manager;
+            return manager;
+        }
+
+    public:
+        /**
+        * @param seconds Idle time after which the data of an unbound buffer is dropped, 0 never drops idle buffers.
+        */
+        void setIdleTime(double seconds) { idleTime = seconds; }
+
+        /**
+        * @param bytes Memory budget of the decoded data of all the buffers, 0 for no budget.
+        */
+        void setBudget(unsigned long long bytes) { budget = bytes; }
+
+        /**
+        * @param percent System memory load [1..100] from which the idle buffers are dropped early, 100 disables it.
+        */
+        void setMemoryLoadLimit(unsigned int percent) { memoryLoadLimit = percent; }
+
+        /**
+        * Applies the eviction policy to all the loaded buffers.
+        */
+        void update();
+
+        ResidencyStatistics getStatistics() const;
+
+    public: // [internal] used by the SoundBuffers
+        void registerBuffer(SoundBuffer* buffer);
+        void unregisterBuffer(SoundBuffer* buffer);
+
+        void onEvicted(unsigned long long bytes) { ++evictions; evictedBytes += bytes; }
+        void onRehydrated() { ++rehydrations; }
+
+    private:
+        ResidencyManager();
+
+        std::mutex mutex;
+        std::vector<SoundBuffer*> buffers;
+
+        std::atomic<double> idleTime;
+        std::atomic<unsigned long long> budget;
+        std::atomic<unsigned int> memoryLoadLimit;
+
+        std::atomic<unsigned long long> evictions;
+        std::atomic<unsigned long long> rehydrations;
+        std::atomic<unsigned long long> evictedBytes;
+        std::atomic<unsigned long long> residentBytes;
+    };
+}
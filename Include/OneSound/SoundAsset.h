@@ -0,0 +1,113 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#pragma once
+
+#include "OneSound\Export.h"
+
+#include "OneSound\Utility.h"
+
+#include "OneSound\SoundType\SoundBuffer.h"
+
+namespace onesnd
+{
+    /**
+    * How the data of a SoundAsset is kept in memory.
+    */
+    enum class Residency
+    {
+        Decoded,    // the whole sound decoded into a SoundBuffer
+        Compressed, // the encoded file in memory, decoded by a SoundStream while playing
+        Streamed,   // a SoundStream that reads the file from disk while playing
+    };
+
+    /**
+    * A sound file whose residency is picked automatically.
+    * The choice depends on the decoded size of the sound, the number of instances
+    * expected to play it at once and the global memory budget of all the assets:
+    * small and often played sounds are decoded, large sounds are kept encoded in memory
+    * while there's budget for them and streamed from disk when there's not.
+    *
+    * The asset hands out the SoundBuffer or SoundStream to bind to the SoundObjects. An asset that isn't
+    * bound to any SoundObject switches its residency on rebalance(), e.g. after the budget changed.
+    */
+    class ONE_SOUND_API SoundAsset
+    {
+    public:
+        /**
+        * Creates a new asset for the specified file, with the residency the budget allows.
+        * @param file Sound file to load
+        * @param instances Number of SoundObjects expected to play the sound at the same time
+        * @return The new asset. Throws if the file can't be opened.
+        */
+        static std::shared_ptr<SoundAsset> create(const fs::path& file, int instances = 1);
+
+        ~SoundAsset();
+
+        /**
+        * @return The SoundBuffer or SoundStream to bind to the SoundObjects.
+        */
+        std::shared_ptr<SoundBuffer> get() const { return sound; }
+
+        Residency getResidency() const { return residency; }
+        const fs::path& getFile() const { return file; }
+
+        /**
+        * @return Memory the asset is charged in the budget, in bytes.
+        */
+        unsigned long long getCharge() const { return charge; }
+
+        /**
+        * Switches the asset to the specified residency.
+        * @return FALSE if the sound is still bound to a SoundObject or can't be loaded this way.
+        */
+        bool setResidency(Residency mode);
+
+        /**
+        * Sets the memory budget of all the assets, 0 for no budget. Call rebalance() to apply it to the existing assets.
+        * @param bytes Memory budget in bytes
+        */
+        static void setBudget(unsigned long long bytes);
+        static unsigned long long getBudget();
+
+        /**
+        * Picks the residency of all the existing unbound assets again.
+        */
+        static void rebalance();
+
+        /**
+        * Picks the residency for a sound.
+        * @param decodedBytes Size of the decoded PCM data
+        * @param encodedBytes Size of the encoded file
+        * @param bytesPerSecond PCM data rate, it sets the size of the stream buffers
+        * @param instances Number of SoundObjects expected to play the sound at the same time
+        * @param available Budget left for this sound in bytes
+        */
+        static Residency choose(unsigned long long decodedBytes, unsigned long long encodedBytes,
+                                unsigned long long bytesPerSecond, int instances, unsigned long long available);
+
+    private:
+        SoundAsset(const fs::path& file, int instances);
+
+        // loads the data without the lock, then swaps it in if the asset is still unbound
+        bool switchTo(Residency mode);
+        std::shared_ptr<SoundBuffer> load(Residency mode) const;
+
+        static unsigned long long chargeOf(Residency mode, unsigned long long decodedBytes, unsigned long long encodedBytes,
+                                           unsigned long long bytesPerSecond, int instances);
+
+        fs::path file;
+        int instances;
+        unsigned long long decodedBytes;
+        unsigned long long encodedBytes;
+        unsigned long long bytesPerSecond;
+
+        Residency residency;
+        unsigned long long charge;
+        std::shared_ptr<SoundBuffer> sound;
+        std::weak_ptr<SoundAsset> self; // keeps the asset alive while rebalance() switches it without the lock
+    };
+}
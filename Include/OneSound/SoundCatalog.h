@@ -0,0 +1,55 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#pragma once
+
+#include "OneSound\Export.h"
+
+#include "OneSound\Utility.h"
+
+#include "OneSound\StreamType\AudioStream.h"
+
+namespace onesnd
+{
+    /**
+    * Format and metadata of a sound file, read from its headers without decoding any audio.
+    */
+    struct SoundInfo
+    {
+        fs::path file;
+        std::string decoder;            // name of the decoder in the DecoderRegistry
+        int channels = 0;
+        int sampleRate = 0;
+        int bitsPerSample = 0;          // of the decoded PCM data
+        unsigned long long frames = 0;  // exact number of sample frames
+        unsigned long long fileSize = 0;
+        SoundTags tags;                 // ID3 tags or Vorbis comments
+        std::string error;              // why the file couldn't be probed, empty if it could
+
+        bool IsValid() const { return error.empty(); }
+
+        double Duration() const { return sampleRate ? double(frames) / sampleRate : 0.0; }
+    };
+
+    /**
+    * Reads the format, exact length and tags of a sound file, from the mounted packs or from disk.
+    * Only the headers are parsed; MP3 files are scanned frame by frame for the exact length, but not decoded.
+    * @param file Sound file to probe
+    * @return The info of the file. Never throws, the error is reported in SoundInfo::error.
+    */
+    ONE_SOUND_API SoundInfo probeSound(const fs::path& file);
+
+    /**
+    * Probes all the sound files of a directory in parallel.
+    * The probes are mostly waiting for the disk, so more threads run than there are cores
+    * to keep the disk queue full while the others parse headers.
+    * @param directory Directory on disk to scan
+    * @param recursive TRUE to scan the subdirectories as well
+    * @param threads Number of threads probing files, 0 for twice the number of cores
+    * @return The info of every file with an extension known to the DecoderRegistry, in directory order.
+    */
+    ONE_SOUND_API std::vector<SoundInfo> scanSounds(const fs::path& directory, bool recursive = true, unsigned threads = 0);
+}
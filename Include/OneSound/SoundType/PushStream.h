@@ -0,0 +1,152 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#pragma once
+
+#include "OneSound\Export.h"
+
+#include "OneSound\Utility.h"
+
+#include "OneSound\SoundType\SoundBuffer.h"
+
+#include <atomic>
+#include <functional>
+
+namespace onesnd
+{
+    /**
+    * Counters of a PushStream, for tuning the latency and the watermarks.
+    */
+    struct PushStats
+    {
+        unsigned long long bytesWritten = 0;
+        unsigned long long bytesPlayed = 0;
+        unsigned long long bytesDropped = 0;    // written while the ring was full
+        unsigned underruns = 0;                 // times the voice ran out of data
+    };
+
+    /**
+    * PushStream plays PCM data the application produces at runtime: voice chat, synthesizers, video decoders.
+    * The data is written into a lock-free ring from a single producer thread and XAudio2 plays it straight
+    * from the ring, so the write is the only copy. Only one SoundObject can be bound to a PushStream.
+    */
+    class ONE_SOUND_API PushStream : public SoundBuffer
+    {
+    public:
+        using Callback = std::function<void(PushStream& stream)>;
+
+    protected:
+        std::vector<unsigned char> ring;
+        int period;                             // bytes submitted to the voice at once
+
+        // the producer only moves writePos, the consumer moves readPos and submitPos
+        std::atomic<unsigned long long> writePos;   // end of the written data
+        std::atomic<unsigned long long> readPos;    // end of the data XAudio2 finished playing
+        unsigned long long submitPos;               // end of the data submitted to the voice
+
+        // sizes of the buffers the voice still plays, in submit order
+        int submitted[XAUDIO2_MAX_QUEUED_BUFFERS];
+        int submittedFirst;
+        int submittedCount;
+
+        std::atomic_flag pumping;               // held by the thread that submits data or consumes a buffer
+        SoundObject* bound;
+
+        int lowWatermark;                       // bytes
+        int highWatermark;                      // bytes
+        Callback onLow;
+        Callback onHigh;
+        std::atomic<bool> lowArmed;
+        std::atomic<bool> highArmed;
+
+        std::atomic<unsigned long long> bytesDropped;
+        std::atomic<unsigned> underruns;
+
+    public:
+        /**
+        * Creates a new PushStream for the specified format.
+        * @param frequency Sample rate of the written data in Hz
+        * @param channels Number of interleaved channels
+        * @param bitsPerSample 16 for PCM or 32 for float data
+        * @param latency Milliseconds of data submitted to the voice at once, half of the latency
+        *                plays while the other half is queued
+        * @param capacity Milliseconds of data the ring holds
+        */
+        PushStream(int frequency, int channels, int bitsPerSample = 16, int latency = 40, int capacity = 500);
+
+        /**
+        * Destroys the stream, it must not be bound anymore.
+        */
+        virtual ~PushStream();
+
+        /**
+        * Writes PCM frames into the ring. Call from a single producer thread at a time.
+        * @param data Interleaved frames in the format of the stream
+        * @param bytes Number of bytes to write, cut to whole frames
+        * @return Number of bytes written, less than requested if the ring is full (the rest counts as dropped).
+        */
+        int Write(const void* data, int bytes);
+
+        /**
+        * @return Number of bytes written, but not played yet.
+        */
+        int Buffered() const;
+
+        /**
+        * @return Number of bytes that can be written before the ring is full.
+        */
+        int Free() const;
+
+        /**
+        * Sets the callback invoked from the audio thread when the buffered data drops below the watermark,
+        * so the producer writes more. It fires once until the data rises above the watermark again.
+        * @note Set the callbacks before binding the stream.
+        */
+        void setLowWatermark(int milliseconds, Callback callback);
+
+        /**
+        * Sets the callback invoked from the producer thread when the buffered data rises above the watermark,
+        * so the producer slows down. It fires once until the data drops below the watermark again.
+        */
+        void setHighWatermark(int milliseconds, Callback callback);
+
+        /**
+        * @return The counters of this stream.
+        */
+        PushStats getStats() const;
+
+        /**
+        * @return Number of buffered PCM SAMPLES
+        */
+        virtual long long Size() const override;
+
+        virtual bool Unload() override;
+        virtual bool BindSource(SoundObject* so) override;
+        virtual bool UnbindSource(SoundObject* so) override;
+
+        /**
+        * Live data can't be rewound, this only submits the data written meanwhile.
+        */
+        virtual bool ResetBuffer(SoundObject* so) override;
+
+        /**
+        * Releases the ring space of the played buffer and submits the next data.
+        */
+        virtual void OnBufferEnd(SoundObject* so) override;
+
+    protected:
+        /**
+        * [internal] Submits the written data to the voice, if no other thread does it right now.
+        */
+        void Pump();
+
+        /**
+        * [internal] Submits the written data in whole periods, or all of it if the voice is about to run dry.
+        * [pumping held]
+        */
+        void Submit();
+    };
+}
@@ -12,12 +12,20 @@
 
 #include"OneSound\SoundType\SoundObject.h"
 
+#include "OneSound\LoadOptimizer.h"
+
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <chrono>
+
 namespace onesnd
 {
     struct XABuffer;
     /**
     * A simple SoundBuffer designed for loading small sound files into a static buffer.
     * Should be used for sound files smaller than 64KB (1.5s @ 41kHz).
+    * SoundAsset picks between a SoundBuffer and a SoundStream automatically.
     */
     class ONE_SOUND_API SoundBuffer
     {
@@ -25,7 +33,68 @@ namespace onesnd
         // number of references of this buffer held by SoundObjects; 
         // NOTE: SoundBuffer can't be unloaded until referance_count == 0.
         int referance_count;
-        XABuffer* xaBuffer;
+        XABuffer* xaBuffer;                 // written under lazyMutex on the thread that uses the buffer,
+                                            // the engine and decode threads only read it under lazyMutex
+
+        // lazy loading: Load only probes the format, the data is decoded on first use
+        fs::path sourceFile;                // file the data is decoded from, lazy and evicted buffers decode it again
+        WAVEFORMATEX probedFormat;          // format of the data that isn't decoded (anymore)
+        int probedBytes;                    // size of the data that isn't decoded (anymore)
+        std::future<void> pending;          // decode in progress, leaves its data in decoded
+        XABuffer* decoded;                  // [lazyMutex] data of a finished decode, until Resolve takes it over
+        XABuffer* headBuffer;               // [lazyMutex] beginning of the sound, played while the decode finishes
+        std::vector<SoundObject*> headBound;// [lazyMutex] objects that play the head and wait for the rest
+        std::vector<SoundObject*> headEnded;// [lazyMutex] objects that finished the head before the decode, it queues their rest
+        mutable std::mutex lazyMutex;
+
+        std::chrono::steady_clock::time_point lastUsed; // last time a SoundObject bound, reset or unbound the buffer
+        bool evicted;                       // the data was dropped by the ResidencyManager
+
+        LoadOptimization optimization;      // passes run over the decoded data, again when evicted data is decoded
+        LoadReport loadReport;              // what the passes did
+
+        std::atomic<float> normalizationGain; // loudness normalization, applied by the SoundObjects on top of their volume
+        bool normalized;                    // the gain was looked up or measured
+
+        /**
+        * [internal] Decodes a whole sound file, through the PCM cache if it's enabled.
+        * @return A new buffer with the decoded data, NULL if the file can't be decoded.
+        */
+        XABuffer* Decode(const fs::path& file);
+
+        /**
+        * [internal] Runs the load-time optimization of this buffer over freshly decoded data.
+        * @return The optimized buffer, the decoded one is destroyed if it was replaced.
+        */
+        XABuffer* Optimize(XABuffer* buffer);
+
+        /**
+        * [internal] Finds the loudness normalization gain of the file, measures the data if it isn't cached.
+        * @return The same buffer.
+        */
+        XABuffer* Normalize(const fs::path& file, XABuffer* buffer);
+
+        /**
+        * [internal] Takes over the data of a finished lazy decode. Never called from the engine thread.
+        * @param wait TRUE to wait for the decode to finish, without holding lazyMutex
+        * @return TRUE if the data is decoded.
+        */
+        bool Resolve(bool wait);
+
+        /**
+        * [internal] Submits the beginning of the sound while the decode is still running.
+        */
+        bool BindHead(SoundObject* so);
+
+        /**
+        * [internal][lazyMutex] Submits the data after the head.
+        */
+        void SubmitRest(SoundObject* so, XABuffer* data);
+
+        /**
+        * [internal][lazyMutex] Number of bytes of the decoded data and the head.
+        */
+        int residentBytes() const;
 
     public:
 
@@ -45,7 +114,10 @@ namespace onesnd
         */
         virtual ~SoundBuffer();
 
-        XABuffer* getXABuffer() const { return xaBuffer; }
+        /**
+        * @return Decoded data of this buffer. Waits for the decode of a lazily loaded buffer.
+        */
+        XABuffer* getXABuffer();
 
         /**
         * @return Frequency in Hz of this SoundBuffer data
@@ -53,12 +125,12 @@ namespace onesnd
         int Frequency() const;
 
         /**
-        * @return Number of bits in a sample of this SoundBuffer data (8 or 16)
+        * @return Number of bits in a sample of this SoundBuffer data (8, 16 or 32 for pre-baked float data)
         */
         int SampleBits() const;
 
         /**
-        * @return Number of bytes in a sample of this SoundBuffer data (1 or 2)
+        * @return Number of bytes in a sample of this SoundBuffer data (1, 2 or 4)
         */
         int SampleBytes() const;
 
@@ -85,7 +157,7 @@ namespace onesnd
         /**
         * @return Size of this SoundBuffer in PCM SAMPLES
         */
-        virtual int Size() const;
+        virtual long long Size() const;
 
         /**
         * @return Number of SoundObjects that still reference this SoundBuffer.
@@ -115,6 +187,85 @@ namespace onesnd
         */
         virtual bool Load(const fs::path& file);
 
+        /**
+        * Loads this SoundBuffer with data found in the specified file.
+        * @param file Sound file to load
+        * @param lazy TRUE to only probe the format now and decode the data on the first play or prefetch()
+        * @return TRUE if loading succeeded (or the file was successfully probed).
+        */
+        bool Load(const fs::path& file, bool lazy);
+
+        /**
+        * Loads this SoundBuffer and optimizes the decoded data, e.g. with the settings of a sound category.
+        * @note The data is decoded right away, the passes need the whole sound to analyze it.
+        * @param file Sound file to load
+        * @param options Optimization passes to run over the decoded data
+        * @return TRUE if loading succeeded and a valid buffer was created.
+        */
+        bool Load(const fs::path& file, const LoadOptimization& options);
+
+        /**
+        * @return What the load-time optimization did to this buffer.
+        */
+        const LoadReport& getLoadReport() const { return loadReport; }
+
+        /**
+        * @return Linear gain the SoundObjects apply to normalize the loudness of this sound, 1.0 if not normalized.
+        * @note Lazily loaded buffers know the gain once their data is decoded.
+        */
+        float getNormalizationGain() const { return normalizationGain; }
+
+        /**
+        * Starts decoding the data of a lazily loaded buffer in the background.
+        * Call this when the sound is about to be played, so the first play doesn't wait.
+        */
+        void prefetch();
+
+        /**
+        * @return TRUE if the data of this buffer is decoded and resident.
+        */
+        bool isResident() const;
+
+        /**
+        * @return Number of bytes of decoded data this buffer holds in memory.
+        */
+        int ResidentBytes() const;
+
+        /**
+        * @return Last time a SoundObject used this buffer.
+        */
+        std::chrono::steady_clock::time_point getLastUsed() const { return lastUsed; }
+
+        /**
+        * Drops the decoded data of an unbound buffer. The format stays available
+        * and the data is decoded again the next time the buffer is bound.
+        * @return TRUE if the data was dropped, FALSE if the buffer is bound or can't be decoded again.
+        */
+        bool Evict();
+
+        /**
+        * Sets if Load(file) loads the SoundBuffers lazily. Disabled by default.
+        */
+        static void setLazyLoading(bool lazy);
+
+        /**
+        * Sets the length of the head a lazy buffer plays while its decode finishes.
+        * @param milliseconds Length of the head, 0 makes the first play wait for the decode
+        */
+        static void setLazyHead(int milliseconds);
+
+        /**
+        * Sets the optimization Load(file) runs over the decoded data. Disabled by default.
+        * Buffers loaded with an optimization are never lazy.
+        */
+        static void setLoadOptimization(const LoadOptimization& options);
+        static LoadOptimization getLoadOptimization();
+
+        /**
+        * @return Number of bytes the load-time optimization saved over all the loaded buffers.
+        */
+        static long long getBytesSaved();
+
         /**
         * Tries to release the underlying sound buffer and free the memory.
         * @note This function will fail if refCount > 0. This means there are SoundObjects still using this SoundBuffer
@@ -143,5 +294,26 @@ namespace onesnd
         * @return TRUE if reset was successful
         */
         virtual bool ResetBuffer(SoundObject* so);
+
+        /**
+        * Called when a buffer of this sound finished playing on the specified SoundObject.
+        * Streams queue their next buffer here. Runs on the engine thread and never waits for a decode:
+        * a head that ends before the decode leaves the rest to the decode task.
+        * @param so SoundObject that played the buffer
+        */
+        virtual void OnBufferEnd(SoundObject* so);
+
+        /**
+        * Sets the volume of the voice of a SoundObject: its own volume times the normalization gain of this sound.
+        * A lazy decode applies it again to the objects that bound before it found the gain.
+        * @param so SoundObject bound to this buffer
+        */
+        void ApplyVolume(SoundObject* so);
+
+        /**
+        * [internal] Stops continuing the head of a lazy buffer on the specified SoundObject,
+        * called before its queued buffers are flushed.
+        */
+        void CancelHead(SoundObject* so);
     };
 }
\ No newline at end of file
@@ -12,6 +12,8 @@
 
 #include "OneSound\SoundType\SoundBuffer.h"
 
+#include <atomic>
+
 namespace onesnd
 {
     /** 
@@ -24,6 +26,7 @@ namespace onesnd
 
         IXAudio2SourceVoice* source;		// the sound source generator (interfaces XAudio2 to generate waveforms)
         SoundObjectState* state;			// Holds and manages the current state of a SoundObject
+        std::atomic<float> userVolume;		// volume set by the user, the voice plays it times the normalization gain
 
         X3DAUDIO_EMITTER Emitter;			// 3D sound emitter data (this object)
 
@@ -65,6 +68,12 @@ namespace onesnd
         */
         bool isEOS() const;
 
+        /**
+        * @return TRUE while a play, rewind or seek of a stream still decodes its first buffers in the background.
+        *         The calls return at once and the playback starts as soon as the buffers are queued.
+        */
+        bool isPending() const;
+
         /**
         * Starts playing the sound. If the sound is already playing, it is rewinded and played again from the start.
         */
@@ -127,30 +136,32 @@ namespace onesnd
         * Indicates the gain (volume amplification) applied. Range [0.0f .. 1.0f]
         * Each division by 2 equals an attenuation of -6dB. Each multiplicaton with 2 equals an amplification of +6dB.
         * A value of 0.0 is meaningless with respect to a logarithmic scale; it is interpreted as zero volume - the channel is effectively disabled.
+        * The loudness normalization gain of the sound (see LoudnessNormalizer) is applied on top.
         * @param gain Gain value between 0.0..1.0
         */
         void setVolume(const float& gain);
 
         /**
-        * @return Current gain value of this source
+        * @return Current gain value of this source, without the loudness normalization
         */
         float getVolume() const;
 
         /**
         * @return Gets the current playback position in the SoundBuffer or SoundStream in SAMPLES
         */
-        int getPlaybackPosition() const;
+        long long getPlaybackPosition() const;
 
         /**
         * Sets the playback position of the underlying SoundBuffer or SoundStream in SAMPLES
+        * Streams return at once and decode the new position in the background (see isPending).
         * @param seekpos Position in SAMPLES where to seek in the SoundBuffer or SoundStream [0..PlaybackSize]
         */
-        void setPlaybackPosition(int seekpos);
+        void setPlaybackPosition(long long seekpos);
 
         /**
         * @return Playback size of the underlying SoundBuffer or SoundStream in SAMPLES
         */
-        int getPlaybackSize() const;
+        long long getPlaybackSize() const;
 
         /**
         * @return Number of samples processed every second (aka SampleRate or Frequency)
@@ -12,38 +12,69 @@
 
 #include "OneSound\SoundType\SoundBuffer.h"
 
+#include "OneSound\StreamType\AudioStream.h"
+
 namespace onesnd
 {
     /**
     * SoundStream stream audio data from a file source.
     * Extremely useful for large file playback. Even a 4m long mp3 can take over 40mb of ram.
     * Multiple sources can be bound to this stream.
+    * The stream keeps a short head of decoded data resident (see setStreamHead), so play and rewind
+    * submit it at once and the rest of the stream is decoded in the background while the head plays.
+    * Seeks decode in the background as well, see IsPending.
+    * While the IOScheduler is enabled, the streams read from disk decode all their buffers through it,
+    * due when the voice would run out of queued data, and keep a third buffer queued, so a refill
+    * can wait behind other requests for a whole buffer.
     */
     class ONE_SOUND_API SoundStream : public SoundBuffer
     {
     protected:
+        // buffers a SoundObject decodes in the background after a play, rewind or seek;
+        // buffers that end while it runs are refilled by the job, so the voice callback never waits for it
+        struct STREAM_JOB
+        {
+            std::shared_future<void> done;
+            bool cancelled = false;             // [restMutex] the data was cleared, the job submits nothing more
+            bool finished = false;              // [restMutex] the job queued its last buffer, the next buffer end takes it over
+            std::vector<XABuffer*> submitted;   // [restMutex] buffers the job queued on the voice so far
+            long long next = 0;                 // [restMutex] stream position after the submitted buffers
+            int queued = 0;                     // buffers of the object on the voice when the job started
+            int ended = 0;                      // [restMutex] buffers that ended before the job was taken over
+            int depth = 2;                      // buffers the job leaves queued, counting the playing one
+            unsigned long long request = 0;     // id of the job in the IOScheduler, 0 if it runs on its own thread
+        };
+
         struct SO_ENTRY
         {
             SoundObject* obj;
-            int base; // current PCM block offset
-            int next; // the next PCM block offset to load
+            AudioStream* cursor; // decoder of this object, shares the source with alStream
+            long long base; // current PCM block offset
+            long long next; // the next PCM block offset to load
 
             XABuffer* front;    // currently playing buffer - frontbuffer
             XABuffer* back;	    // enqueued backbuffer
+            XABuffer* ahead;    // enqueued after the backbuffer, while the IOScheduler refills the stream
             bool busy;          // the stream is busy on an internal operation, all other operations are ignored
+            std::shared_ptr<STREAM_JOB> job; // latest background decode on the cursor, NULL if there is none
 
-            inline SO_ENTRY(SoundObject* obj) : 
+            inline SO_ENTRY(SoundObject* obj, AudioStream* cursor) : 
                 obj(obj), 
+                cursor(cursor), 
                 base(0), 
                 next(0), 
                 front(0), 
                 back(0), 
+                ahead(0),
                 busy(false)
             { }
         };
 
         std::vector<SO_ENTRY> alSources;    // bound sources
-        AudioStream* alStream;              // streamer object
+        AudioStream* alStream;              // streamer object, decodes the first buffer and owns the source
+        std::vector<char> encoded;          // encoded file data, if the stream is decoded from memory
+        fs::path streamFile;                // file the stream was loaded from, reopened when the quality changes
+        std::mutex restMutex;               // buffers of the jobs are taken over by the caller or by the voice callback
 
     public:
         /**
@@ -65,7 +96,7 @@ namespace onesnd
         /**
         * @return Size of this SoundStream in PCM SAMPLES
         */
-        virtual int Size() const override;
+        virtual long long Size() const override;
 
         /**
         * @return TRUE if this object is a Sound stream
@@ -80,6 +111,47 @@ namespace onesnd
         */
         virtual bool Load(const fs::path& file) override;
 
+        /**
+        * Initializes this SoundStream with the specified file, decoded at a reduced quality.
+        * The stream buffers hold one second of the decoded data, so they shrink along with the rate.
+        * @param file Sound file to load
+        * @param quality Quality to decode the stream at, e.g. Half for background chatter
+        * @return TRUE if loading succeeded and a stream was initialized.
+        */
+        bool Load(const fs::path& file, DecodeQuality quality);
+
+        /**
+        * Initializes this SoundStream with the specified file, loaded into memory still encoded.
+        * The stream is decoded from memory, so playback never touches the disk and costs
+        * only the size of the encoded file.
+        * @param file Sound file to load
+        * @param quality Quality to decode the stream at
+        * @return TRUE if loading succeeded and a stream was initialized.
+        */
+        bool LoadInMemory(const fs::path& file, DecodeQuality quality = DecodeQuality::Full);
+
+        /**
+        * Reopens the decoder of an unbound stream at another quality,
+        * e.g. when its sound moves far away or loses priority.
+        * @return FALSE if the stream is still bound to a SoundObject, its voices play the current format.
+        */
+        bool setQuality(DecodeQuality quality);
+
+        /**
+        * @return The quality the stream is decoded at.
+        */
+        DecodeQuality getQuality() const;
+
+        /**
+        * Sets the length of the decoded head every stream keeps resident, for the streams loaded after the call.
+        * Play and rewind submit the head at once and decode the rest of the stream in the background.
+        * The decoder of every object is opened and taken to the end of the head when it's bound,
+        * so the head only has to outlast the read and decode of one stream buffer.
+        * @param milliseconds Length of the head, 0 keeps a whole stream buffer (one second)
+        */
+        static void setStreamHead(int milliseconds);
+        static int getStreamHead();
+
         /**
         * Tries to release the underlying sound buffers and free the memory.
         * @note This function will fail if refCount > 0. This means there are SoundObjects still using this SoundStream
@@ -89,6 +161,8 @@ namespace onesnd
 
         /**
         * Binds a specific source to this SoundStream and increases the refCount.
+        * Opens the decoder cursor of the object and seeks it to the end of the head (or parks a snapshot there)
+        * on the calling thread, so the playback never waits for a cold decoder.
         * @param so SoundObject to bind to this SoundStream.
         * @return FALSE if the binding failed. TODO: POSSIBLE REASONS?
         */
@@ -109,6 +183,12 @@ namespace onesnd
         */
         virtual bool ResetBuffer(SoundObject* so) override;
 
+        /**
+        * Queues the next buffer of the stream for the SoundObject that finished a buffer.
+        * @param so SoundObject that played the buffer
+        */
+        virtual void OnBufferEnd(SoundObject* so) override;
+
         /**
         * Resets the stream by unloading previous buffers and requeuing the first two buffers.
         * @param so SoundObject to reset the stream for
@@ -135,13 +215,30 @@ namespace onesnd
         */
         SO_ENTRY* GetSOEntry(const SoundObject* so) const;
 
+        /**
+        * @param so SoundObject to check
+        * @return TRUE while a play, rewind or seek of the SoundObject still decodes its first buffers in the background,
+        *         or a refill waits in the IOScheduler.
+        */
+        bool IsPending(const SoundObject* so);
+
         /**
         * Seeks to the specified sample position in the stream.
+        * Returns at once, a short first buffer and a full one are decoded in the background (see IsPending).
         * @note The SoundObject will stop playing and must be manually restarted!
         * @param so SoundObject to perform seek on
         * @param samplepos Position in the stream in samples [0..SoundStream::Size()]
         */
-        void Seek(SoundObject* so, int samplepos);
+        void Seek(SoundObject* so, long long samplepos);
+
+        /**
+        * Keeps the decoder state of the SoundObject at the specified position,
+        * so seeking there later resumes at once (see AudioStream::Snapshot).
+        * @param so SoundObject to add the cue point for
+        * @param samplepos Position in the stream in samples [0..SoundStream::Size()]
+        * @return TRUE if the decoder keeps a snapshot at this position.
+        */
+        bool AddCuePoint(SoundObject* so, long long samplepos);
 
     protected:
         /**
@@ -158,7 +255,43 @@ namespace onesnd
         * @param streampos [optional] PCM byte position in stream where to seek data from.
         *                  If unspecified (default -1), stream will use the current streampos
         */
-        bool LoadStreamData(SO_ENTRY& so, int streampos = -1);
+        bool LoadStreamData(SO_ENTRY& so, long long streampos = -1);
+
+        /**
+        * [internal] Decodes buffers of the specified SoundObject in the background and queues them.
+        * The job starts after the previous job of the cursor, even if that one was cancelled.
+        * @param so SO_ENTRY handle to decode for
+        * @param streampos PCM byte position of the first buffer
+        * @param sizes Sizes of the buffers to decode, in bytes
+        * @param snapshot TRUE to keep a decoder snapshot at streampos (see AudioStream::Snapshot)
+        * @param deadline Milliseconds until the voice runs out of queued data
+        */
+        void StartJob(SO_ENTRY& so, long long streampos, std::vector<int> sizes, bool snapshot, int deadline);
+
+        /**
+        * [internal] @return TRUE if the IOScheduler decodes the refills of the specified SoundObject.
+        */
+        bool IsScheduled(const SO_ENTRY& so) const;
+
+        /**
+        * [internal] @return Milliseconds of data the voice of the specified SoundObject still has queued.
+        */
+        int QueuedMilliseconds(const SO_ENTRY& so) const;
+
+        /**
+        * [internal] Takes over the buffers of the finished background job of the specified SoundObject.
+        * Without waiting, the call stands for a buffer end: if the job is still decoding, it queues the refill
+        * of that buffer as well before it finishes.
+        * @param so SO_ENTRY handle of the job
+        * @param wait TRUE to wait for the job to finish
+        * @return TRUE if there is no job (anymore), FALSE if it's still decoding.
+        */
+        bool FinishJob(SO_ENTRY& so, bool wait);
+
+        /**
+        * [internal] Releases the decoder and the encoded data, after an unload or a failed load.
+        */
+        void Release();
 
         /**
         * [internal] Unloads all queued data for the specified SoundObject
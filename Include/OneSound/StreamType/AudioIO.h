@@ -0,0 +1,190 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#pragma once
+
+#include "OneSound\Export.h"
+
+#include "OneSound\Utility.h"
+
+namespace onesnd
+{
+    /**
+    * I/O interface which AudioStreams read their encoded data through.
+    * Every callback receives AudioIO::context, so the data may live anywhere:
+    * a file, a memory block, an archive or an application streaming system.
+    * The callbacks follow the semantics of the file_* functions in Utility.h.
+    */
+    struct ONE_SOUND_API AudioIO
+    {
+        void* context;                                          // user data, passed to every callback
+        int   (*read)(void* context, void* dst, size_t size);   // returns number of bytes read, 0 on end of data
+        long long (*seek)(void* context, long long offset, int whence); // returns the new position, -1 on error
+        long long (*tell)(void* context);                               // returns the current position
+        int   (*close)(void* context);                          // releases the context, can be NULL
+        AudioIO (*clone)(void* context);                        // opens another cursor over the same data, can be NULL
+
+        /**
+        * @return TRUE if this AudioIO can be read from.
+        */
+        inline bool IsValid() const
+        {
+            return read != nullptr;
+        }
+    };
+
+    /**
+    * Wraps an already opened file handle (see file_open_ro) into an AudioIO.
+    * The file is read by positional reads, so clones of the AudioIO share the handle.
+    * The handle is closed when the last of them is closed.
+    * @param handle Opened file handle
+    */
+    ONE_SOUND_API AudioIO makeFileIO(void* handle);
+
+    /**
+    * Opens the specified file for reading through an AudioIO.
+    * @param file Path to the file to open
+    * @return A valid AudioIO. Throws if the file can't be opened.
+    */
+    ONE_SOUND_API AudioIO openFileIO(const fs::path& file);
+
+    /**
+    * Opens the specified file for reading through a memory mapping.
+    * Only a window of the file is mapped at a time and moved along with the reads, so files
+    * of any size work in a 32-bit process and every read costs the same at any offset.
+    * Clones share the mapping and move their own window. Every cursor and parked snapshot
+    * of a stream is a clone, so keep the window small: a refill reads about a second of data.
+    * An empty file has nothing to map, it's opened as a plain file IO that reads nothing.
+    * @param file Path to the file to open
+    * @param window Size of the mapped window in bytes, rounded up to the allocation granularity
+    * @return A valid AudioIO. Throws if the file can't be opened or mapped.
+    */
+    ONE_SOUND_API AudioIO openMappedIO(const fs::path& file, size_t window = 1024 * 1024);
+
+    /**
+    * Sets if the loose files the streams open are memory mapped instead of read (see openMappedIO).
+    * Disabled by default. Mapped files are not buffered, the reads are served from the mapping.
+    */
+    ONE_SOUND_API void setMappedIO(bool enabled);
+    ONE_SOUND_API bool isMappedIO();
+
+    /**
+    * Creates an AudioIO that reads straight from a memory block. Data is not copied,
+    * so the memory must stay valid until the AudioIO is closed.
+    * @param data Beginning of the encoded audio data
+    * @param size Size of the data in bytes
+    */
+    ONE_SOUND_API AudioIO openMemoryIO(const void* data, size_t size);
+
+    /**
+    * Closes the AudioIO (if it has a close callback) and resets it to an invalid state.
+    */
+    ONE_SOUND_API void closeAudioIO(AudioIO& io);
+
+    /**
+    * Opens another independent cursor over the data of an AudioIO.
+    * The file handles, mappings and memory of the source are shared, not reopened.
+    * @return A new AudioIO positioned at the beginning, or an invalid AudioIO if the source can't be cloned.
+    */
+    ONE_SOUND_API AudioIO cloneAudioIO(const AudioIO& io);
+
+    /**
+    * Wraps an AudioIO into a buffered reader, so the many tiny reads and seeks
+    * of the decoders are served from memory. Two read-ahead buffers are kept:
+    * the current one and the previous one, so short seeks back don't touch the source.
+    * Both are filled on the reading thread when a read misses, there is no background prefetch
+    * (see AsyncIOService for that). The buffers are only allocated when they're first filled.
+    * Reads larger than the read-ahead size go straight to the source.
+    * @note The buffered reader takes ownership of the source io.
+    * @param io Source io to read from
+    * @param readAhead Size of a single read-ahead buffer in bytes [64KB..1MB]
+    */
+    ONE_SOUND_API AudioIO openBufferedIO(const AudioIO& io, size_t readAhead);
+
+    /**
+    * Sets the read-ahead size used for all the files the streams open.
+    * Disabled by default: probes, cursors and hashing passes open files as well and only read a little of them.
+    * @param bytes Read-ahead size in bytes, clamped to [64KB..1MB]. 0 disables buffering.
+    */
+    ONE_SOUND_API void setReadAheadSize(size_t bytes);
+
+    /**
+    * @return Current read-ahead size in bytes, 0 if buffering is disabled.
+    */
+    ONE_SOUND_API size_t getReadAheadSize();
+
+    /**
+    * Statistics of all the buffered readers, since the start or the last reset.
+    */
+    struct IOStatistics
+    {
+        unsigned long long requests;    // number of reads the decoders issued
+        unsigned long long hits;        // number of reads served completely from the read-ahead buffers
+        unsigned long long reads;       // number of reads passed to the source: from disk, or copies out of a pack or memory
+        unsigned long long bytes;       // number of bytes read from the source
+
+        /**
+        * @return Ratio of the reads served from memory [0..1]
+        */
+        inline double HitRate() const
+        {
+            return requests ? double(hits) / double(requests) : 0.0;
+        }
+    };
+
+    ONE_SOUND_API IOStatistics getIOStatistics();
+    ONE_SOUND_API void resetIOStatistics();
+
+    /**
+    * Timing of a simulated storage device, for reproducing streaming glitches on fast disks.
+    */
+    struct StorageProfile
+    {
+        int latency = 0;            // milliseconds every read waits before its data arrives
+        int jitter = 0;             // up to this many random milliseconds on top of the latency
+        size_t bandwidth = 0;       // bytes per second the device delivers to all the readers together, 0 for unlimited
+        float stallChance = 0.0f;   // chance [0..1] that a read stalls
+        int stallLength = 0;        // milliseconds a stalled read waits on top of the rest
+        unsigned seed = 1;          // the same seed replays the same delays for the same reads
+    };
+
+    /**
+    * Statistics of the simulated storage, since it was set or since the last reset.
+    */
+    struct StorageStatistics
+    {
+        unsigned long long reads;   // number of reads that went through the device
+        unsigned long long bytes;   // number of bytes they read
+        unsigned long long stalls;  // number of reads that stalled
+        double delay;               // milliseconds the reads were held back in total
+        double maxDelay;            // milliseconds the slowest read was held back
+    };
+
+    /**
+    * Puts a simulated storage device under all the files the streams open from now on (see VirtualFileSystem),
+    * below the read-ahead buffers. The device serves one read at a time: every read waits for the reads
+    * before it, then for the latency, the jitter, a possible stall and the transfer at the profile bandwidth.
+    * Changing the profile applies to the simulated files that are already open as well.
+    * @param profile Timing of the device
+    */
+    ONE_SOUND_API void setSimulatedStorage(const StorageProfile& profile);
+
+    /**
+    * Removes the simulated storage, the files opened through it read at full speed from now on.
+    */
+    ONE_SOUND_API void clearSimulatedStorage();
+    ONE_SOUND_API bool isStorageSimulated();
+
+    /**
+    * Wraps an AudioIO into the simulated storage device, if one is set.
+    * @note The wrapper takes ownership of the source io.
+    * @return The wrapped io, or the source io itself if no storage is simulated.
+    */
+    ONE_SOUND_API AudioIO openSimulatedIO(const AudioIO& io);
+
+    ONE_SOUND_API StorageStatistics getStorageStatistics();
+    ONE_SOUND_API void resetStorageStatistics();
+}
@@ -10,8 +10,25 @@
 
 #include <OneSound\Utility.h>
 
+#include "OneSound\StreamType\AudioIO.h"
+
 namespace onesnd
 {
+    /**
+    * How much work a decoder puts into a stream. Lower levels cost less CPU and memory,
+    * e.g. for distant or low-priority voices. Decoders that can't decode cheaper ignore it.
+    */
+    enum class DecodeQuality
+    {
+        Full,       // the native rate and channels
+        Half,       // half the native rate
+        Quarter,    // a quarter of the native rate
+        Mono,       // the native rate, the channels mixed to mono
+    };
+
+    // metadata of a sound file as (key, value) pairs in file order, e.g. ("TITLE", "Main Theme"), all text in UTF-8
+    using SoundTags = std::vector<std::pair<std::string, std::string>>;
+
     /**
     * Basic AudioStreamer class for streaming audio data.
     * Data is decoded and presented in simple wave PCM format.
@@ -23,12 +40,14 @@ namespace onesnd
     {
     protected:
         int* FileHandle;				// internally interpreted file handle
-        int stream_size;					// size of the audiostream in PCM bytes, not File bytes
-        int stream_position;					// current stream position in PCM bytes
+        AudioIO SourceIO;				// I/O the encoded data is read through
+        long long stream_size;			// size of the audiostream in PCM bytes, not File bytes
+        long long stream_position;		// current stream position in PCM bytes
         unsigned int sample_rate;		// frequency (or rate) of the sound data, usually 20500 or 41000 (20.5kHz / 41kHz)
         unsigned char NumChannels;		// number of channels in a sample block, usually 1 or 2 (Mono / Stereo)
         unsigned char SampleSize;		// size (in bytes) of a sample, usually 1 to 2 bytes (8bit:1 / 16bit:2)
         unsigned char SampleBlockSize;	// size (in bytes) of a sample block: SampleSize * NumChannels
+        DecodeQuality quality;			// decode quality requested for the next open
     public:
         /**
         * Creates a new uninitialized AudioStreamer.
@@ -55,7 +74,23 @@ namespace onesnd
         * @param file Audio file to open
         * @return TRUE if stream is successfully opened and initialized. FALSE if the stream open failed or it's already opened.
         */
-        virtual bool OpenStream(const fs::path& file);
+        bool OpenStream(const fs::path& file);
+
+        /**
+        * Opens a new stream that reads straight from memory. Data is not copied.
+        * @param data Encoded audio data, must stay valid until the stream is closed
+        * @param size Size of the data in bytes
+        * @return TRUE if stream is successfully opened and initialized. FALSE if it's already opened.
+        */
+        bool OpenStream(const void* data, size_t size);
+
+        /**
+        * Opens a new stream that reads through the specified I/O callbacks.
+        * @note The stream takes ownership of the AudioIO and closes it, even if the open fails.
+        * @param io I/O callbacks and their context
+        * @return TRUE if stream is successfully opened and initialized. FALSE if it's already opened.
+        */
+        virtual bool OpenStream(const AudioIO& io);
 
         /**
         * Closes the stream and releases all resources held.
@@ -77,7 +112,52 @@ namespace onesnd
         * @param streampos Position in the stream to seek to in BYTES
         * @return The actual position where seeked, or 0 if out of bounds (this also means the stream was reset to 0).
         */
-        virtual unsigned int Seek(unsigned int streampos);
+        virtual unsigned long long Seek(unsigned long long streampos);
+
+        /**
+        * Creates a new decoder cursor over the source data of this stream.
+        * The cursor shares the file handle, pack or memory of this stream and takes over
+        * its format, but decodes on its own, so every cursor can read sequentially at its own position.
+        * @return A new opened stream of the same type, or NULL if the source can't be shared.
+        */
+        virtual AudioStream* CreateCursor() const;
+
+        /**
+        * Keeps the decoder state at the specified position, so a later Seek to exactly
+        * this position resumes decoding without seeking (loop points, cue points).
+        * The base implementation does nothing, because PCM streams seek for free.
+        * @param streampos Position in the stream in BYTES
+        * @return TRUE if the stream keeps a snapshot at this position.
+        */
+        virtual bool Snapshot(unsigned long long streampos);
+
+        /**
+        * Makes Size() exact for formats whose header only gives an estimate.
+        * The base implementation does nothing, because the header of PCM streams has the exact size.
+        * @note This may read the whole file, but it never decodes any audio.
+        * @return TRUE if Size() is exact.
+        */
+        virtual bool ScanLength();
+
+        /**
+        * Reads the metadata of the stream (ID3 tags, Vorbis comments) without decoding any audio.
+        * @return The tags of the stream, empty if the format has none.
+        */
+        virtual SoundTags ReadTags();
+
+        /**
+        * Sets the quality the stream is decoded at. Takes effect on the next OpenStream.
+        * Check Frequency() and Channels() after the open for what the decoder delivers.
+        */
+        inline void SetQuality(DecodeQuality level)
+        {
+            quality = level;
+        }
+
+        inline DecodeQuality Quality() const
+        {
+            return quality;
+        }
 
         /**
         * @return TRUE if the Stream has been opened. FALSE if it remains unopened.
@@ -98,7 +178,7 @@ namespace onesnd
         /**
         * @return Size of the stream in PCM bytes, not File bytes
         */
-        inline int Size() const
+        inline long long Size() const
         {
             return stream_size;
         }
@@ -106,15 +186,23 @@ namespace onesnd
         /**
         * @return Position of the stream in PCM bytes
         */
-        inline int Position() const
+        inline long long Position() const
         {
             return stream_position;
         }
 
+        /**
+        * @return Position of the decoder in the encoded source data in bytes, -1 if the source can't tell
+        */
+        inline long long SourcePosition() const
+        {
+            return SourceIO.tell ? SourceIO.tell(SourceIO.context) : -1;
+        }
+
         /**
         * @return Number of PCM bytes still available in the stream
         */
-        inline int Available() const
+        inline long long Available() const
         {
             return stream_size - stream_position;
         }
@@ -169,26 +257,22 @@ namespace onesnd
     };
 
     /**
-    * Automatically creates a specific AudioStreamer
-    * instance depending on the specified file extension
-    * or by the file header format if extension not specified.
-    * @note The Stream is not Opened! You must do it manually.
-    * @param file Audio file string
-    * @return New dynamic instance of a specific AudioStreamer. Or NULL if the file format cannot be detected.
+    * Opens a sound file with the decoder its format requires, see DecoderRegistry.
+    * The file is opened once: its first bytes pick the decoder, which then decodes from the same handle.
+    * @param file Audio file to open, from the mounted packs or from disk
+    * @param quality Quality to decode the stream at
+    * @return New dynamic instance of an opened AudioStream. Or NULL if the file format cannot be detected.
     */
-    AudioStream* createAudioStream(const char* file);
+    ONE_SOUND_API AudioStream* openAudioStream(const fs::path& file, DecodeQuality quality = DecodeQuality::Full);
 
     /**
-    * Automatically creates a specific AudioStreamer
-    * instance depending on the specified file extension
-    * or by the file header format if extension not specified.
-    *
-    * This initializes an already existing AudioStream instance.
-    *
-    * @note The Stream is not Opened! You must do it manually.
-    * @param as AudioStream instance to create the streamer into. Can be any other AudioStream instance.
-    * @param file Audio file string
-    * @return TRUE if the instance was created.
+    * Opens a stream over an AudioIO with the decoder its format requires, see DecoderRegistry.
+    * @note The stream takes ownership of the AudioIO.
+    * @param io I/O positioned at the beginning of the encoded data
+    * @param hint File name, its extension picks the decoder if the data isn't recognized
+    * @param quality Quality to decode the stream at
+    * @return New dynamic instance of an opened AudioStream. Or NULL if the format cannot be detected.
     */
-    bool createAudioStream(AudioStream* as, const char* file);
+    ONE_SOUND_API AudioStream* openAudioStream(const AudioIO& io, const fs::path& hint = fs::path(),
+                                               DecodeQuality quality = DecodeQuality::Full);
 }
\ No newline at end of file
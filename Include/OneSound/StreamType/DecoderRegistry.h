@@ -0,0 +1,106 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#pragma once
+
+#include "OneSound\Export.h"
+
+#include "OneSound\StreamType\AudioStream.h"
+
+#include <functional>
+#include <mutex>
+
+namespace onesnd
+{
+    /**
+    * Registry of the decoders the sound files are opened with.
+    * Every decoder registers a sniffer that recognizes its format by the first bytes of a file
+    * and a factory that creates its AudioStream. A file is opened once: the sniffers look at the
+    * beginning of the opened file and the chosen decoder takes over the same handle.
+    *
+    * WAV, OGG and MP3 decoders are registered by default. Decoders added later are tried first,
+    * so applications can add their own formats or replace the built-in decoders.
+    */
+    class ONE_SOUND_API DecoderRegistry
+    {
+    public:
+        // number of bytes the sniffers get to see
+        static const size_t SniffSize = 64;
+
+        using Sniffer = std::function<bool(const unsigned char* head, size_t size)>;
+        using Factory = std::function<AudioStream*()>;
+
+        static DecoderRegistry& instance()
+        {
+            static DecoderRegistry registry;
+            return registry;
+        }
+
+    public:
+        /**
+        * Registers a decoder.
+        * @param name Name of the decoder, a decoder with the same name is replaced
+        * @param sniff Returns TRUE if the first bytes of a file are in the format of this decoder
+        * @param create Creates a new unopened AudioStream of this decoder
+        * @param extensions File extensions (e.g. ".flac") tried if no sniffer recognizes a file
+        */
+        void add(const std::string& name, const Sniffer& sniff, const Factory& create,
+                 const std::vector<std::string>& extensions = {});
+
+        /**
+        * Removes the decoder with the specified name.
+        */
+        void remove(const std::string& name);
+
+        /**
+        * Creates the decoder for an AudioIO and opens the stream on it.
+        * @note The stream takes ownership of the AudioIO, it's closed if no decoder is found.
+        * @param io I/O positioned at the beginning of the encoded data
+        * @param hint File name, its extension is used if no sniffer recognizes the data
+        * @param quality Quality the stream is decoded at
+        * @return A new opened stream, NULL if the format is unknown. Throws if the decoder fails to open the data.
+        */
+        AudioStream* open(const AudioIO& io, const fs::path& hint = fs::path(), DecodeQuality quality = DecodeQuality::Full);
+
+        /**
+        * Opens a sound file from the mounted packs or from disk and creates its decoder.
+        * @return A new opened stream, NULL if the format is unknown. Throws if the file can't be opened.
+        */
+        AudioStream* open(const fs::path& file, DecodeQuality quality = DecodeQuality::Full);
+
+        /**
+        * @return Name of the decoder that recognizes the data, an empty string if none does.
+        */
+        std::string identify(const unsigned char* head, size_t size, const fs::path& hint = fs::path()) const;
+
+        /**
+        * @return TRUE if a registered decoder lists the extension of the file.
+        */
+        bool knowsExtension(const fs::path& file) const;
+
+        /**
+        * Creates and destroys one stream of every decoder, so the decoder libraries are loaded
+        * before streams are opened on several threads at once.
+        */
+        void preload();
+
+    private:
+        DecoderRegistry();
+
+        struct Decoder
+        {
+            std::string name;
+            Sniffer sniff;
+            Factory create;
+            std::vector<std::string> extensions;
+        };
+
+        const Decoder* find(const unsigned char* head, size_t size, const fs::path& hint) const; // [lock held]
+
+        mutable std::mutex mutex;
+        std::vector<Decoder> decoders; // in the order they are tried
+    };
+}
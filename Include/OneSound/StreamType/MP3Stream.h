@@ -12,6 +12,22 @@
 
 namespace onesnd
 {
+    /**
+    * Throughput of the mpg123 decoders measured on this CPU.
+    */
+    struct DecoderPerformance
+    {
+        struct Candidate
+        {
+            std::string decoder;        // mpg123 decoder name, e.g. "generic", "SSE", "AVX"
+            double samplesPerSecond;    // sample frames decoded per second of CPU time
+        };
+
+        std::string decoder;            // decoder the MP3 streams are opened with, empty before the calibration
+        double samplesPerSecond = 0.0;
+        std::vector<Candidate> candidates;
+    };
+
     /**
     * AudioStream for streaming file in WAV format.
     * The stream is decoded into PCM format.
@@ -37,12 +53,15 @@ namespace onesnd
 
 
 
+        using AudioStream::OpenStream;
+
         /**
-        * Opens a new stream for reading.
-        * @param file Audio file to open
+        * Opens a new stream that reads through the specified I/O callbacks.
+        * @note The stream takes ownership of the AudioIO and closes it, even if the open fails.
+        * @param io I/O callbacks and their context
         * @return TRUE if stream is successfully opened and initialized. FALSE if the stream open failed or its already open.
         */
-        virtual bool OpenStream(const fs::path& file);
+        virtual bool OpenStream(const AudioIO& io);
 
         /**
         * Closes the stream and releases all resources held.
@@ -64,6 +83,43 @@ namespace onesnd
         * @param streampos Position in the stream to seek to in BYTES
         * @return The actual position where seeked, or 0 if out of bounds (this also means the stream was reset to 0).
         */
-        virtual unsigned int Seek(unsigned int streampos);
+        virtual unsigned long long Seek(unsigned long long streampos);
+
+        /**
+        * Creates a new decoder cursor over the source data of this stream.
+        * The cursor shares the file handle, pack or memory of this stream and takes over
+        * its format, but decodes on its own, so every cursor can read sequentially at its own position.
+        * The mpg123 state can't be shared, so this is a plain reopen of the decoder over a clone of the source.
+        * @return A new opened stream of the same type, or NULL if the source can't be shared or reopened.
+        */
+        virtual AudioStream* CreateCursor() const;
+
+        /**
+        * Counts the frames of the whole file, because the header only gives an estimate for VBR files.
+        * Only the frame headers are parsed, no audio is decoded.
+        * @return TRUE if Size() is exact.
+        */
+        virtual bool ScanLength();
+
+        /**
+        * Reads the ID3v2 tag of the stream, or the ID3v1 tag if there's no ID3v2 tag.
+        * ID3v2 fields are keyed by their frame id (TIT2, TPE1, ...), ID3v1 fields by their name.
+        */
+        virtual SoundTags ReadTags();
+
+        /**
+        * Decodes a short clip with every decoder mpg123 supports on this CPU and opens
+        * the streams with the fastest from then on. Every decoder runs the clip for at least 20ms
+        * a few times over and is rated by the median run. OneSound::initialize calls this,
+        * until then the streams open with the default decoder of mpg123.
+        * @return The measured throughput of the decoders.
+        */
+        static DecoderPerformance calibrate();
+
+        /**
+        * @return The decoder the streams are opened with and the throughput measured at the calibration.
+        *         The decoder is empty if the calibration didn't run or failed, the streams use the default of mpg123.
+        */
+        static DecoderPerformance getDecoderPerformance();
     };
 }
\ No newline at end of file
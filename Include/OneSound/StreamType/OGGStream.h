@@ -10,14 +10,58 @@
 
 #include "OneSound\StreamType\AudioStream.h"
 
+#include <future>
+#include <mutex>
+
 namespace onesnd
 {
+    struct OggSeekTable;
+
     /**
     * AudioStream for streaming file in WAV format.
     * The stream is decoded into PCM format.
     */
     class OGGStream : public AudioStream
     {
+    protected:
+        // a second decoder parked at a known position, seeking there swaps the decoders
+        struct DecoderSnapshot
+        {
+            unsigned long long position; // PCM byte position of the parked decoder
+            int* decoder;           // parked Vorbis handle
+            AudioIO io;             // cursor the parked decoder reads through
+            int rearmIn;            // reads left until the consumed snapshot gets parked again, 0 if ready
+            std::future<void> rearming; // seek of the consumed decoder back to its position, on a worker thread
+        };
+
+        std::vector<std::unique_ptr<DecoderSnapshot>> snapshots;
+
+        // guards the snapshots and the seek table: the refills read and seek on the voice callback,
+        // cue points are parked from the thread of the application
+        std::mutex snapshotMutex;
+
+        /**
+        * [internal] Seeks a consumed snapshot decoder back to its position.
+        * Runs on a worker thread, only touches the decoder and the cursor of the snapshot.
+        */
+        void RearmSnapshot(DecoderSnapshot& snapshot, const OggSeekTable* table);
+
+        std::shared_ptr<const OggSeekTable> seekTable; // granule to page offset table, shared with the cursors
+        std::shared_future<std::shared_ptr<const OggSeekTable>> seekTableBuild; // page scan on a worker thread
+
+        /**
+        * [internal][snapshotMutex held] Gets the seek table of the stream, the first call starts building it on a worker thread.
+        * @param wait TRUE to wait for the build
+        * @return The seek table, or NULL while it's still being built.
+        */
+        std::shared_ptr<const OggSeekTable> AcquireSeekTable(bool wait);
+
+        /**
+        * [internal] Positions a Vorbis decoder exactly at the specified sample.
+        * Uses the seek table if there is one, otherwise lets vorbisfile bisect the file.
+        */
+        bool SeekDecoder(int* decoder, long long sample, const OggSeekTable* table);
+
     public:
         /**
         * Creates a new unitialized OGG AudioStreamer.
@@ -36,12 +80,15 @@ namespace onesnd
         virtual ~OGGStream();
 
 
+        using AudioStream::OpenStream;
+
         /**
-        * Opens a new stream for reading.
-        * @param file Audio file to open
+        * Opens a new stream that reads through the specified I/O callbacks.
+        * @note The stream takes ownership of the AudioIO and closes it, even if the open fails.
+        * @param io I/O callbacks and their context
         * @return TRUE if stream is successfully opened and initialized. FALSE if the stream open failed or its already open.
         */
-        virtual bool OpenStream(const fs::path& file);
+        virtual bool OpenStream(const AudioIO& io);
 
         /**
         * Closes the stream and releases all resources held.
@@ -63,6 +110,46 @@ namespace onesnd
         * @param streampos Position in the stream to seek to in BYTES
         * @return The actual position where seeked, or 0 if out of bounds (this also means the stream was reset to 0).
         */
-        virtual unsigned int Seek(unsigned int streampos);
+        virtual unsigned long long Seek(unsigned long long streampos);
+
+        /**
+        * Creates a new decoder cursor over the source data of this stream.
+        * The cursor shares the file handle, pack or memory of this stream and takes over
+        * its format, but decodes on its own, so every cursor can read sequentially at its own position.
+        * The vorbisfile state can't be shared, so this is a plain reopen of the decoder over a clone of the source.
+        * @return A new opened stream of the same type, or NULL if the source can't be shared or reopened.
+        */
+        virtual AudioStream* CreateCursor() const;
+
+        /**
+        * Parks a second Vorbis decoder at the specified position. Seeking to exactly this position
+        * later swaps the decoders, so a loop restart or a cue point resumes without re-reading pages.
+        * The consumed decoder is parked again on a worker thread a buffer later, so neither the restart
+        * nor the refills pay for the seek. Until it's parked, seeking there seeks the stream as usual.
+        * @param streampos Position in the stream in BYTES
+        * @return TRUE if the stream keeps a snapshot at this position.
+        */
+        virtual bool Snapshot(unsigned long long streampos);
+
+        /**
+        * Reads the Vorbis comments of the stream, keyed by their field name in upper case (TITLE, ARTIST, ...).
+        */
+        virtual SoundTags ReadTags();
+
+        /**
+        * Builds the page seek table of this stream, if it's not built yet, and waits for it.
+        * Otherwise the first seek past the start of the stream builds it on a worker thread,
+        * the seeks bisect the file until it's done. Call this to have the table ready
+        * from the first seek, e.g. right after the stream is loaded. The most recently used tables
+        * are kept in memory and all of them in the seek table cache directory, so a file is rarely scanned twice.
+        * @return TRUE if the stream seeks through the table.
+        */
+        bool BuildSeekTable();
+
+        /**
+        * Sets the directory where the seek tables are stored between the runs.
+        * @param directory Cache directory, created if needed. An empty path keeps the tables in memory only.
+        */
+        static void setSeekTableCache(const fs::path& directory);
     };
 }
\ No newline at end of file
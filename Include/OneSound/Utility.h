@@ -42,14 +42,47 @@ namespace onesnd
         return (int)bytesRead;
     }
     // seeks the file pointer
-    inline off_t file_seek(void* handle, off_t offset, int whence)
+    inline long long file_seek(void* handle, long long offset, int whence)
     {
-        return SetFilePointer(handle, offset, NULL, whence);
+        LARGE_INTEGER distance, position;
+        distance.QuadPart = offset;
+        if (!SetFilePointerEx(handle, distance, &position, whence))
+            return -1;
+        return position.QuadPart;
     }
     // tells the current file position
-    inline off_t file_tell(void* handle)
+    inline long long file_tell(void* handle)
     {
-        return SetFilePointer(handle, 0, NULL, FILE_CURRENT);
+        return file_seek(handle, 0, FILE_CURRENT);
+    }
+    // reads bytes at the given file offset, the file pointer is not used
+    inline int file_pread(void* handle, void* dst, size_t size, unsigned long long offset)
+    {
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+        DWORD bytesRead;
+        if (!ReadFile(handle, dst, size, &bytesRead, &ov))
+            return 0;
+        return (int)bytesRead;
+    }
+    // gets the size of the opened file
+    inline unsigned long long file_size(void* handle)
+    {
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(handle, &size))
+            return 0;
+        return static_cast<unsigned long long>(size.QuadPart);
+    }
+
+    // 64-bit FNV-1a hash, pass the previous result as seed to hash data in pieces
+    inline unsigned long long hash_fnv1a(const void* data, size_t size, unsigned long long seed = 14695981039346656037ull)
+    {
+        auto* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i)
+            seed = (seed ^ bytes[i]) * 1099511628211ull;
+        return seed;
     }
 
 ///------
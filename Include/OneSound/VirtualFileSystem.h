@@ -0,0 +1,162 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#pragma once
+
+#include "OneSound\Export.h"
+
+#include "OneSound\Utility.h"
+
+#include "OneSound\StreamType\AudioIO.h"
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+
+namespace onesnd
+{
+    /**
+    * Read-only pack of sound files.
+    * The pack keeps a single file handle open, every file inside of it is read
+    * by positional reads at (offset, size), so any number of streams can read it at once.
+    *
+    * Layout: [PACKHEADER][file data...][index]
+    * Index entry: [uint16 name length][name][uint64 offset][uint64 size]
+    */
+    class ONE_SOUND_API PackFile
+    {
+    public:
+        struct Entry
+        {
+            unsigned long long offset;  // offset of the file data in the pack
+            unsigned long long size;    // size of the file data in bytes
+        };
+
+    public:
+        /**
+        * Opens the pack and loads its index.
+        * @param pack Path to the pack file
+        */
+        PackFile(const fs::path& pack);
+       ~PackFile();
+
+        PackFile(const PackFile&) = delete;
+        PackFile& operator=(const PackFile&) = delete;
+
+    public:
+        /**
+        * @param name Path of the file inside of the pack
+        * @return Entry of the file or NULL if the pack doesn't contain it
+        */
+        const Entry* find(const fs::path& name) const;
+
+        /**
+        * @return Number of files in this pack
+        */
+        size_t size() const { return index.size(); }
+
+        /**
+        * @return Index of this pack, keyed by the normalized file names
+        */
+        const std::unordered_map<std::string, Entry>& getIndex() const { return index; }
+
+        /**
+        * @return The shared OS file handle of this pack
+        */
+        void* getHandle() const { return handle; }
+
+        /**
+        * @return Last write time of the pack when it was opened, in ticks of the file clock
+        */
+        long long getModified() const { return modified; }
+
+        /**
+        * Creates a new pack from the specified files.
+        * @param pack Path of the pack to write
+        * @param root Directory the file names in the pack are relative to
+        * @param files Files to store in the pack
+        * Throws if two files get the same name in the pack or a name is longer than 65535 bytes.
+        */
+        static void create(const fs::path& pack, const fs::path& root, const std::vector<fs::path>& files);
+
+        /**
+        * @return Normalized name of a file inside of packs: lower case with '/' separators
+        */
+        static std::string normalizeName(const fs::path& name);
+
+    private:
+        void* handle;
+        long long modified;
+        std::unordered_map<std::string, Entry> index;
+    };
+
+    /**
+    * Virtual file system all the sound files are opened through.
+    * Files found in mounted packs are opened by a table lookup and read from the pack,
+    * all other files are opened from disk.
+    */
+    class ONE_SOUND_API VirtualFileSystem
+    {
+    public:
+        static VirtualFileSystem& instance()
+        {
+            static VirtualFileSystem vfs;
+            return vfs;
+        }
+
+    public:
+        /**
+        * Mounts a pack, its files override the disk files with the same name.
+        * Packs mounted later override the packs mounted earlier.
+        * @param pack Path to the pack file
+        */
+        void mount(const fs::path& pack);
+
+        /**
+        * Unmounts all the packs. Streams that are still reading them keep them alive.
+        */
+        void unmountAll();
+
+        /**
+        * @return TRUE if the file exists in a mounted pack or on disk.
+        */
+        bool exists(const fs::path& file) const;
+
+        /**
+        * @return TRUE if the file is found in a mounted pack.
+        */
+        bool isPacked(const fs::path& file) const;
+
+        /**
+        * Gets the size and the last write time of a file, a packed file has the time of its pack.
+        * @param file Path of the file
+        * @param size [out] Size of the file in bytes
+        * @param modified [out] Last write time in ticks of the file clock
+        * @return TRUE if the file exists in a mounted pack or on disk.
+        */
+        bool stat(const fs::path& file, unsigned long long& size, long long& modified) const;
+
+        /**
+        * Opens a file from the mounted packs or from disk.
+        * @param file Path of the file to open
+        * @return A valid AudioIO. Throws if the file can't be opened.
+        */
+        AudioIO open(const fs::path& file) const;
+
+    private:
+        struct PackedFile
+        {
+            std::shared_ptr<PackFile> pack;
+            PackFile::Entry entry;
+        };
+
+        bool findPacked(const fs::path& file, PackedFile& out) const;
+
+        mutable std::mutex mutex;
+        std::vector<std::shared_ptr<PackFile>> packs;
+        std::unordered_map<std::string, PackedFile> files;  // merged index of all mounted packs
+    };
+}
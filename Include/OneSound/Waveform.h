@@ -0,0 +1,147 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#pragma once
+
+#include "OneSound\Export.h"
+
+#include "OneSound\Utility.h"
+
+#include <future>
+
+namespace onesnd
+{
+    class AudioStream;
+    struct XABuffer;
+
+    /**
+    * Summary of a range of samples of one channel, in 16-bit PCM scale.
+    */
+    struct WaveformPoint
+    {
+        short min;
+        short max;
+        unsigned short rms;
+    };
+
+    /**
+    * Multi-resolution min/max/RMS overview of a sound, for drawing waveforms at any zoom.
+    * Level 0 summarizes every BinFrames sample frames per channel, every level above merges
+    * two bins of the level below. A query picks the level closest to the zoom, so drawing
+    * any range of a sound costs O(pixels) whatever its length.
+    * The data is built in a single streaming pass, e.g. while decoding, and only level 0
+    * is saved to disk, the other levels are rebuilt on load.
+    */
+    class ONE_SOUND_API WaveformPyramid
+    {
+    public:
+        static const int BinFrames = 512;   // sample frames per bin of level 0, ~10ms at 48kHz
+
+    protected:
+        int channels;
+        int frequency;
+        long long frames;
+
+        std::vector<std::vector<WaveformPoint>> levels; // [level][bin * channels + channel]
+
+        // bin of level 0 being filled
+        std::vector<short> binMin;
+        std::vector<short> binMax;
+        std::vector<double> binSquares;
+        int binFill;
+
+    public:
+        /**
+        * Creates an empty pyramid for data of the specified format.
+        * @param channels Number of interleaved channels
+        * @param frequency Sample rate in Hz, converts times to frames in queries
+        */
+        WaveformPyramid(int channels, int frequency);
+
+        /**
+        * Adds interleaved 16-bit frames, in order.
+        * @param samples Interleaved PCM16 samples
+        * @param count Number of sample frames
+        */
+        void Append(const short* samples, int count);
+
+        /**
+        * Adds interleaved frames in any format a SoundBuffer holds (8-bit, 16-bit or float).
+        * @param data Interleaved samples in the specified format
+        * @param bytes Number of bytes, whole frames
+        * @param wf Format of the data, it must have the channels of the pyramid
+        */
+        void Append(const void* data, int bytes, const WAVEFORMATEX& wf);
+
+        /**
+        * Closes the last bin and builds the levels above level 0. Call once after the last Append.
+        */
+        void Finish();
+
+        int Channels() const { return channels; }
+        int Frequency() const { return frequency; }
+        long long Frames() const { return frames; }
+        int Levels() const { return int(levels.size()); }
+
+        /**
+        * Summarizes a time range of one channel in a point per pixel.
+        * @param channel Channel to query
+        * @param begin Start of the range in seconds
+        * @param end End of the range in seconds
+        * @param pixels Number of points to produce
+        * @param points Receives the points, pixels past the end of the sound are zero
+        * @return Number of points that cover data of the sound.
+        */
+        int Query(int channel, double begin, double end, int pixels, WaveformPoint* points) const;
+
+        /**
+        * Saves the pyramid in a compact binary file.
+        * @param file File to write
+        * @param source [optional] Sound file of the pyramid, its size and last write time are saved with it
+        * @return TRUE if the file was written.
+        */
+        bool Save(const fs::path& file, const fs::path& source = fs::path()) const;
+
+        /**
+        * Loads a pyramid saved with Save.
+        * @param file File to read
+        * @param source [optional] Sound file of the pyramid, the load fails if it changed since the pyramid was saved
+        * @return The pyramid, NULL if the file can't be read or the sound file changed.
+        */
+        static std::shared_ptr<WaveformPyramid> Load(const fs::path& file, const fs::path& source = fs::path());
+
+    protected:
+        /**
+        * [internal] Adds a run of frames that fits into the bin being filled.
+        */
+        void Scan(const short* samples, int count);
+
+        /**
+        * [internal] Closes the bin being filled and starts a new one.
+        */
+        void CloseBin();
+    };
+
+    /**
+    * Builds the waveform of a stream in one pass from its current position to the end.
+    * @param strm Stream to read
+    * @return The finished pyramid, NULL if the stream is invalid.
+    */
+    ONE_SOUND_API std::shared_ptr<WaveformPyramid> buildWaveform(AudioStream* strm);
+
+    /**
+    * Builds the waveform of decoded data.
+    */
+    ONE_SOUND_API std::shared_ptr<WaveformPyramid> buildWaveform(const XABuffer* buffer);
+
+    /**
+    * Builds the waveform of a sound file on a background thread, with a decoder of its own.
+    * @param file Sound file, from the mounted packs or from disk
+    * @param cache Optional file the pyramid is loaded from if it exists and the sound file didn't change since, and saved to otherwise
+    * @return Future of the pyramid, NULL if the file can't be decoded.
+    */
+    ONE_SOUND_API std::future<std::shared_ptr<WaveformPyramid>> buildWaveformAsync(const fs::path& file, const fs::path& cache = fs::path());
+}
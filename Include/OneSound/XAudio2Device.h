@@ -42,6 +42,11 @@ namespace onesnd
         IXAudio2* getEngine() const { return xEngine; }
         IXAudio2MasteringVoice* getMaster() const { return xMaster; }
 
+        /**
+        * @return Sample rate the mastering voice mixes at.
+        */
+        int getMasterRate() const;
+
     private:
         IXAudio2* xEngine;
         IXAudio2MasteringVoice* xMaster;
@@ -52,15 +57,21 @@ namespace onesnd
     struct XABuffer : XAUDIO2_BUFFER
     {
         WAVEFORMATEX wf;		// wave format descriptor
-        int nBytesPerSample;	// number of bytes per single audio sample (1 or 2 bytes)
+        int nBytesPerSample;	// number of bytes per single audio sample (1, 2 or 4 bytes for float)
         int nPCMSamples;		// number of PCM samples in the entire buffer
         unsigned wfHash;		// waveformat pseudo-hash
+        void* mapping;			// mapped view the data lives in, NULL if the data follows the header
 
-        static XABuffer* create(SoundBuffer* ctx, int size, AudioStream* strm, int* pos = nullptr);
+        static XABuffer* create(SoundBuffer* ctx, int size, AudioStream* strm, long long* pos = nullptr);
+        static XABuffer* create(SoundBuffer* ctx, const WAVEFORMATEX& wf, const void* data, int size);
+        static XABuffer* createMapped(SoundBuffer* ctx, const WAVEFORMATEX& wf, void* view, const void* data, int size);
         static void destroy(XABuffer*& buffer);
 
-        static void stream(XABuffer* buffer, AudioStream* strm, int* pos = nullptr);
+        static void stream(XABuffer* buffer, AudioStream* strm, long long* pos = nullptr);
 
         static int getBuffersQueued(IXAudio2SourceVoice* source);
+
+        static WAVEFORMATEX formatOf(AudioStream* strm);
+        static unsigned hashFormat(const WAVEFORMATEX& wf);
     };
 }
\ No newline at end of file
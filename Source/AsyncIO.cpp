@@ -0,0 +1,417 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#include "OneSound\AsyncIO.h"
+
+#include <condition_variable>
+#include <algorithm>
+#include <iterator>
+
+namespace onesnd
+{
+    enum class BlockState
+    {
+        Free, Pending, Ready,
+    };
+
+    struct AsyncBlock
+    {
+        OVERLAPPED ov;              // must be the first member, completions give us back this pointer
+        AsyncFile* file;
+        char* data;
+        unsigned long long offset;  // file offset of the block data
+        DWORD bytes;                // number of valid bytes after the completion
+        BlockState state;
+    };
+
+    struct AsyncFile
+    {
+        std::shared_ptr<void> handle;   // shared by the clones, every clone has its own window
+        unsigned long long size;
+        unsigned long long position;    // logical read position
+        unsigned long long nextOffset;  // the next offset to read ahead
+        size_t blockSize;
+        std::vector<AsyncBlock> blocks; // never resized, completions hold pointers to the blocks
+        bool synchronous;               // the service was disabled, blocks are read on the calling thread
+        HANDLE event;                   // event of the synchronous reads, NULL until the first one
+
+        std::mutex mutex;
+        std::condition_variable completed;
+    };
+
+    // [lock held] reads a block on the calling thread; the low bit of the event keeps the completion off the port
+    static DWORD readSynchronous(AsyncFile* f, AsyncBlock& block)
+    {
+        if (!f->event && !(f->event = CreateEventA(nullptr, TRUE, FALSE, nullptr)))
+            return 0;
+
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(block.offset);
+        ov.OffsetHigh = static_cast<DWORD>(block.offset >> 32);
+        ov.hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<ULONG_PTR>(f->event) | 1);
+
+        DWORD bytes = 0;
+        if (!ReadFile(f->handle.get(), block.data, static_cast<DWORD>(f->blockSize), nullptr, &ov) &&
+            GetLastError() != ERROR_IO_PENDING)
+            return 0;
+        if (!GetOverlappedResult(f->handle.get(), &ov, &bytes, TRUE))
+            return 0;
+        return bytes;
+    }
+
+    // [lock held] queues an overlapped read of one block
+    static void submitBlock(AsyncFile* f, AsyncBlock& block, unsigned long long offset)
+    {
+        block.offset = offset;
+        block.bytes = 0;
+
+        if (offset >= f->size)
+        {
+            block.state = BlockState::Ready; // nothing to read past the end of file
+            return;
+        }
+
+        if (f->synchronous)
+        {
+            block.bytes = readSynchronous(f, block);
+            block.state = BlockState::Ready;
+            return;
+        }
+
+        memset(&block.ov, 0, sizeof(block.ov));
+        block.ov.Offset = static_cast<DWORD>(offset);
+        block.ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        block.state = BlockState::Pending;
+
+        // the completion is always posted to the port, even if the read finished right away
+        if (!ReadFile(f->handle.get(), block.data, static_cast<DWORD>(f->blockSize), nullptr, &block.ov) &&
+            GetLastError() != ERROR_IO_PENDING)
+            block.state = BlockState::Ready; // failed, 0 bytes
+    }
+
+    // [lock held] waits for all the reads in flight, so the block buffers can be reused
+    static void waitPending(AsyncFile* f, std::unique_lock<std::mutex>& lock)
+    {
+        f->completed.wait(lock, [f]
+        {
+            for (const auto& block : f->blocks)
+                if (block.state == BlockState::Pending)
+                    return false;
+            return true;
+        });
+    }
+
+    // [lock held] restarts the read-ahead window at the specified offset
+    static void restartWindow(AsyncFile* f, std::unique_lock<std::mutex>& lock, unsigned long long offset)
+    {
+        waitPending(f, lock);
+
+        offset -= offset % f->blockSize;
+        for (auto& block : f->blocks)
+        {
+            submitBlock(f, block, offset);
+            offset += f->blockSize;
+        }
+        f->nextOffset = offset;
+    }
+
+    static AsyncBlock* findBlock(AsyncFile* f, unsigned long long position)
+    {
+        for (auto& block : f->blocks)
+            if (block.state != BlockState::Free && position >= block.offset && position < block.offset + f->blockSize)
+                return &block;
+
+        return nullptr;
+    }
+
+    static int async_read(void* context, void* dst, size_t size)
+    {
+        auto* f = static_cast<AsyncFile*>(context);
+        std::unique_lock<std::mutex> lock(f->mutex);
+
+        auto* out = static_cast<char*>(dst);
+        auto total = size_t();
+        while (total < size && f->position < f->size)
+        {
+            auto* block = findBlock(f, f->position);
+            if (!block) // seeked out of the window
+            {
+                restartWindow(f, lock, f->position);
+                continue;
+            }
+
+            // only waits if the disk didn't deliver this block yet
+            f->completed.wait(lock, [block] { return block->state != BlockState::Pending; });
+
+            auto blockEnd = block->offset + block->bytes;
+            if (f->position >= blockEnd)
+                break; // read error or unexpected end of file
+
+            auto count = std::min<unsigned long long>(size - total, blockEnd - f->position);
+            memcpy(out + total, block->data + (f->position - block->offset), static_cast<size_t>(count));
+            total += static_cast<size_t>(count);
+            f->position += count;
+
+            if (f->position >= block->offset + f->blockSize) // block consumed, move it to the front of the window
+            {
+                submitBlock(f, *block, f->nextOffset);
+                f->nextOffset += f->blockSize;
+            }
+        }
+
+        return static_cast<int>(total);
+    }
+
+    static long long async_seek(void* context, long long offset, int whence)
+    {
+        auto* f = static_cast<AsyncFile*>(context);
+        std::lock_guard<std::mutex> lock(f->mutex);
+
+        auto base = (long long)0;
+        switch (whence)
+        {
+            case SEEK_SET: base = 0; break;
+            case SEEK_CUR: base = (long long)f->position; break;
+            case SEEK_END: base = (long long)f->size; break;
+            default:
+                return -1;
+        }
+
+        auto target = base + offset;
+        if (target < 0 || (unsigned long long)target > f->size)
+            return -1;
+
+        f->position = (unsigned long long)target; // the window is moved by the next read, if needed
+        return target;
+    }
+
+    static long long async_tell(void* context)
+    {
+        auto* f = static_cast<AsyncFile*>(context);
+        std::lock_guard<std::mutex> lock(f->mutex);
+
+        return (long long)f->position;
+    }
+
+    static int async_close(void* context)
+    {
+        auto* f = static_cast<AsyncFile*>(context);
+        {
+            std::unique_lock<std::mutex> lock(f->mutex);
+            for (auto& block : f->blocks) // only our reads, the clones keep reading the same handle
+                if (block.state == BlockState::Pending)
+                    CancelIoEx(f->handle.get(), &block.ov); // cancelled reads still post their completions
+            waitPending(f, lock);
+        }
+
+        AsyncIOService::instance().closeAsyncFile(f);
+        return 0;
+    }
+
+    static AudioIO async_clone(void* context)
+    {
+        auto* f = static_cast<AsyncFile*>(context);
+        return AsyncIOService::instance().openAsyncFile(f->handle, f->size);
+    }
+
+    AsyncIOService::AsyncIOService() :
+        port(nullptr),
+        windowBlocks(4),
+        blockSize(64 * 1024),
+        pool(nullptr),
+        poolSize(0)
+    { }
+
+    AsyncIOService::~AsyncIOService()
+    {
+        disable();
+
+        if (pool)
+            VirtualFree(pool, 0, MEM_RELEASE);
+    }
+
+    void AsyncIOService::enable(size_t window, size_t block, size_t poolBlocks)
+    {
+        std::lock_guard<std::mutex> filesLock(filesMutex);
+        if (port) // already running, the settings can't be changed while files are open
+            return;
+
+        windowBlocks = std::clamp<size_t>(window, 2, 16);
+        if (!pool) // the pool is carved up by the block size, it stays once allocated
+            blockSize = (std::max<size_t>(block, 4096) + 4095) & ~size_t(4095);
+
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            if (!pool && poolBlocks)
+            {
+                poolSize = poolBlocks * blockSize;
+                pool = static_cast<char*>(VirtualAlloc(nullptr, poolSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+                if (!pool)
+                    throw std::runtime_error("Failed to allocate the asynchronous I/O buffer pool.");
+
+                for (auto i = size_t(0); i < poolBlocks; ++i)
+                    freeBlocks.push_back(pool + i * blockSize);
+            }
+        }
+
+        auto* created = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+        if (!created)
+            throw std::runtime_error("Failed to create the I/O completion port.");
+        port = created;
+
+        completionThread = std::thread(&AsyncIOService::completionLoop, this);
+    }
+
+    void AsyncIOService::disable()
+    {
+        std::lock_guard<std::mutex> filesLock(filesMutex); // no file is opened or closed meanwhile
+        if (!port)
+            return;
+
+        // the open files stop queuing reads, the ones in flight still complete through the port
+        for (auto* f : files)
+        {
+            std::unique_lock<std::mutex> lock(f->mutex);
+            f->synchronous = true;
+            waitPending(f, lock);
+        }
+
+        PostQueuedCompletionStatus(port, 0, 0, nullptr); // a null OVERLAPPED stops the loop
+        if (completionThread.joinable())
+            completionThread.join();
+
+        CloseHandle(port);
+        port = nullptr;
+    }
+
+    void AsyncIOService::completionLoop()
+    {
+        OVERLAPPED_ENTRY entries[64];
+        ULONG count = 0;
+        auto* port = this->port.load(); // only disable changes it, after this thread is joined
+
+        // every wakeup drains a whole batch of completions, for all the files at once
+        while (GetQueuedCompletionStatusEx(port, entries, ULONG(std::size(entries)), &count, INFINITE, FALSE))
+        {
+            for (auto i = ULONG(0); i < count; ++i)
+            {
+                if (!entries[i].lpOverlapped)
+                    return; // shutdown
+
+                auto* block = reinterpret_cast<AsyncBlock*>(entries[i].lpOverlapped);
+                auto* f = block->file;
+
+                std::lock_guard<std::mutex> lock(f->mutex);
+                block->bytes = entries[i].dwNumberOfBytesTransferred;
+                block->state = BlockState::Ready;
+                f->completed.notify_all();
+            }
+        }
+    }
+
+    char* AsyncIOService::acquireBlock()
+    {
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            if (!freeBlocks.empty())
+            {
+                auto* block = freeBlocks.back();
+                freeBlocks.pop_back();
+                return block;
+            }
+        }
+
+        // pool exhausted, the block lives on its own
+        return static_cast<char*>(_aligned_malloc(blockSize, 4096));
+    }
+
+    void AsyncIOService::releaseBlock(char* block)
+    {
+        if (!block)
+            return;
+
+        if (block >= pool && block < pool + poolSize)
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            freeBlocks.push_back(block);
+        }
+        else
+            _aligned_free(block);
+    }
+
+    AudioIO AsyncIOService::open(const fs::path& file)
+    {
+        std::unique_lock<std::mutex> filesLock(filesMutex); // the port stays open while the file is attached
+        if (!port)
+        {
+            filesLock.unlock();
+            return openFileIO(file);
+        }
+
+        auto handle = CreateFileA(file.string().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (handle == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("Can't open file: "s + file.string());
+
+        if (!CreateIoCompletionPort(handle, port, 0, 0))
+        {
+            CloseHandle(handle);
+            throw std::runtime_error("Can't attach file to the I/O completion port: "s + file.string());
+        }
+        filesLock.unlock();
+
+        // a disable right here only makes the file read synchronously
+        return openAsyncFile(std::shared_ptr<void>(handle, CloseHandle), file_size(handle));
+    }
+
+    void AsyncIOService::closeAsyncFile(AsyncFile* f)
+    {
+        {
+            std::lock_guard<std::mutex> filesLock(filesMutex);
+            files.erase(std::remove(files.begin(), files.end(), f), files.end());
+        }
+
+        for (auto& block : f->blocks)
+            releaseBlock(block.data);
+        if (f->event)
+            CloseHandle(f->event);
+
+        delete f;
+    }
+
+    AudioIO AsyncIOService::openAsyncFile(const std::shared_ptr<void>& handle, unsigned long long size)
+    {
+        auto* f = new AsyncFile();
+        f->handle = handle;
+        f->size = size;
+        f->position = 0;
+        f->nextOffset = 0;
+        f->blockSize = blockSize;
+        f->event = nullptr;
+        f->blocks.resize(windowBlocks);
+        for (auto& block : f->blocks)
+        {
+            memset(&block, 0, sizeof(block));
+            block.file = f;
+            block.data = acquireBlock();
+            block.state = BlockState::Free;
+        }
+
+        {
+            std::lock_guard<std::mutex> filesLock(filesMutex);
+            f->synchronous = !port;
+            files.push_back(f);
+        }
+
+        // start reading ahead right away, the header is needed first anyway
+        {
+            std::unique_lock<std::mutex> lock(f->mutex);
+            restartWindow(f, lock, 0);
+        }
+
+        return { f, async_read, async_seek, async_tell, async_close, async_clone };
+    }
+}
@@ -0,0 +1,275 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#include "OneSound\IOScheduler.h"
+
+#include <algorithm>
+
+namespace onesnd
+{
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+
+    // how often requests waiting for another one are checked again, their predecessor may run outside of the scheduler
+    static const auto DependencyPoll = std::chrono::milliseconds(2);
+
+    // the bucket holds at most a quarter second of bandwidth, so a pause doesn't turn into a long burst
+    static double burstOf(size_t bandwidth)
+    {
+        return std::max(double(bandwidth) / 4.0, 64.0 * 1024.0);
+    }
+
+    IOScheduler::IOScheduler() :
+        running(false),
+        nextId(1),
+        audioBandwidth(0),
+        tokens(0.0),
+        lastRefill(Clock::now()),
+        urgentWindow(std::chrono::milliseconds(100)),
+        waitSum(0.0),
+        latencySum(0.0)
+    { }
+
+    IOScheduler::~IOScheduler()
+    {
+        disable();
+    }
+
+    void IOScheduler::enable(unsigned threads)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (running)
+            return;
+
+        running = true;
+        for (auto i = 0u; i < std::max(threads, 1u); ++i)
+            workers.emplace_back(&IOScheduler::workerLoop, this);
+    }
+
+    void IOScheduler::disable()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running)
+                return;
+            running = false;
+        }
+        changed.notify_all();
+
+        for (auto& worker : workers) // the workers drain the queue before they leave
+            worker.join();
+        workers.clear();
+    }
+
+    void IOScheduler::setAudioBandwidth(size_t bytesPerSecond)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        audioBandwidth = bytesPerSecond;
+        tokens = bytesPerSecond ? burstOf(bytesPerSecond) : 0.0;
+        lastRefill = Clock::now();
+        changed.notify_all();
+    }
+
+    size_t IOScheduler::getAudioBandwidth() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return audioBandwidth;
+    }
+
+    void IOScheduler::setUrgentWindow(int milliseconds)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        urgentWindow = std::chrono::milliseconds(std::max(milliseconds, 0));
+        changed.notify_all();
+    }
+
+    int IOScheduler::getUrgentWindow() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return int(std::chrono::duration_cast<std::chrono::milliseconds>(urgentWindow).count());
+    }
+
+    IORequest IOScheduler::submit(IOClass cls, Clock::time_point deadline, Work work, std::shared_future<void> after)
+    {
+        IORequest request;
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!running)
+        {
+            lock.unlock();
+
+            // never runs on the calling thread, callers may hold locks the work takes
+            request.done = std::async(std::launch::async, [work, after]
+            {
+                if (after.valid())
+                    after.wait();
+                work();
+            }).share();
+            return request;
+        }
+
+        auto done = std::make_shared<std::promise<void>>();
+        request.done = done->get_future().share();
+        request.id = nextId++;
+        queue.emplace(deadline, Request{ request.id, cls, Clock::now(), deadline, std::move(work), std::move(after), done, false });
+
+        auto& queued = cls == IOClass::Audio ? stats.audioQueued : stats.applicationQueued;
+        ++queued;
+        stats.maxQueued = std::max(stats.maxQueued, unsigned(queue.size()));
+        lock.unlock();
+        changed.notify_one();
+        return request;
+    }
+
+    void IOScheduler::expedite(unsigned long long id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = queue.begin(); it != queue.end(); ++it)
+        {
+            if (it->second.id == id)
+            {
+                // the deadline it was submitted with still counts for the stats
+                auto node = queue.extract(it);
+                node.key() = Clock::now(); // due right away, so it's urgent as well
+                queue.insert(std::move(node));
+                changed.notify_all();
+                return;
+            }
+        }
+    }
+
+    IOSchedulerStats IOScheduler::getStats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+    void IOScheduler::resetStats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // the queue depth is the current state, not a counter
+        IOSchedulerStats reset;
+        reset.audioQueued = stats.audioQueued;
+        reset.applicationQueued = stats.applicationQueued;
+        reset.maxQueued = unsigned(queue.size());
+        stats = reset;
+        waitSum = 0.0;
+        latencySum = 0.0;
+    }
+
+    void IOScheduler::refill(Clock::time_point now)
+    {
+        if (audioBandwidth)
+        {
+            auto seconds = std::chrono::duration<double>(now - lastRefill).count();
+            tokens = std::min(tokens + seconds * double(audioBandwidth), burstOf(audioBandwidth));
+        }
+        lastRefill = now;
+    }
+
+    IOScheduler::Queue::iterator IOScheduler::pick(Clock::time_point now, Clock::time_point& wake)
+    {
+        refill(now);
+
+        // in deadline order: the urgent requests are always the first ones
+        for (auto it = queue.begin(); it != queue.end(); ++it)
+        {
+            auto& request = it->second;
+            if (request.after.valid() && request.after.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            {
+                wake = std::min(wake, now + DependencyPoll);
+                continue;
+            }
+
+            auto capped = request.cls == IOClass::Audio && audioBandwidth && tokens < 0.0 && running;
+            if (!capped)
+                return it;
+
+            auto urgentAt = it->first - urgentWindow;
+            if (urgentAt <= now)
+            {
+                ++stats.urgent;
+                return it;
+            }
+
+            if (!request.throttled)
+            {
+                request.throttled = true;
+                ++stats.throttled;
+            }
+
+            // wait until the bucket is out of debt or the request turns urgent, whichever comes first
+            auto refilled = now + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(-tokens / double(audioBandwidth)));
+            wake = std::min(wake, std::min(refilled, urgentAt));
+        }
+        return queue.end();
+    }
+
+    void IOScheduler::workerLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            if (!running && queue.empty())
+                return;
+
+            auto now = Clock::now();
+            auto wake = Clock::time_point::max();
+            auto it = pick(now, wake);
+            if (it == queue.end())
+            {
+                if (wake == Clock::time_point::max())
+                    changed.wait(lock);
+                else
+                    changed.wait_until(lock, wake);
+                continue;
+            }
+
+            auto request = std::move(it->second);
+            queue.erase(it);
+            auto& queued = request.cls == IOClass::Audio ? stats.audioQueued : stats.applicationQueued;
+            --queued;
+
+            lock.unlock();
+            auto started = Clock::now();
+            auto bytes = size_t(0);
+            try
+            {
+                bytes = request.work();
+                request.done->set_value();
+            }
+            catch (...)
+            {
+                request.done->set_exception(std::current_exception());
+            }
+            auto finished = Clock::now();
+            lock.lock();
+
+            if (request.cls == IOClass::Audio)
+            {
+                stats.audioBytes += bytes;
+                if (audioBandwidth)
+                    tokens -= double(bytes); // charged after the fact, the next audio request waits off the debt
+            }
+            else
+                stats.applicationBytes += bytes;
+
+            auto wait = Milliseconds(started - request.submitted).count();
+            auto latency = Milliseconds(finished - request.submitted).count();
+            waitSum += wait;
+            latencySum += latency;
+
+            ++stats.completed;
+            if (finished > request.deadline)
+                ++stats.missed;
+            stats.averageWait = waitSum / double(stats.completed);
+            stats.averageLatency = latencySum / double(stats.completed);
+            stats.maxLatency = std::max(stats.maxLatency, latency);
+
+            changed.notify_all(); // requests may have waited for this one
+        }
+    }
+}
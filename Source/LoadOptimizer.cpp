@@ -0,0 +1,320 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#include "OneSound\LoadOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <intrin.h>
+#include <emmintrin.h>
+
+namespace onesnd
+{
+    // |sample| of 8 samples at once, -32768 saturates to 32767
+    static inline __m128i absolute16(__m128i v)
+    {
+        return _mm_max_epi16(v, _mm_subs_epi16(_mm_setzero_si128(), v));
+    }
+
+    // index of the first sample louder than the threshold, -1 if there is none
+    static int firstAudible(const short* samples, int count, short threshold)
+    {
+        auto limit = _mm_set1_epi16(threshold);
+        auto i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+            auto mask = _mm_movemask_epi8(_mm_cmpgt_epi16(absolute16(v), limit));
+            if (mask)
+            {
+                unsigned long bit;
+                _BitScanForward(&bit, (unsigned long)mask);
+                return i + int(bit / 2);
+            }
+        }
+        for (; i < count; ++i)
+            if (abs(samples[i]) > threshold)
+                return i;
+
+        return -1;
+    }
+
+    // index of the last sample louder than the threshold, -1 if there is none
+    static int lastAudible(const short* samples, int count, short threshold)
+    {
+        auto i = count;
+        while (i % 8)
+        {
+            if (abs(samples[--i]) > threshold)
+                return i;
+        }
+
+        auto limit = _mm_set1_epi16(threshold);
+        for (; i >= 8; i -= 8)
+        {
+            auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i - 8));
+            auto mask = _mm_movemask_epi8(_mm_cmpgt_epi16(absolute16(v), limit));
+            if (mask)
+            {
+                unsigned long bit;
+                _BitScanReverse(&bit, (unsigned long)mask);
+                return i - 8 + int(bit / 2);
+            }
+        }
+        return -1;
+    }
+
+    // compares the left and right samples of interleaved stereo frames
+    static bool identicalChannels(const short* samples, int frames, int tolerance)
+    {
+        auto limit = _mm_set1_epi16((short)std::min(tolerance, 32767));
+        auto count = frames * 2;
+        auto i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+            auto swapped = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1)); // [R L R L ...]
+            auto difference = absolute16(_mm_subs_epi16(v, swapped));
+            if (_mm_movemask_epi8(_mm_cmpgt_epi16(difference, limit)))
+                return false;
+        }
+        for (; i < count; i += 2)
+            if (abs(samples[i] - samples[i + 1]) > tolerance)
+                return false;
+
+        return true;
+    }
+
+    // averages the left and right samples of interleaved stereo frames
+    static void mixToMono(const short* stereo, short* mono, int frames)
+    {
+        auto ones = _mm_set1_epi16(1);
+        auto i = 0;
+        for (; i + 8 <= frames; i += 8)
+        {
+            auto a = _mm_madd_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(stereo + i * 2)), ones);     // L + R of 4 frames
+            auto b = _mm_madd_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(stereo + i * 2 + 8)), ones);
+            auto pair = _mm_packs_epi32(_mm_srai_epi32(a, 1), _mm_srai_epi32(b, 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(mono + i), pair);
+        }
+        for (; i < frames; ++i)
+            mono[i] = short((stereo[i * 2] + stereo[i * 2 + 1]) >> 1);
+    }
+
+    // count must be a multiple of 4
+    static float dotProduct(const float* a, const float* b, int count)
+    {
+        auto sum = _mm_setzero_ps();
+        for (auto i = 0; i < count; i += 4)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum);
+    }
+
+    static const double Pi = 3.14159265358979323846;
+
+    // polyphase windowed-sinc filter, the phase is picked from a table instead of computing the kernel per sample
+    static const int FilterPhases = 256;
+    static const int FilterZeroCrossings = 16;
+
+    // the output keeps the 16-bit scale, it's converted to the final sample format afterwards
+    static std::vector<float> resample(const short* samples, int frames, int channels, int srcRate, int dstRate)
+    {
+        // the cutoff sits a little below the lower Nyquist frequency to leave room for the transition band
+        auto cutoff = 0.5 * std::min(1.0, double(dstRate) / srcRate) * 0.95; // in cycles per source sample
+        auto half = (int)ceil(FilterZeroCrossings / (2.0 * cutoff));
+        auto taps = (half * 2 + 3) & ~3;
+
+        // tap k weights the source sample at (center + k - half + 1)
+        std::vector<float> kernel(size_t(FilterPhases + 1) * taps);
+        for (auto phase = 0; phase <= FilterPhases; ++phase)
+        {
+            auto* weights = &kernel[size_t(phase) * taps];
+            auto fraction = double(phase) / FilterPhases;
+            auto sum = 0.0;
+            for (auto k = 0; k < taps; ++k)
+            {
+                auto x = (k - half + 1) - fraction;
+                if (fabs(x) >= half)
+                    continue;
+
+                auto window = 0.42 + 0.5 * cos(Pi * x / half) + 0.08 * cos(2.0 * Pi * x / half); // Blackman
+                auto sinc = x == 0.0 ? 1.0 : sin(2.0 * Pi * cutoff * x) / (2.0 * Pi * cutoff * x);
+                weights[k] = float(sinc * window);
+                sum += weights[k];
+            }
+            for (auto k = 0; k < taps; ++k) // unity gain at DC for every phase
+                weights[k] = float(weights[k] / sum);
+        }
+
+        auto outFrames = int((long long)frames * dstRate / srcRate);
+        auto step = double(srcRate) / dstRate;
+        std::vector<float> output(size_t(outFrames) * channels);
+
+        // one channel at a time, padded with silence so the filter can run over the edges
+        std::vector<float> source(size_t(frames) + half * 2 + taps);
+        for (auto channel = 0; channel < channels; ++channel)
+        {
+            std::fill(source.begin(), source.end(), 0.0f);
+            for (auto i = 0; i < frames; ++i)
+                source[half + i] = samples[size_t(i) * channels + channel];
+
+            for (auto j = 0; j < outFrames; ++j)
+            {
+                auto center = j * step;
+                auto index = (int)center;
+                auto phase = (int)lround((center - index) * FilterPhases);
+
+                output[size_t(j) * channels + channel] = dotProduct(&source[size_t(index) + 1], &kernel[size_t(phase) * taps], taps);
+            }
+        }
+        return output;
+    }
+
+    static void floatToPCM16(const float* samples, short* output, size_t count)
+    {
+        auto i = size_t(0);
+        for (; i + 8 <= count; i += 8) // rounds to nearest and saturates
+        {
+            auto a = _mm_cvtps_epi32(_mm_loadu_ps(samples + i));
+            auto b = _mm_cvtps_epi32(_mm_loadu_ps(samples + i + 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_packs_epi32(a, b));
+        }
+        for (; i < count; ++i)
+            output[i] = short(std::max(-32768L, std::min(32767L, lround(samples[i]))));
+    }
+
+    static void scaleToFloat(const float* samples, float* output, size_t count)
+    {
+        auto scale = _mm_set1_ps(1.0f / 32768.0f);
+        auto i = size_t(0);
+        for (; i + 4 <= count; i += 4)
+            _mm_storeu_ps(output + i, _mm_mul_ps(_mm_loadu_ps(samples + i), scale));
+        for (; i < count; ++i)
+            output[i] = samples[i] / 32768.0f;
+    }
+
+    static void PCM16ToFloat(const short* samples, float* output, size_t count)
+    {
+        auto scale = _mm_set1_ps(1.0f / 32768.0f);
+        auto i = size_t(0);
+        for (; i + 8 <= count; i += 8)
+        {
+            auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+            auto low = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16); // sign extended to 32 bits
+            auto high = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+            _mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+            _mm_storeu_ps(output + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+        }
+        for (; i < count; ++i)
+            output[i] = samples[i] / 32768.0f;
+    }
+
+    LoadReport optimizeBuffer(SoundBuffer* ctx, XABuffer*& buffer, const LoadOptimization& options)
+    {
+        LoadReport report;
+        if (!buffer)
+            return report;
+
+        report.originalBytes = report.optimizedBytes = buffer->AudioBytes;
+        report.originalRate = report.optimizedRate = buffer->wf.nSamplesPerSec;
+        if (!options.IsEnabled() || buffer->wf.wFormatTag != WAVE_FORMAT_PCM || buffer->wf.wBitsPerSample != 16)
+            return report;
+
+        auto wf = buffer->wf;
+        int channels = wf.nChannels;
+        auto* samples = reinterpret_cast<const short*>(buffer->pAudioData);
+        auto frames = int(buffer->AudioBytes / wf.nBlockAlign);
+
+        if (options.trimSilence)
+        {
+            auto threshold = (short)std::min(32767.0, 32768.0 * pow(10.0, options.silenceThreshold / 20.0));
+            auto first = firstAudible(samples, frames * channels, threshold);
+            if (first >= 0) // a sound that is silent all the way through is left alone, it's silent on purpose
+            {
+                auto last = lastAudible(samples, frames * channels, threshold);
+                auto padding = std::max(options.silencePadding, 0) * int(wf.nSamplesPerSec) / 1000;
+                auto begin = std::max(first / channels - padding, 0);
+                auto end = std::min(last / channels + 1 + padding, frames);
+
+                report.trimmedFrames = frames - (end - begin);
+                samples += size_t(begin) * channels;
+                frames = end - begin;
+            }
+        }
+
+        std::vector<short> mono;
+        if (options.collapseMono && channels == 2 && identicalChannels(samples, frames, options.monoTolerance))
+        {
+            mono.resize(frames);
+            mixToMono(samples, mono.data(), frames);
+            samples = mono.data();
+            channels = 1;
+            report.collapsedToMono = true;
+        }
+
+        // pre-baked data is mixed at the rate of the mastering voice, otherwise only downsampling saves anything
+        auto rate = int(wf.nSamplesPerSec);
+        if (options.preBake)
+            rate = XAudio2Device::instance().getMasterRate();
+        else if (options.targetRate > 0 && options.targetRate < rate)
+            rate = options.targetRate;
+
+        std::vector<float> resampled;
+        if (rate > 0 && rate != int(wf.nSamplesPerSec) && frames > 0)
+        {
+            resampled = resample(samples, frames, channels, wf.nSamplesPerSec, rate);
+            frames = int(resampled.size()) / channels;
+            report.optimizedRate = rate;
+        }
+
+        if (!report.trimmedFrames && !report.collapsedToMono && report.optimizedRate == report.originalRate && !options.preBake)
+            return report; // nothing to save
+
+        auto count = size_t(frames) * channels;
+        std::vector<char> data;
+        if (options.preBake)
+        {
+            data.resize(count * sizeof(float));
+            auto* output = reinterpret_cast<float*>(data.data());
+            if (!resampled.empty())
+                scaleToFloat(resampled.data(), output, count);
+            else
+                PCM16ToFloat(samples, output, count);
+            report.preBaked = true;
+        }
+        else if (!resampled.empty())
+        {
+            data.resize(count * sizeof(short));
+            floatToPCM16(resampled.data(), reinterpret_cast<short*>(data.data()), count);
+        }
+        else // trimmed or collapsed 16-bit data
+        {
+            data.assign(reinterpret_cast<const char*>(samples), reinterpret_cast<const char*>(samples + count));
+        }
+
+        auto sampleBytes = options.preBake ? int(sizeof(float)) : int(sizeof(short));
+        wf.wFormatTag = options.preBake ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+        wf.nChannels = channels;
+        wf.nSamplesPerSec = report.optimizedRate;
+        wf.wBitsPerSample = sampleBytes * 8;
+        wf.nBlockAlign = channels * sampleBytes;
+        wf.nAvgBytesPerSec = wf.nBlockAlign * wf.nSamplesPerSec;
+
+        auto* optimized = XABuffer::create(ctx, wf, data.data(), int(data.size()));
+        if (!optimized) // out of memory, keep the original
+            return LoadReport{ report.originalBytes, report.originalBytes, 0, false, report.originalRate, report.originalRate, false };
+
+        XABuffer::destroy(buffer);
+        buffer = optimized;
+        report.optimizedBytes = optimized->AudioBytes;
+        return report;
+    }
+}
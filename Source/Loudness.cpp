@@ -0,0 +1,489 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#include "OneSound\Loudness.h"
+
+#include "OneSound\StreamType\AudioStream.h"
+#include "OneSound\VirtualFileSystem.h"
+#include "OneSound\XAudio2Device.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <emmintrin.h>
+
+namespace onesnd
+{
+    static const double Pi = 3.14159265358979323846;
+
+    // bump this whenever the measurement changes, the old cache entries are never hit again
+    static const char* LoudnessVersion = "BS.1770-4/1";
+
+    // sounds are split between threads in parts of at least this many 100ms blocks
+    static const int MinBlocksPerThread = 300;
+
+    // coefficients of the two K-weighting biquads, the pre-filter shelf and the RLB high-pass
+    struct KWeighting
+    {
+        double b[2][3];
+        double a[2][2];
+
+        KWeighting(double rate)
+        {
+            // the BS.1770 filters are specified at 48kHz, these are the analog prototypes behind them
+            auto K = tan(Pi * 1681.974450955533 / rate);
+            auto Q = 0.7071752369554196;
+            auto Vh = pow(10.0, 3.999843853973347 / 20.0);
+            auto Vb = pow(Vh, 0.4996667741545416);
+            auto a0 = 1.0 + K / Q + K * K;
+            b[0][0] = (Vh + Vb * K / Q + K * K) / a0;
+            b[0][1] = 2.0 * (K * K - Vh) / a0;
+            b[0][2] = (Vh - Vb * K / Q + K * K) / a0;
+            a[0][0] = 2.0 * (K * K - 1.0) / a0;
+            a[0][1] = (1.0 - K / Q + K * K) / a0;
+
+            K = tan(Pi * 38.13547087602444 / rate);
+            Q = 0.5003270373238773;
+            a0 = 1.0 + K / Q + K * K;
+            b[1][0] = 1.0;
+            b[1][1] = -2.0;
+            b[1][2] = 1.0;
+            a[1][0] = 2.0 * (K * K - 1.0) / a0;
+            a[1][1] = (1.0 - K / Q + K * K) / a0;
+        }
+    };
+
+    // channel weights of BS.1770, the LFE of 5.1 doesn't count
+    static double weightOf(int channel, int channels)
+    {
+        if (channels != 6)
+            return 1.0;
+        return channel == 3 ? 0.0 : (channel >= 4 ? 1.41 : 1.0);
+    }
+
+    // interleaved float samples of the frames read so far, the source converts from its own format
+    using FrameReader = std::function<int(long long frame, float* dst, int frames)>;
+
+    static void toFloat(const void* src, float* dst, size_t count, const WAVEFORMATEX& wf)
+    {
+        if (wf.wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+        {
+            memcpy(dst, src, count * sizeof(float));
+        }
+        else if (wf.wBitsPerSample == 16)
+        {
+            auto* samples = static_cast<const short*>(src);
+            auto scale = _mm_set1_ps(1.0f / 32768.0f);
+            auto i = size_t(0);
+            for (; i + 8 <= count; i += 8)
+            {
+                auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+                auto lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16); // sign extend
+                auto hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+                _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+                _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+            }
+            for (; i < count; ++i)
+                dst[i] = samples[i] / 32768.0f;
+        }
+        else // 8-bit PCM is unsigned
+        {
+            auto* samples = static_cast<const unsigned char*>(src);
+            for (auto i = size_t(0); i < count; ++i)
+                dst[i] = (samples[i] - 128) / 128.0f;
+        }
+    }
+
+    // largest magnitude of the samples
+    static float peakOf(const float* samples, size_t count)
+    {
+        auto sign = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        auto peak = _mm_setzero_ps();
+        auto i = size_t(0);
+        for (; i + 4 <= count; i += 4)
+            peak = _mm_max_ps(peak, _mm_and_ps(_mm_loadu_ps(samples + i), sign));
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, peak);
+        auto result = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+        for (; i < count; ++i)
+            result = std::max(result, fabsf(samples[i]));
+        return result;
+    }
+
+    // weighted K-filtered energy of the 100ms blocks of a part of the sound
+    struct Part
+    {
+        std::vector<double> energy; // sum of the weighted squares per block
+        std::vector<int> frames;    // frames per block, only the last block of the sound is shorter
+        float peak = 0.0f;
+    };
+
+    static void measurePart(const WAVEFORMATEX& wf, const FrameReader& read, long long begin, long long end, Part& part)
+    {
+        const auto channels = int(wf.nChannels);
+        const auto blockFrames = std::max(int(wf.nSamplesPerSec / 10), 1);
+        const auto pairs = (channels + 1) / 2;
+        const KWeighting k(wf.nSamplesPerSec);
+
+        // the channels are filtered in pairs, one per SSE2 lane
+        struct PairState { __m128d z[2][2]; __m128d weight; };
+        std::vector<PairState> state((size_t)pairs);
+        for (auto p = 0; p < pairs; ++p)
+        {
+            for (auto& stage : state[p].z)
+                stage[0] = stage[1] = _mm_setzero_pd();
+            auto second = p * 2 + 1 < channels ? weightOf(p * 2 + 1, channels) : 0.0;
+            state[p].weight = _mm_set_pd(second, weightOf(p * 2, channels));
+        }
+
+        __m128d b[2][3], a[2][2];
+        for (auto s = 0; s < 2; ++s)
+        {
+            for (auto i = 0; i < 3; ++i)
+                b[s][i] = _mm_set1_pd(k.b[s][i]);
+            for (auto i = 0; i < 2; ++i)
+                a[s][i] = _mm_set1_pd(k.a[s][i]);
+        }
+
+        // the filters settle during the pre-roll, it isn't measured
+        auto frame = std::max(begin - (long long)wf.nSamplesPerSec / 2, 0ll);
+        auto energy = _mm_setzero_pd();
+        auto inBlock = 0;
+
+        const auto chunkFrames = 4096;
+        std::vector<float> chunk(size_t(chunkFrames) * channels);
+        while (frame < end)
+        {
+            auto count = read(frame, chunk.data(), int(std::min<long long>(chunkFrames, end - frame)));
+            if (count <= 0)
+                break;
+
+            auto measuredFrom = int(std::max<long long>(begin - frame, 0));
+            if (measuredFrom < count)
+                part.peak = std::max(part.peak, peakOf(chunk.data() + size_t(measuredFrom) * channels, size_t(count - measuredFrom) * channels));
+
+            for (auto f = 0; f < count; ++f)
+            {
+                const auto* x = chunk.data() + size_t(f) * channels;
+                auto sum = _mm_setzero_pd();
+                for (auto p = 0; p < pairs; ++p)
+                {
+                    auto& z = state[p].z;
+                    auto in = _mm_set_pd(p * 2 + 1 < channels ? x[p * 2 + 1] : 0.0, x[p * 2]);
+
+                    // two transposed direct form II biquads
+                    auto y = _mm_add_pd(_mm_mul_pd(b[0][0], in), z[0][0]);
+                    z[0][0] = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b[0][1], in), _mm_mul_pd(a[0][0], y)), z[0][1]);
+                    z[0][1] = _mm_sub_pd(_mm_mul_pd(b[0][2], in), _mm_mul_pd(a[0][1], y));
+                    in = y;
+                    y = _mm_add_pd(_mm_mul_pd(b[1][0], in), z[1][0]);
+                    z[1][0] = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b[1][1], in), _mm_mul_pd(a[1][0], y)), z[1][1]);
+                    z[1][1] = _mm_sub_pd(_mm_mul_pd(b[1][2], in), _mm_mul_pd(a[1][1], y));
+
+                    sum = _mm_add_pd(sum, _mm_mul_pd(state[p].weight, _mm_mul_pd(y, y)));
+                }
+
+                if (frame + f < begin)
+                    continue;
+
+                energy = _mm_add_pd(energy, sum);
+                if (++inBlock == blockFrames)
+                {
+                    double lanes[2];
+                    _mm_storeu_pd(lanes, energy);
+                    part.energy.push_back(lanes[0] + lanes[1]);
+                    part.frames.push_back(inBlock);
+                    energy = _mm_setzero_pd();
+                    inBlock = 0;
+                }
+            }
+            frame += count;
+        }
+
+        if (inBlock) // the end of the sound
+        {
+            double lanes[2];
+            _mm_storeu_pd(lanes, energy);
+            part.energy.push_back(lanes[0] + lanes[1]);
+            part.frames.push_back(inBlock);
+        }
+    }
+
+    static double loudnessOf(double meanSquare)
+    {
+        return meanSquare > 0.0 ? -0.691 + 10.0 * log10(meanSquare) : -HUGE_VAL;
+    }
+
+    // splits the sound into parts on 100ms boundaries, measures them in parallel and gates the 400ms blocks
+    static LoudnessInfo measure(const WAVEFORMATEX& wf, long long frames, unsigned threads,
+                                const std::function<FrameReader()>& createReader)
+    {
+        LoudnessInfo info;
+        if (frames <= 0 || !wf.nChannels || !wf.nSamplesPerSec)
+            return info;
+
+        const auto blockFrames = std::max((long long)wf.nSamplesPerSec / 10, 1ll);
+        const auto blocks = (frames + blockFrames - 1) / blockFrames;
+
+        if (!threads)
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        threads = unsigned(std::max(std::min<long long>(threads, blocks / MinBlocksPerThread), 1ll));
+
+        std::vector<Part> parts(threads);
+        auto run = [&](unsigned i)
+        {
+            auto reader = createReader();
+            if (!reader)
+                return;
+            auto begin = blocks * i / threads * blockFrames;
+            auto end = std::min(blocks * (i + 1) / threads * blockFrames, frames);
+            measurePart(wf, reader, begin, end, parts[i]);
+        };
+
+        std::vector<std::thread> workers;
+        for (auto i = 1u; i < threads; ++i)
+            workers.emplace_back(run, i);
+        run(0);
+        for (auto& worker : workers)
+            worker.join();
+
+        std::vector<double> energy;
+        std::vector<int> counts;
+        for (auto& part : parts)
+        {
+            energy.insert(energy.end(), part.energy.begin(), part.energy.end());
+            counts.insert(counts.end(), part.frames.begin(), part.frames.end());
+            info.peak = std::max(info.peak, part.peak);
+        }
+        if (energy.empty())
+            return info;
+
+        // 400ms blocks overlapping by 75%, a shorter sound is a single block
+        std::vector<double> meanSquares;
+        auto span = std::min<size_t>(4, energy.size());
+        for (auto j = size_t(0); j + span <= energy.size(); ++j)
+        {
+            auto sum = 0.0;
+            auto count = 0;
+            for (auto i = j; i < j + span; ++i)
+                sum += energy[i], count += counts[i];
+            meanSquares.push_back(sum / count);
+        }
+
+        auto gatedMean = [&](double gate)
+        {
+            auto sum = 0.0;
+            auto count = 0;
+            for (auto z : meanSquares)
+                if (loudnessOf(z) > gate)
+                    sum += z, ++count;
+            return count ? sum / count : 0.0;
+        };
+
+        auto absolute = gatedMean(-70.0);
+        if (absolute <= 0.0)
+            return info; // silence
+
+        auto relative = loudnessOf(absolute) - 10.0;
+        info.integrated = float(std::max(loudnessOf(gatedMean(std::max(relative, -70.0))), -70.0));
+        return info;
+    }
+
+    LoudnessInfo measureLoudness(const XABuffer* buffer, unsigned threads)
+    {
+        if (!buffer || !buffer->wf.nBlockAlign)
+            return LoudnessInfo();
+
+        const auto wf = buffer->wf;
+        const auto frames = (long long)(buffer->AudioBytes / wf.nBlockAlign);
+        const auto* data = buffer->pAudioData;
+
+        return measure(wf, frames, threads, [&]() -> FrameReader
+        {
+            return [&](long long frame, float* dst, int count)
+            {
+                count = int(std::min<long long>(count, frames - frame));
+                toFloat(data + frame * wf.nBlockAlign, dst, size_t(count) * wf.nChannels, wf);
+                return count;
+            };
+        });
+    }
+
+    LoudnessInfo measureLoudness(AudioStream* strm, unsigned threads)
+    {
+        if (!strm || !strm->FullSampleBlockSize())
+            return LoudnessInfo();
+
+        const auto wf = XABuffer::formatOf(strm);
+        const auto frames = strm->Size() / wf.nBlockAlign;
+
+        // every thread reads with its own cursor, the stream itself if it can't create cursors
+        std::mutex cursorsMutex;
+        std::vector<std::unique_ptr<AudioStream>> cursors;
+        auto shared = false;
+        auto createReader = [&]() -> FrameReader
+        {
+            std::lock_guard<std::mutex> lock(cursorsMutex);
+            auto* cursor = strm->CreateCursor();
+            if (!cursor)
+            {
+                if (shared)
+                    return nullptr;
+                shared = true;
+                cursor = strm;
+            }
+            else
+            {
+                cursors.emplace_back(cursor);
+            }
+
+            return [cursor, wf, buffer = std::vector<char>()](long long frame, float* dst, int count) mutable
+            {
+                auto pos = frame * wf.nBlockAlign;
+                if (cursor->Position() != pos)
+                    cursor->Seek((unsigned long long)pos);
+
+                buffer.resize(size_t(count) * wf.nBlockAlign);
+                auto bytes = cursor->ReadSome(buffer.data(), int(buffer.size()));
+                auto read = bytes / wf.nBlockAlign;
+                toFloat(buffer.data(), dst, size_t(read) * wf.nChannels, wf);
+                return read;
+            };
+        };
+
+        // a decoder without cursors can't be shared between threads
+        if (auto* probe = strm->CreateCursor())
+            delete probe;
+        else
+            threads = 1;
+
+        auto info = measure(wf, frames, threads, createReader);
+        strm->Seek(0);
+        return info;
+    }
+
+    LoudnessNormalizer::LoudnessNormalizer() :
+        enabled(false),
+        target(-23.0f),
+        maxBoost(12.0f),
+        hits(0),
+        measured(0)
+    { }
+
+    void LoudnessNormalizer::enable(float targetLUFS, float boost)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            target = targetLUFS;
+            maxBoost = std::max(boost, 0.0f);
+        }
+        enabled = true;
+    }
+
+    void LoudnessNormalizer::disable()
+    {
+        enabled = false;
+    }
+
+    void LoudnessNormalizer::setCacheFile(const fs::path& file)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cacheFile = file;
+
+        // one "key integrated peak" line per file
+        std::ifstream in(file);
+        unsigned long long key;
+        LoudnessInfo info;
+        while (in >> std::hex >> key >> std::dec >> info.integrated >> info.peak)
+            cache[key] = info;
+    }
+
+    unsigned long long LoudnessNormalizer::key(const fs::path& file) const
+    {
+        auto size = 0ull;
+        auto modified = 0ll;
+        if (!VirtualFileSystem::instance().stat(file, size, modified))
+            return 0;
+
+        // every load asks for the key, so it's taken from the file metadata instead of the data
+        auto name = PackFile::normalizeName(file);
+        auto hash = hash_fnv1a(LoudnessVersion, strlen(LoudnessVersion));
+        hash = hash_fnv1a(name.data(), name.size(), hash);
+        hash = hash_fnv1a(&size, sizeof(size), hash);
+        hash = hash_fnv1a(&modified, sizeof(modified), hash);
+        return hash ? hash : 1;
+    }
+
+    float LoudnessNormalizer::gainOf(const LoudnessInfo& info) const
+    {
+        if (!info.IsValid())
+            return 1.0f; // silence stays silent
+
+        auto gain = std::min(target - info.integrated, maxBoost);
+
+        // the peaks stay below -1 dBFS, so the boost never clips
+        if (info.peak > 0.0f)
+            gain = std::min(gain, -1.0f - 20.0f * log10f(info.peak));
+
+        return powf(10.0f, std::min(gain, maxBoost) / 20.0f);
+    }
+
+    bool LoudnessNormalizer::lookup(unsigned long long key, LoudnessInfo& info)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = cache.find(key);
+        if (it == cache.end())
+            return false;
+
+        info = it->second;
+        ++hits;
+        return true;
+    }
+
+    void LoudnessNormalizer::store(unsigned long long key, const LoudnessInfo& info)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cache[key] = info;
+        ++measured;
+
+        if (!cacheFile.empty())
+        {
+            std::ofstream out(cacheFile, std::ios::app);
+            out << std::hex << key << std::dec << ' ' << info.integrated << ' ' << info.peak << '\n';
+        }
+    }
+
+    float LoudnessNormalizer::analyze(const fs::path& file, const XABuffer* buffer)
+    {
+        auto cacheKey = key(file);
+        LoudnessInfo info;
+        if (!cacheKey || !lookup(cacheKey, info))
+        {
+            info = measureLoudness(buffer);
+            if (cacheKey)
+                store(cacheKey, info);
+        }
+        return gainOf(info);
+    }
+
+    float LoudnessNormalizer::analyze(const fs::path& file, AudioStream* strm)
+    {
+        auto cacheKey = key(file);
+        LoudnessInfo info;
+        if (!cacheKey || !lookup(cacheKey, info))
+        {
+            info = measureLoudness(strm);
+            if (cacheKey)
+                store(cacheKey, info);
+        }
+        return gainOf(info);
+    }
+}
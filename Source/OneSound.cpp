@@ -22,6 +22,11 @@ namespace onesnd
         return pd;
     }
 
+    DecoderPerformance OneSound::getDecoderPerformance() const
+    {
+        return MP3Stream::getDecoderPerformance();
+    }
+
     OneSound::~OneSound()
     {
         this->finalize();
@@ -31,6 +36,17 @@ namespace onesnd
     {
         if (!XAudio2Device::instance().getEngine())
             XAudio2Device::instance().initialize();
+
+        // here rather than on the first MP3 load, which may be in the middle of a game
+        try
+        {
+            if (MP3Stream::getDecoderPerformance().decoder.empty())
+                MP3Stream::calibrate();
+        }
+        catch (const std::runtime_error&)
+        {
+            // mpg123 isn't installed, MP3 loads report it
+        }
     }
 
     void OneSound::finalize() const
@@ -0,0 +1,265 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#include "OneSound\PCMCache.h"
+
+#include "OneSound\VirtualFileSystem.h"
+#include "OneSound\XAudio2Device.h"
+
+#include <algorithm>
+#include <fstream>
+#include <thread>
+#include <sstream>
+
+namespace onesnd
+{
+#pragma pack(push)
+#pragma pack(1)
+    struct PCMCACHEHEADER
+    {
+        int Magic;                      // contains the letters "OSPC"
+        unsigned int Version;           // cache file version
+        unsigned long long Key;         // key of the source file
+        unsigned short Channels;        // PCM format of the data
+        unsigned short BitsPerSample;
+        unsigned int SampleRate;
+        unsigned int DataSize;          // size of the PCM data that follows the header
+        unsigned int Reserved;
+    };
+#pragma pack(pop)
+
+    static const int PCMCacheMagic = (int)'CPSO';
+    static const unsigned int PCMCacheVersion = 1;
+
+    // bump this whenever the decoders change their output, the old entries are never hit again
+    static const char* DecoderVersion = "mpg123+vorbisfile/PCM16/1";
+
+    PCMCache::PCMCache() :
+        enabled(false),
+        maxBytes(0),
+        hits(0),
+        misses(0)
+    { }
+
+    void PCMCache::enable(const fs::path& dir, unsigned long long limit)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            directory = dir;
+            maxBytes = limit;
+
+            std::error_code ec;
+            fs::create_directories(directory, ec);
+            if (ec)
+                throw std::runtime_error("Can't create PCM cache directory: "s + directory.string());
+        }
+
+        enabled = true;
+        trim();
+    }
+
+    void PCMCache::disable()
+    {
+        enabled = false;
+    }
+
+    fs::path PCMCache::entryPath(unsigned long long key) const
+    {
+        char name[32];
+        sprintf_s(name, "%016llx.pcm", key);
+        return directory / name;
+    }
+
+    unsigned long long PCMCache::key(const fs::path& file) const
+    {
+        auto extension = file.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+        if (extension.empty() || extension == ".wav")
+            return 0; // already PCM, nothing to win
+
+        auto size = 0ull;
+        auto modified = 0ll;
+        if (!VirtualFileSystem::instance().stat(file, size, modified))
+            return 0;
+
+        // taken from the file metadata, reading the whole file in front of every hit would cost what the cache saves
+        auto name = PackFile::normalizeName(file);
+        auto hash = hash_fnv1a(DecoderVersion, strlen(DecoderVersion));
+        hash = hash_fnv1a(name.data(), name.size(), hash);
+        hash = hash_fnv1a(&size, sizeof(size), hash);
+        hash = hash_fnv1a(&modified, sizeof(modified), hash);
+        return hash ? hash : 1;
+    }
+
+    XABuffer* PCMCache::load(SoundBuffer* ctx, unsigned long long key)
+    {
+        if (!enabled || !key)
+            return nullptr;
+
+        fs::path path;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            path = entryPath(key);
+        }
+
+        auto file = CreateFileA(path.string().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                                nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            ++misses;
+            return nullptr;
+        }
+
+        auto size = file_size(file);
+        auto mapping = size > sizeof(PCMCACHEHEADER) ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+        CloseHandle(file);
+
+        auto* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (mapping)
+            CloseHandle(mapping); // the view keeps the mapping alive
+
+        if (!view)
+        {
+            ++misses;
+            return nullptr;
+        }
+
+        PCMCACHEHEADER header;
+        memcpy(&header, view, sizeof(header));
+        if (header.Magic != PCMCacheMagic || header.Version != PCMCacheVersion || header.Key != key ||
+            sizeof(header) + header.DataSize > size || !header.Channels || !header.BitsPerSample)
+        {
+            UnmapViewOfFile(view);
+            ++misses;
+            return nullptr;
+        }
+
+        WAVEFORMATEX wf = {};
+        wf.wFormatTag = WAVE_FORMAT_PCM;
+        wf.nChannels = header.Channels;
+        wf.nSamplesPerSec = header.SampleRate;
+        wf.wBitsPerSample = header.BitsPerSample;
+        wf.nBlockAlign = header.Channels * header.BitsPerSample / 8;
+        wf.nAvgBytesPerSec = wf.nBlockAlign * wf.nSamplesPerSec;
+
+        auto* buffer = XABuffer::createMapped(ctx, wf, view, (const char*)view + sizeof(header), int(header.DataSize));
+        if (!buffer)
+        {
+            UnmapViewOfFile(view);
+            return nullptr;
+        }
+
+        std::error_code ec; // the write time is the LRU stamp of the entry
+        fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+
+        ++hits;
+        return buffer;
+    }
+
+    void PCMCache::store(unsigned long long key, const XABuffer* buffer)
+    {
+        if (!enabled || !key || !buffer || !buffer->AudioBytes)
+            return;
+
+        fs::path path;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            path = entryPath(key);
+        }
+
+        PCMCACHEHEADER header = {};
+        header.Magic = PCMCacheMagic;
+        header.Version = PCMCacheVersion;
+        header.Key = key;
+        header.Channels = buffer->wf.nChannels;
+        header.BitsPerSample = buffer->wf.wBitsPerSample;
+        header.SampleRate = buffer->wf.nSamplesPerSec;
+        header.DataSize = buffer->AudioBytes;
+
+        // written aside and renamed, so another process never maps a half written entry
+        std::stringstream temp;
+        temp << path.string() << '.' << std::this_thread::get_id() << ".tmp";
+        {
+            std::ofstream out(temp.str(), std::ios::binary | std::ios::trunc);
+            if (!out)
+                return; // the cache is optional, the sound is loaded anyway
+
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(buffer->pAudioData), buffer->AudioBytes);
+            if (!out)
+            {
+                out.close();
+                std::error_code ec;
+                fs::remove(temp.str(), ec);
+                return;
+            }
+        }
+
+        std::error_code ec;
+        fs::rename(temp.str(), path, ec);
+        if (ec)
+            fs::remove(temp.str(), ec); // somebody else stored it first
+
+        trim();
+    }
+
+    void PCMCache::trim()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (directory.empty())
+            return;
+
+        struct CacheEntry
+        {
+            fs::path path;
+            fs::file_time_type used;
+            unsigned long long size;
+        };
+
+        std::vector<CacheEntry> entries;
+        auto total = 0ull;
+
+        std::error_code ec;
+        for (const auto& item : fs::directory_iterator(directory, ec))
+        {
+            if (item.path().extension() != ".pcm")
+                continue;
+
+            CacheEntry entry = { item.path(), fs::last_write_time(item.path(), ec), fs::file_size(item.path(), ec) };
+            if (ec)
+                continue;
+
+            total += entry.size;
+            entries.push_back(entry);
+        }
+
+        if (total <= maxBytes)
+            return;
+
+        std::sort(entries.begin(), entries.end(), [](const CacheEntry& a, const CacheEntry& b) { return a.used < b.used; });
+        for (const auto& entry : entries)
+        {
+            if (total <= maxBytes)
+                break;
+
+            // mapped entries can't be removed, they are still in use anyway
+            if (fs::remove(entry.path, ec))
+                total -= entry.size;
+        }
+    }
+
+    void PCMCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (directory.empty())
+            return;
+
+        std::error_code ec;
+        for (const auto& item : fs::directory_iterator(directory, ec))
+            if (item.path().extension() == ".pcm")
+                fs::remove(item.path(), ec);
+    }
+}
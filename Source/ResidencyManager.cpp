@@ -0,0 +1,98 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#include "OneSound\ResidencyManager.h"
+
+#include "OneSound\SoundType\SoundBuffer.h"
+
+#include <algorithm>
+
+namespace onesnd
+{
+    ResidencyManager::ResidencyManager() :
+        idleTime(0.0),
+        budget(0),
+        memoryLoadLimit(100),
+        evictions(0),
+        rehydrations(0),
+        evictedBytes(0),
+        residentBytes(0)
+    { }
+
+    void ResidencyManager::registerBuffer(SoundBuffer* buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffers.push_back(buffer);
+    }
+
+    void ResidencyManager::unregisterBuffer(SoundBuffer* buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffers.erase(std::remove(buffers.begin(), buffers.end(), buffer), buffers.end());
+    }
+
+    void ResidencyManager::update()
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto idle = std::chrono::duration<double>(idleTime.load());
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto resident = 0ull;
+        std::vector<SoundBuffer*> candidates; // unbound buffers that still hold their data
+        for (auto* buffer : buffers)
+        {
+            if (buffer->IsStream())
+                continue; // streams only hold a few buffers, they are never evicted
+
+            auto bytes = (unsigned long long)buffer->ResidentBytes();
+            if (!bytes)
+                continue;
+
+            if (buffer->getReferanceCount() == 0)
+            {
+                if (idle.count() > 0 && now - buffer->getLastUsed() >= idle && buffer->Evict())
+                    continue; // idle for too long
+                candidates.push_back(buffer);
+            }
+            resident += bytes;
+        }
+
+        // over the budget, or the system is low on memory: the least recently used go first
+        auto target = budget ? budget.load() : resident;
+        if (memoryLoadLimit < 100)
+        {
+            MEMORYSTATUSEX status = { sizeof(status) };
+            if (GlobalMemoryStatusEx(&status) && status.dwMemoryLoad >= memoryLoadLimit)
+                target = std::min(target, resident - resident / 4);
+        }
+
+        if (resident > target)
+        {
+            std::sort(candidates.begin(), candidates.end(), [](SoundBuffer* a, SoundBuffer* b)
+            {
+                return a->getLastUsed() < b->getLastUsed();
+            });
+
+            for (auto* buffer : candidates)
+            {
+                if (resident <= target)
+                    break;
+
+                auto bytes = (unsigned long long)buffer->ResidentBytes();
+                if (buffer->Evict())
+                    resident -= bytes;
+            }
+        }
+
+        residentBytes = resident;
+    }
+
+    ResidencyStatistics ResidencyManager::getStatistics() const
+    {
+        return { evictions, rehydrations, evictedBytes, residentBytes };
+    }
+}
@@ -0,0 +1,240 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#include "OneSound\SoundAsset.h"
+
+#include "OneSound\SoundType\SoundStream.h"
+#include "OneSound\StreamType\AudioStream.h"
+#include "OneSound\VirtualFileSystem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+namespace onesnd
+{
+    // sounds this small cost less decoded than their two stream buffers
+    static const unsigned long long SmallSound = 64 * 1024;
+
+    // decoded data worth keeping per playing instance, it saves a decoder per instance
+    static const unsigned long long DecodedPerInstance = 2 * 1024 * 1024;
+
+    static std::atomic<unsigned long long> assetBudget(256ull * 1024 * 1024);
+
+    static std::mutex assetsMutex;
+    static std::vector<SoundAsset*> assets;
+
+    // [lock held]
+    static unsigned long long chargedBytes()
+    {
+        auto total = 0ull;
+        for (auto* asset : assets)
+            total += asset->getCharge();
+        return total;
+    }
+
+    static unsigned long long availableBytes(unsigned long long charged)
+    {
+        auto budget = assetBudget.load();
+        if (!budget)
+            return std::numeric_limits<unsigned long long>::max();
+
+        return budget > charged ? budget - charged : 0;
+    }
+
+    SoundAsset::SoundAsset(const fs::path& file, int instances) :
+        file(file),
+        instances(std::max(instances, 1)),
+        decodedBytes(0),
+        encodedBytes(0),
+        bytesPerSecond(0),
+        residency(Residency::Streamed),
+        charge(0)
+    { }
+
+    SoundAsset::~SoundAsset()
+    {
+        std::lock_guard<std::mutex> lock(assetsMutex);
+        assets.erase(std::remove(assets.begin(), assets.end(), this), assets.end());
+    }
+
+    std::shared_ptr<SoundAsset> SoundAsset::create(const fs::path& file, int instances)
+    {
+        std::shared_ptr<SoundAsset> asset(new SoundAsset(file, instances));
+
+        // the file size tells the encoded size, the header tells the decoded size
+        auto io = VirtualFileSystem::instance().open(file);
+        asset->encodedBytes = (unsigned long long)std::max<long long>(io.seek(io.context, 0, SEEK_END), 0);
+        io.seek(io.context, 0, SEEK_SET);
+
+        std::unique_ptr<AudioStream> strm(openAudioStream(io, file));
+        if (!strm)
+            throw std::runtime_error("Can't open sound asset: "s + file.string());
+
+        asset->decodedBytes = (unsigned long long)strm->Size();
+        asset->bytesPerSecond = (unsigned long long)strm->BytesPerSecond();
+        strm->CloseStream();
+
+        auto mode = Residency::Streamed;
+        {
+            std::lock_guard<std::mutex> lock(assetsMutex);
+            mode = choose(asset->decodedBytes, asset->encodedBytes, asset->bytesPerSecond,
+                          asset->instances, availableBytes(chargedBytes()));
+        }
+
+        // streaming from disk always works, if anything does
+        if (!asset->switchTo(mode) && (mode == Residency::Streamed || !asset->switchTo(Residency::Streamed)))
+            throw std::runtime_error("Can't load sound asset: "s + file.string());
+
+        std::lock_guard<std::mutex> lock(assetsMutex);
+        asset->self = asset;
+        assets.push_back(asset.get());
+        return asset;
+    }
+
+    bool SoundAsset::setResidency(Residency mode)
+    {
+        return switchTo(mode);
+    }
+
+    bool SoundAsset::switchTo(Residency mode)
+    {
+        {
+            std::lock_guard<std::mutex> lock(assetsMutex);
+            if (sound && mode == residency)
+                return true;
+
+            if (sound && sound->getReferanceCount() > 0)
+                return false; // SoundObjects still play the current data
+        }
+
+        // decoded without the lock, the other assets and the game thread don't wait for it
+        auto loaded = load(mode);
+        if (!loaded)
+            return false;
+
+        std::lock_guard<std::mutex> lock(assetsMutex); // released before the replaced data
+        if (sound && sound->getReferanceCount() > 0)
+            return false; // bound meanwhile, the new data goes
+
+        std::swap(sound, loaded);
+        residency = mode;
+        charge = chargeOf(mode, decodedBytes, encodedBytes, bytesPerSecond, instances);
+        return true;
+    }
+
+    std::shared_ptr<SoundBuffer> SoundAsset::load(Residency mode) const
+    {
+        switch (mode)
+        {
+            case Residency::Decoded:
+            {
+                auto buffer = std::make_shared<SoundBuffer>();
+                return buffer->Load(file) ? buffer : nullptr;
+            }
+            case Residency::Compressed:
+            {
+                auto stream = std::make_shared<SoundStream>();
+                return stream->LoadInMemory(file) ? stream : nullptr;
+            }
+            case Residency::Streamed:
+            {
+                auto stream = std::make_shared<SoundStream>();
+                return stream->Load(file) ? stream : nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    unsigned long long SoundAsset::chargeOf(Residency mode, unsigned long long decodedBytes, unsigned long long encodedBytes,
+                                            unsigned long long bytesPerSecond, int instances)
+    {
+        // every playing instance of a stream holds a front and a back buffer of one second each
+        auto streamBuffers = (unsigned long long)instances * 2 * bytesPerSecond;
+
+        switch (mode)
+        {
+            case Residency::Decoded:    return decodedBytes;
+            case Residency::Compressed: return encodedBytes + streamBuffers;
+            case Residency::Streamed:   return streamBuffers;
+        }
+        return 0;
+    }
+
+    Residency SoundAsset::choose(unsigned long long decodedBytes, unsigned long long encodedBytes,
+                                 unsigned long long bytesPerSecond, int instances, unsigned long long available)
+    {
+        if (decodedBytes <= SmallSound)
+            return Residency::Decoded;
+
+        // a single XAudio2 buffer holds less than 2GB
+        auto decoded = chargeOf(Residency::Decoded, decodedBytes, encodedBytes, bytesPerSecond, instances);
+        if (decoded <= available && decodedBytes <= DecodedPerInstance * (unsigned long long)instances &&
+            decodedBytes < XAUDIO2_MAX_BUFFER_BYTES)
+            return Residency::Decoded;
+
+        // keeping an uncompressed file in memory doesn't win anything over decoding it
+        auto compressed = chargeOf(Residency::Compressed, decodedBytes, encodedBytes, bytesPerSecond, instances);
+        if (compressed <= available && encodedBytes < decodedBytes)
+            return Residency::Compressed;
+
+        return Residency::Streamed;
+    }
+
+    void SoundAsset::setBudget(unsigned long long bytes)
+    {
+        assetBudget = bytes;
+    }
+
+    unsigned long long SoundAsset::getBudget()
+    {
+        return assetBudget;
+    }
+
+    void SoundAsset::rebalance()
+    {
+        struct Move
+        {
+            std::shared_ptr<SoundAsset> asset; // released after the lock, it may be the last reference
+            Residency mode;
+            bool frees;
+        };
+
+        // planned under the lock, loaded without it: a decode doesn't stall every other asset operation
+        std::vector<Move> moves;
+        {
+            std::lock_guard<std::mutex> lock(assetsMutex);
+
+            // the largest assets are placed first, they matter the most for the budget
+            auto ordered = assets;
+            std::sort(ordered.begin(), ordered.end(), [](SoundAsset* a, SoundAsset* b) { return a->decodedBytes > b->decodedBytes; });
+
+            auto charged = chargedBytes();
+            for (auto* asset : ordered)
+            {
+                auto others = charged - asset->charge;
+                auto mode = choose(asset->decodedBytes, asset->encodedBytes, asset->bytesPerSecond,
+                                   asset->instances, availableBytes(others));
+                if (mode == asset->residency || (asset->sound && asset->sound->getReferanceCount() > 0))
+                    continue;
+
+                auto pinned = asset->self.lock();
+                if (!pinned)
+                    continue; // being destroyed, it waits for the lock to leave the list
+
+                auto next = chargeOf(mode, asset->decodedBytes, asset->encodedBytes, asset->bytesPerSecond, asset->instances);
+                moves.push_back({ pinned, mode, next < asset->charge });
+                charged = others + next;
+            }
+        }
+
+        // the ones that free memory first, so the budget holds in between;
+        // a switch that fails leaves its asset as it is until the next rebalance
+        std::stable_partition(moves.begin(), moves.end(), [](const Move& move) { return move.frees; });
+        for (auto& move : moves)
+            move.asset->switchTo(move.mode);
+    }
+}
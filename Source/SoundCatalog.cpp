@@ -0,0 +1,107 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#include "OneSound\SoundCatalog.h"
+
+#include "OneSound\StreamType\DecoderRegistry.h"
+#include "OneSound\VirtualFileSystem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace onesnd
+{
+    SoundInfo probeSound(const fs::path& file)
+    {
+        SoundInfo info;
+        info.file = file;
+
+        try
+        {
+            auto io = VirtualFileSystem::instance().open(file);
+            info.fileSize = (unsigned long long)std::max<long long>(io.seek(io.context, 0, SEEK_END), 0);
+            io.seek(io.context, 0, SEEK_SET);
+
+            // sniff once here for the decoder name, the registry sniffs the same bytes again on open
+            unsigned char head[DecoderRegistry::SniffSize];
+            auto bytesRead = io.read(io.context, head, sizeof(head));
+            io.seek(io.context, 0, SEEK_SET);
+            info.decoder = DecoderRegistry::instance().identify(head, size_t(std::max(bytesRead, 0)), file);
+
+            std::unique_ptr<AudioStream> strm(openAudioStream(io, file));
+            if (!strm)
+            {
+                info.error = "Unknown sound format";
+                return info;
+            }
+
+            strm->ScanLength();
+
+            info.channels = strm->Channels();
+            info.sampleRate = strm->Frequency();
+            info.bitsPerSample = strm->SingleSampleSize() * 8;
+            info.frames = strm->FullSampleBlockSize() ? (unsigned long long)strm->Size() / strm->FullSampleBlockSize() : 0;
+            info.tags = strm->ReadTags();
+        }
+        catch (const std::exception& e)
+        {
+            info.error = e.what();
+        }
+        return info;
+    }
+
+    std::vector<SoundInfo> scanSounds(const fs::path& directory, bool recursive, unsigned threads)
+    {
+        std::vector<fs::path> files;
+        std::error_code ec;
+        auto collect = [&](const fs::directory_entry& entry)
+        {
+            if (fs::is_regular_file(entry.status()) && DecoderRegistry::instance().knowsExtension(entry.path()))
+                files.push_back(entry.path());
+        };
+
+        if (recursive)
+        {
+            for (fs::recursive_directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec))
+                collect(*it);
+        }
+        else
+        {
+            for (fs::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec))
+                collect(*it);
+        }
+
+        std::vector<SoundInfo> infos(files.size());
+        if (files.empty())
+            return infos;
+
+        // the decoder libraries are loaded on first use, which must not happen on several threads at once
+        DecoderRegistry::instance().preload();
+
+        if (!threads)
+            threads = std::max(std::thread::hardware_concurrency(), 1u) * 2;
+        threads = std::min<unsigned>(threads, (unsigned)files.size());
+
+        // every thread takes the next file, so a slow file doesn't hold up a whole share of the list
+        std::atomic<size_t> next(0);
+        auto worker = [&]
+        {
+            for (auto i = next++; i < files.size(); i = next++)
+                infos[i] = probeSound(files[i]);
+        };
+
+        std::vector<std::thread> workers;
+        for (auto i = 1u; i < threads; ++i)
+            workers.emplace_back(worker);
+        worker();
+
+        for (auto& thread : workers)
+            thread.join();
+
+        return infos;
+    }
+}
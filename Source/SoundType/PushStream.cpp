@@ -0,0 +1,278 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#include "OneSound\SoundType\PushStream.h"
+
+#include "OneSound\SoundType\SoundObject.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace onesnd
+{
+    // bytes of whole frames in the specified milliseconds
+    static int framesIn(const WAVEFORMATEX& wf, int milliseconds)
+    {
+        auto bytes = int((long long)wf.nAvgBytesPerSec * milliseconds / 1000);
+        return std::max(bytes - bytes % wf.nBlockAlign, int(wf.nBlockAlign));
+    }
+
+    PushStream::PushStream(int frequency, int channels, int bitsPerSample, int latency, int capacity) :
+        period(0),
+        writePos(0),
+        readPos(0),
+        submitPos(0),
+        submitted(),
+        submittedFirst(0),
+        submittedCount(0),
+        bound(nullptr),
+        lowWatermark(0),
+        highWatermark(0),
+        lowArmed(true),
+        highArmed(true),
+        bytesDropped(0),
+        underruns(0)
+    {
+        if ((bitsPerSample != 16 && bitsPerSample != 32) || channels < 1 || channels > XAUDIO2_MAX_AUDIO_CHANNELS ||
+            frequency < XAUDIO2_MIN_SAMPLE_RATE || frequency > XAUDIO2_MAX_SAMPLE_RATE)
+            throw std::runtime_error("Unsupported PushStream format: "s + std::to_string(frequency) + "Hz " +
+                                     std::to_string(channels) + "ch " + std::to_string(bitsPerSample) + "bit");
+
+        pumping.clear();
+
+        probedFormat.wFormatTag = bitsPerSample == 32 ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+        probedFormat.nChannels = WORD(channels);
+        probedFormat.nSamplesPerSec = DWORD(frequency);
+        probedFormat.wBitsPerSample = WORD(bitsPerSample);
+        probedFormat.nBlockAlign = WORD(channels * bitsPerSample / 8);
+        probedFormat.nAvgBytesPerSec = probedFormat.nSamplesPerSec * probedFormat.nBlockAlign;
+        probedFormat.cbSize = 0;
+
+        // half of the latency plays while the other half is queued
+        period = framesIn(probedFormat, std::max(latency / 2, 1));
+        ring.resize(size_t(std::max(framesIn(probedFormat, capacity), period * 2)));
+    }
+
+    PushStream::~PushStream()
+    {
+        Unload();
+    }
+
+    int PushStream::Write(const void* data, int bytes)
+    {
+        bytes -= bytes % probedFormat.nBlockAlign;
+        if (bytes <= 0)
+            return 0;
+
+        auto write = writePos.load(std::memory_order_relaxed);
+        auto used = write - readPos.load(std::memory_order_acquire);
+        auto count = int(std::min<unsigned long long>(bytes, ring.size() - used));
+
+        // the free space wraps around the end of the ring at most once
+        auto offset = size_t(write % ring.size());
+        auto first = std::min(size_t(count), ring.size() - offset);
+        memcpy(ring.data() + offset, data, first);
+        memcpy(ring.data(), static_cast<const unsigned char*>(data) + first, size_t(count) - first);
+
+        writePos.store(write + count, std::memory_order_release);
+        if (count < bytes)
+            bytesDropped += (unsigned long long)(bytes - count);
+
+        auto buffered = int(used) + count;
+        if (buffered >= lowWatermark)
+            lowArmed = true;
+        if (onHigh && buffered > highWatermark && highArmed.exchange(false))
+            onHigh(*this);
+
+        Pump();
+        return count;
+    }
+
+    int PushStream::Buffered() const
+    {
+        return int(writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_acquire));
+    }
+
+    int PushStream::Free() const
+    {
+        return int(ring.size()) - Buffered();
+    }
+
+    void PushStream::setLowWatermark(int milliseconds, Callback callback)
+    {
+        lowWatermark = milliseconds > 0 ? framesIn(probedFormat, milliseconds) : 0;
+        onLow = std::move(callback);
+        lowArmed = true;
+    }
+
+    void PushStream::setHighWatermark(int milliseconds, Callback callback)
+    {
+        highWatermark = milliseconds > 0 ? framesIn(probedFormat, milliseconds) : int(ring.size());
+        onHigh = std::move(callback);
+        highArmed = true;
+    }
+
+    PushStats PushStream::getStats() const
+    {
+        PushStats stats;
+        stats.bytesWritten = writePos;
+        stats.bytesPlayed = readPos;
+        stats.bytesDropped = bytesDropped;
+        stats.underruns = underruns;
+        return stats;
+    }
+
+    long long PushStream::Size() const
+    {
+        return Buffered() / probedFormat.nBlockAlign;
+    }
+
+    bool PushStream::Unload()
+    {
+        if (referance_count > 0)
+            return false; // still played by a SoundObject
+
+        writePos = 0;
+        readPos = 0;
+        submitPos = 0;
+        submittedFirst = 0;
+        submittedCount = 0;
+        return true;
+    }
+
+    bool PushStream::BindSource(SoundObject* so)
+    {
+        if (bound)
+            return false; // the ring is consumed by a single voice
+
+        while (pumping.test_and_set(std::memory_order_acquire))
+            std::this_thread::yield();
+        bound = so;
+        pumping.clear(std::memory_order_release);
+
+        lastUsed = std::chrono::steady_clock::now();
+        ++referance_count;
+
+        Pump(); // the data written before the bind plays right away
+        return true;
+    }
+
+    bool PushStream::UnbindSource(SoundObject* so)
+    {
+        if (so != bound)
+            return true;
+
+        auto* source = so->getSource();
+        source->Stop();
+        if (XABuffer::getBuffersQueued(source))
+            source->FlushSourceBuffers();
+
+        // the callbacks of the flushed buffers come for an unbound object, so their space is released here
+        while (pumping.test_and_set(std::memory_order_acquire))
+            std::this_thread::yield();
+        bound = nullptr;
+        readPos.store(submitPos, std::memory_order_release);
+        submittedFirst = 0;
+        submittedCount = 0;
+        pumping.clear(std::memory_order_release);
+
+        lastUsed = std::chrono::steady_clock::now();
+        --referance_count;
+        return true;
+    }
+
+    bool PushStream::ResetBuffer(SoundObject* so)
+    {
+        if (so != bound)
+            return false;
+
+        Pump();
+        return true;
+    }
+
+    void PushStream::OnBufferEnd(SoundObject* so)
+    {
+        // the producer only ever tries the flag, so this wait is short
+        while (pumping.test_and_set(std::memory_order_acquire))
+            std::this_thread::yield();
+
+        auto ran = so == bound && submittedCount > 0;
+        if (ran)
+        {
+            auto bytes = submitted[submittedFirst];
+            submittedFirst = (submittedFirst + 1) % XAUDIO2_MAX_QUEUED_BUFFERS;
+            --submittedCount;
+            readPos.store(readPos.load(std::memory_order_relaxed) + bytes, std::memory_order_release);
+        }
+
+        Submit();
+        auto dry = ran && submittedCount == 0;
+        pumping.clear(std::memory_order_release);
+
+        if (!ran)
+            return; // a flushed buffer of an unbound object
+
+        if (dry)
+            ++underruns;
+
+        auto buffered = Buffered();
+        if (buffered <= highWatermark)
+            highArmed = true;
+        if (onLow && buffered < lowWatermark && lowArmed.exchange(false))
+            onLow(*this);
+
+        Pump(); // picks up data written while the flag was held
+    }
+
+    void PushStream::Pump()
+    {
+        // the producer never waits: if another thread holds the flag, that thread submits the data
+        while (!pumping.test_and_set(std::memory_order_acquire))
+        {
+            auto seen = writePos.load(std::memory_order_acquire);
+            Submit();
+            pumping.clear(std::memory_order_release);
+
+            if (writePos.load(std::memory_order_acquire) == seen)
+                break; // nothing was written meanwhile
+        }
+    }
+
+    void PushStream::Submit()
+    {
+        if (!bound)
+            return;
+
+        auto* source = bound->getSource();
+        auto written = writePos.load(std::memory_order_acquire);
+        auto played = readPos.load(std::memory_order_relaxed);
+
+        while (submittedCount < XAUDIO2_MAX_QUEUED_BUFFERS)
+        {
+            auto available = written - submitPos;
+            if (!available)
+                break;
+
+            // a whole period is worth a buffer, less only if the voice would run dry before the next period
+            if (available < (unsigned long long)period && submitPos - played >= (unsigned long long)period)
+                break;
+
+            // XAudio2 reads straight from the ring, a buffer ends where the ring wraps around
+            auto offset = size_t(submitPos % ring.size());
+            auto bytes = int(std::min<unsigned long long>({ available, (unsigned long long)period, ring.size() - offset }));
+
+            XAUDIO2_BUFFER buffer = {};
+            buffer.AudioBytes = UINT32(bytes);
+            buffer.pAudioData = ring.data() + offset;
+            buffer.pContext = this;
+            if (FAILED(source->SubmitSourceBuffer(&buffer)))
+                break;
+
+            submitted[(submittedFirst + submittedCount++) % XAUDIO2_MAX_QUEUED_BUFFERS] = bytes;
+            submitPos += bytes;
+        }
+    }
+}
@@ -10,64 +10,101 @@
 #include "OneSound\SoundType\SoundBuffer.h"
 #include "OneSound\SoundType\SoundStream.h"
 
+#include "OneSound\PCMCache.h"
+#include "OneSound\Loudness.h"
+#include "OneSound\ResidencyManager.h"
+
+#include <algorithm>
+#include <atomic>
+
 namespace onesnd
 {
+    static std::atomic<bool> lazyLoading(false);
+    static std::atomic<int> lazyHeadMilliseconds(250);
+
+    static std::mutex optimizationMutex;
+    static LoadOptimization defaultOptimization;
+    static std::atomic<long long> bytesSaved(0);
+
     SoundBuffer::SoundBuffer() :
         referance_count(0), 
-        xaBuffer(nullptr)
-    { }
+        xaBuffer(nullptr),
+        probedFormat(),
+        probedBytes(0),
+        decoded(nullptr),
+        headBuffer(nullptr),
+        lastUsed(std::chrono::steady_clock::now()),
+        evicted(false),
+        normalizationGain(1.0f),
+        normalized(false)
+    {
+        ResidencyManager::instance().registerBuffer(this);
+    }
 
     SoundBuffer::SoundBuffer(const fs::path& file) : 
         referance_count(0), 
-        xaBuffer(nullptr)
+        xaBuffer(nullptr),
+        probedFormat(),
+        probedBytes(0),
+        decoded(nullptr),
+        headBuffer(nullptr),
+        lastUsed(std::chrono::steady_clock::now()),
+        evicted(false),
+        normalizationGain(1.0f),
+        normalized(false)
     {
+        ResidencyManager::instance().registerBuffer(this);
         Load(file);
     }
 
     SoundBuffer::~SoundBuffer()
     {
-        if (xaBuffer)
-            Unload();
+        ResidencyManager::instance().unregisterBuffer(this);
+        Unload();
     }
 
+    // the lazy buffers answer from the probed format until the data is decoded
     int SoundBuffer::Frequency() const
     {
-        return xaBuffer->wf.nSamplesPerSec;
+        return xaBuffer ? xaBuffer->wf.nSamplesPerSec : probedFormat.nSamplesPerSec;
     }
 
     int SoundBuffer::SampleBits() const
     {
-        return xaBuffer->wf.wBitsPerSample;
+        return xaBuffer ? xaBuffer->wf.wBitsPerSample : probedFormat.wBitsPerSample;
     }
 
     int SoundBuffer::SampleBytes() const
     {
-        return xaBuffer->nBytesPerSample;
+        return xaBuffer ? xaBuffer->nBytesPerSample : probedFormat.wBitsPerSample / 8;
     }
 
     int SoundBuffer::Channels() const
     {
-        return xaBuffer->wf.nChannels;
+        return xaBuffer ? xaBuffer->wf.nChannels : probedFormat.nChannels;
     }
 
     int SoundBuffer::FullSampleSize() const
     {
-        return xaBuffer->wf.nBlockAlign;
+        return xaBuffer ? xaBuffer->wf.nBlockAlign : probedFormat.nBlockAlign;
     }
 
     int SoundBuffer::SizeBytes() const
     {
-        return xaBuffer->AudioBytes;
+        return xaBuffer ? xaBuffer->AudioBytes : probedBytes;
     }
 
     int SoundBuffer::BytesPerSecond() const
     {
-        return xaBuffer->wf.nAvgBytesPerSec;
+        return xaBuffer ? xaBuffer->wf.nAvgBytesPerSec : probedFormat.nAvgBytesPerSec;
     }
 
-    int SoundBuffer::Size() const
+    long long SoundBuffer::Size() const
     {
-        return xaBuffer->nPCMSamples;
+        if (xaBuffer)
+            return xaBuffer->nPCMSamples;
+
+        return probedFormat.nBlockAlign ? probedBytes / probedFormat.nBlockAlign : 0;
     }
 
     int SoundBuffer::getReferanceCount() const
@@ -82,40 +119,351 @@ namespace onesnd
 
     const WAVEFORMATEX* SoundBuffer::WaveFormat() const
     {
-        return xaBuffer ? &xaBuffer->wf : nullptr;
+        if (xaBuffer)
+            return &xaBuffer->wf;
+
+        return probedFormat.nChannels ? &probedFormat : nullptr;
     }
 
     unsigned SoundBuffer::WaveFormatHash() const
     {
-        return xaBuffer ? xaBuffer->wfHash : 0;
+        if (xaBuffer)
+            return xaBuffer->wfHash;
+
+        return probedFormat.nChannels ? XABuffer::hashFormat(probedFormat) : 0;
+    }
+
+    XABuffer* SoundBuffer::getXABuffer()
+    {
+        Resolve(true);
+        return xaBuffer;
     }
 
     bool SoundBuffer::Load(const fs::path& file)
+    {
+        auto options = getLoadOptimization();
+        if (options.IsEnabled())
+            return Load(file, options);
+
+        return Load(file, lazyLoading);
+    }
+
+    bool SoundBuffer::Load(const fs::path& file, const LoadOptimization& options)
+    {
+        if (xaBuffer || !sourceFile.empty()) // is there existing data?
+            return false;
+
+        optimization = options;
+        if (!Load(file, false))
+        {
+            optimization = LoadOptimization();
+            return false;
+        }
+
+        bytesSaved += loadReport.BytesSaved();
+        return true;
+    }
+
+    bool SoundBuffer::Load(const fs::path& file, bool lazy)
     {
         if (XAudio2Device::instance().getEngine() == nullptr)
             throw std::runtime_error("Can't create sound because XAudio2 Device is not created.");
 
-        if (xaBuffer) // is there existing data?
+        if (xaBuffer || !sourceFile.empty()) // is there existing data?
             return false;
 
-        AudioStream mem; // temporary stream
-        AudioStream* strm = &mem;
-        if (!createAudioStream(strm, file.string().c_str()))
-            return false; // invalid file format or file not found
+        if (!lazy)
+        {
+            if (!(xaBuffer = Decode(file)))
+                return false;
+
+            sourceFile = file; // evicted data is decoded from here again
+            return true;
+        }
+
+        // only the header is read, the data is decoded when the sound is played for the first time
+        std::unique_ptr<AudioStream> strm(openAudioStream(file)); // temporary stream
+        if (!strm)
+            return false; // invalid file format
+
+        if (strm->Size() >= XAUDIO2_MAX_BUFFER_BYTES)
+            return false; // too long for a single buffer, it has to be streamed
+
+        probedFormat = XABuffer::formatOf(strm.get());
+        probedBytes = int(strm->Size());
+        strm->CloseStream();
+
+        sourceFile = file;
+        return probedBytes > 0;
+    }
+
+    XABuffer* SoundBuffer::Decode(const fs::path& file)
+    {
+        auto& cache = PCMCache::instance();
+        auto cacheKey = cache.isEnabled() ? cache.key(file) : 0;
+        if (cacheKey)
+        {
+            if (auto* cached = cache.load(this, cacheKey))
+                return Normalize(file, Optimize(cached)); // decoded by an earlier load
+        }
 
-        if (!strm->OpenStream(file))
-            return false; // failed to open the stream (probably not really correct format)
+        std::unique_ptr<AudioStream> strm(openAudioStream(file)); // temporary stream
+        if (!strm)
+            return nullptr; // invalid file format
 
-        xaBuffer = XABuffer::create(this, strm->Size(), strm);
-        strm->CloseStream(); // close this manually, otherwise we get a nasty error when the dtor runs...
+        if (strm->Size() >= XAUDIO2_MAX_BUFFER_BYTES)
+            return nullptr; // too long for a single buffer, it has to be streamed
+
+        auto* buffer = XABuffer::create(this, int(strm->Size()), strm.get());
+        strm->CloseStream();
         
+        if (buffer && cacheKey)
+            cache.store(cacheKey, buffer);
+
+        return Normalize(file, Optimize(buffer));
+    }
+
+    XABuffer* SoundBuffer::Optimize(XABuffer* buffer)
+    {
+        // the cache keeps the data as decoded, so the passes run on every load
+        if (buffer && optimization.IsEnabled())
+            loadReport = optimizeBuffer(this, buffer, optimization);
+
+        return buffer;
+    }
+
+    XABuffer* SoundBuffer::Normalize(const fs::path& file, XABuffer* buffer)
+    {
+        // measured once per load, evicted data decoded again keeps its gain
+        auto& normalizer = LoudnessNormalizer::instance();
+        if (buffer && !normalized && normalizer.isEnabled())
+        {
+            normalizationGain = normalizer.analyze(file, buffer);
+            normalized = true;
+        }
+        return buffer;
+    }
+
+    void SoundBuffer::prefetch()
+    {
+        std::lock_guard<std::mutex> lock(lazyMutex);
+        if (xaBuffer || pending.valid() || sourceFile.empty())
+            return; // already decoded or decoding
+
+        if (evicted)
+        {
+            evicted = false;
+            ResidencyManager::instance().onRehydrated();
+        }
+
+        pending = std::async(std::launch::async, [this, file = sourceFile]
+        {
+            XABuffer* buffer = nullptr;
+            try
+            {
+                buffer = Decode(file);
+            }
+            catch (const std::exception&)
+            {
+                // a file that can't be decoded is resolved as no data
+            }
+
+            // the heads that already ended continue from here, their voices never waited
+            std::lock_guard<std::mutex> lock(lazyMutex);
+            decoded = buffer;
+            if (buffer)
+            {
+                // the objects that bound meanwhile set their volume before the gain was known
+                for (auto* so : headBound)
+                    so->getSource()->SetVolume(so->getVolume() * normalizationGain);
+                for (auto* so : headEnded)
+                {
+                    so->getSource()->SetVolume(so->getVolume() * normalizationGain);
+                    SubmitRest(so, buffer);
+                }
+            }
+            headEnded.clear();
+        });
+    }
+
+    bool SoundBuffer::Resolve(bool wait)
+    {
+        if (xaBuffer)
+            return true;
+
+        if (!pending.valid())
+            return false; // not lazy or not prefetched
+
+        if (wait)
+            pending.wait(); // lazyMutex is free meanwhile, the voice callbacks don't wait behind the decode
+        else if (pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return false;
+        pending.get();
+
+        std::lock_guard<std::mutex> lock(lazyMutex);
+        xaBuffer = decoded;
+        decoded = nullptr;
         return xaBuffer != nullptr;
     }
 
+    bool SoundBuffer::BindHead(SoundObject* so)
+    {
+        if (optimization.IsEnabled())
+            return false; // the head would be in the format of the file, not of the optimized data
+
+        auto headBytes = int(probedFormat.nAvgBytesPerSec / 1000) * lazyHeadMilliseconds;
+        if (probedFormat.nBlockAlign)
+            headBytes -= headBytes % probedFormat.nBlockAlign;
+        if (headBytes <= 0 || headBytes >= probedBytes)
+            return false; // short sounds are decoded faster than the head
+
+        if (!headBuffer) // decoded once, shared by all the objects that start before the decode finishes
+        {
+            // decoded outside of lazyMutex, the voice callbacks take it
+            std::unique_ptr<AudioStream> strm(openAudioStream(sourceFile));
+            if (!strm)
+                return false;
+
+            auto* head = XABuffer::create(this, headBytes, strm.get());
+            strm->CloseStream();
+            if (!head)
+                return false;
+
+            std::lock_guard<std::mutex> lock(lazyMutex);
+            headBuffer = head;
+        }
+
+        std::lock_guard<std::mutex> lock(lazyMutex);
+        headBound.push_back(so);
+        so->getSource()->SubmitSourceBuffer(headBuffer);
+        return true;
+    }
+
+    void SoundBuffer::SubmitRest(SoundObject* so, XABuffer* data)
+    {
+        XAUDIO2_BUFFER rest = *data;
+        rest.PlayBegin = headBuffer->nPCMSamples;
+        rest.PlayLength = data->nPCMSamples - rest.PlayBegin;
+        so->getSource()->SubmitSourceBuffer(&rest);
+    }
+
+    void SoundBuffer::OnBufferEnd(SoundObject* so)
+    {
+        std::lock_guard<std::mutex> lock(lazyMutex);
+        auto it = std::find(headBound.begin(), headBound.end(), so);
+        if (it == headBound.end())
+            return; // a regular buffer, nothing follows it
+
+        if (XABuffer::getBuffersQueued(so->getSource()))
+            return; // a flushed head, the one queued now still plays
+
+        headBound.erase(it);
+
+        // the rest of the sound continues right after the head, or as soon as the decode is done
+        if (auto* data = xaBuffer ? xaBuffer : decoded)
+            SubmitRest(so, data);
+        else
+            headEnded.push_back(so);
+    }
+
+    void SoundBuffer::ApplyVolume(SoundObject* so)
+    {
+        // under lazyMutex, so it can't interleave with a decode that found the gain and applies it
+        std::lock_guard<std::mutex> lock(lazyMutex);
+        so->getSource()->SetVolume(so->getVolume() * normalizationGain);
+    }
+
+    bool SoundBuffer::isResident() const
+    {
+        // the decode and Evict swap the data under lazyMutex, the ResidencyManager asks from its own thread
+        std::lock_guard<std::mutex> lock(lazyMutex);
+        return xaBuffer != nullptr;
+    }
+
+    int SoundBuffer::ResidentBytes() const
+    {
+        std::lock_guard<std::mutex> lock(lazyMutex);
+        return residentBytes();
+    }
+
+    int SoundBuffer::residentBytes() const
+    {
+        return (xaBuffer ? xaBuffer->AudioBytes : 0) + (headBuffer ? headBuffer->AudioBytes : 0);
+    }
+
+    bool SoundBuffer::Evict()
+    {
+        if (referance_count > 0 || sourceFile.empty())
+            return false; // in use, or there is nothing to decode the data from again
+
+        if (!Resolve(false) && pending.valid())
+            return false; // still decoding
+
+        std::lock_guard<std::mutex> lock(lazyMutex);
+        auto bytes = residentBytes();
+        if (!bytes)
+            return false;
+
+        if (xaBuffer) // the format stays, so the buffer can still be queried and bound
+        {
+            probedFormat = xaBuffer->wf;
+            probedBytes = xaBuffer->AudioBytes;
+            XABuffer::destroy(xaBuffer);
+        }
+        if (headBuffer)
+            XABuffer::destroy(headBuffer);
+
+        evicted = true;
+        ResidencyManager::instance().onEvicted(bytes);
+        return true;
+    }
+
+    void SoundBuffer::CancelHead(SoundObject* so)
+    {
+        std::lock_guard<std::mutex> lock(lazyMutex);
+        headBound.erase(std::remove(headBound.begin(), headBound.end(), so), headBound.end());
+        headEnded.erase(std::remove(headEnded.begin(), headEnded.end(), so), headEnded.end());
+    }
+
+    void SoundBuffer::setLazyLoading(bool lazy)
+    {
+        lazyLoading = lazy;
+    }
+
+    void SoundBuffer::setLazyHead(int milliseconds)
+    {
+        lazyHeadMilliseconds = std::max(milliseconds, 0);
+    }
+
+    void SoundBuffer::setLoadOptimization(const LoadOptimization& options)
+    {
+        std::lock_guard<std::mutex> lock(optimizationMutex);
+        defaultOptimization = options;
+    }
+
+    LoadOptimization SoundBuffer::getLoadOptimization()
+    {
+        std::lock_guard<std::mutex> lock(optimizationMutex);
+        return defaultOptimization;
+    }
+
+    long long SoundBuffer::getBytesSaved()
+    {
+        return bytesSaved;
+    }
+
     bool SoundBuffer::Unload()
     {
-        if (!xaBuffer)
+        if (!xaBuffer && !headBuffer && !pending.valid())
+        {
+            sourceFile.clear();
+            evicted = false;
+            optimization = LoadOptimization();
+            loadReport = LoadReport();
+            normalizationGain = 1.0f;
+            normalized = false;
             return true; // yes, its unloaded
+        }
         
         if (referance_count > 0)
         {
@@ -123,19 +471,44 @@ namespace onesnd
             return false; // can't do anything here while still referenced
         }
         
-        XABuffer::destroy(xaBuffer);
-        
+        Resolve(true); // a decode in flight has to finish before its data can be freed
+        if (xaBuffer)
+            XABuffer::destroy(xaBuffer);
+        if (headBuffer)
+            XABuffer::destroy(headBuffer);
+
+        sourceFile.clear();
+        evicted = false;
+        optimization = LoadOptimization();
+        loadReport = LoadReport();
+        normalizationGain = 1.0f;
+        normalized = false;
         return true;
     }
 
     bool SoundBuffer::BindSource(SoundObject* so)
     {
-        if (!xaBuffer)
-            return false; // no data
-
         if (so->getSound().get() == this)
             return false; // no double-binding dude, it will mess up referance_counting.
 
+        lastUsed = std::chrono::steady_clock::now();
+
+        if (!Resolve(false))
+        {
+            if (sourceFile.empty())
+                return false; // no data
+
+            prefetch(); // the first play starts the decode
+            if (BindHead(so))
+            {
+                ++referance_count;
+                return true;
+            }
+
+            if (!Resolve(true))
+                return false; // no head, the first play waits for the decode
+        }
+
         so->getSource()->SubmitSourceBuffer(xaBuffer); // enqueue this buffer
         ++referance_count;
         
@@ -146,6 +519,8 @@ namespace onesnd
     {
         if (so->getSound().get() == this) // correct buffer link?
         {
+            CancelHead(so);
+            lastUsed = std::chrono::steady_clock::now(); // idle from now on
             so->getSource()->Stop(); // make sure its stopped (otherwise Flush won't work)
             if (XABuffer::getBuffersQueued(so->getSource()))
                 so->getSource()->FlushSourceBuffers(); // ensure not in queue anymore
@@ -158,14 +533,21 @@ namespace onesnd
 
     bool SoundBuffer::ResetBuffer(SoundObject* so)
     {
-        if (!xaBuffer || !so->getSource())
+        if ((!Resolve(false) && sourceFile.empty()) || !so->getSource())
             return false; // nothing to do here
 
+        CancelHead(so);
+        lastUsed = std::chrono::steady_clock::now();
+
         so->getSource()->Stop();
         if (XABuffer::getBuffersQueued(so->getSource())) // only flush IF we have buffers to flush
             so->getSource()->FlushSourceBuffers();
 
-        so->getSource()->SubmitSourceBuffer(xaBuffer);
+        if (!xaBuffer && !BindHead(so) && !Resolve(true))
+            return false; // still decoding
+
+        if (xaBuffer)
+            so->getSource()->SubmitSourceBuffer(xaBuffer);
         
         return true;
     }
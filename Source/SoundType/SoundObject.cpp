@@ -20,7 +20,8 @@ namespace onesnd
     SoundObject::SoundObject() : 
         sound(nullptr), 
         source(nullptr), 
-        state(nullptr)
+        state(nullptr),
+        userVolume(1.f)
     {
         memset(&Emitter, 0, sizeof(Emitter));
         Emitter.ChannelCount = 1;
@@ -30,7 +31,8 @@ namespace onesnd
     SoundObject::SoundObject(const std::shared_ptr<SoundBuffer>& sound, const bool& looping, const bool& playing, const float& volume) : 
         sound(nullptr), 
         source(nullptr), 
-        state(nullptr)
+        state(nullptr),
+        userVolume(1.f)
     {
         memset(&Emitter, 0, sizeof(Emitter));
         Emitter.ChannelCount = 1;
@@ -66,14 +68,19 @@ namespace onesnd
 
         if (sound_buf) // new sound?
         {
+            auto kept = 1.f; // the volume set by the user stays, the normalization gain changes with the sound
             if (!source) // no Source object created yet? First init.
                 state = new SoundObjectState(this);
             else if (sound_buf->WaveFormatHash() != sound->WaveFormatHash()) // WaveFormat has changed?
                 source->DestroyVoice(); // Destroy old and re-create with new
+            else
+                kept = userVolume;
+            userVolume = kept;
 
             XAudio2Device::instance().getEngine()->CreateSourceVoice(&source, sound_buf->WaveFormat(), 0, 2.0F, state);
 
             sound_buf->BindSource(this);
+            sound_buf->ApplyVolume(this); // a lazy buffer knows its gain once decoded, it applies it again then
 
             state->isInitial = true;
             state->isPlaying = play;
@@ -94,6 +101,11 @@ namespace onesnd
         return sound && sound->IsStream() && ((SoundStream*)sound.get())->IsEOS(this);
     }
 
+    bool SoundObject::isPending() const
+    {
+        return sound && sound->IsStream() && ((SoundStream*)sound.get())->IsPending(this);
+    }
+
     void SoundObject::play()
     {
         if (state->isPlaying) 
@@ -103,7 +115,7 @@ namespace onesnd
             state->isPlaying = true;
             state->isPaused = false;
 
-            if (!XABuffer::getBuffersQueued(source)) // no buffers queued (track probably finished)
+            if (!XABuffer::getBuffersQueued(source) && !isPending()) // no buffers queued (track probably finished)
             {
                 state->isInitial = true;
                 sound->ResetBuffer(this); // reset buffer to beginning
@@ -135,6 +147,7 @@ namespace onesnd
             state->isPaused = false;
 
             source->Stop();
+            sound->CancelHead(this);
             source->FlushSourceBuffers();
         }
     }
@@ -193,26 +206,30 @@ namespace onesnd
             state->isLoopable = looping;
     }
 
-    void SoundObject::setVolume(const float& volume)
+    void SoundObject::setVolume(const float& gain)
     {
         // HACK: Check the current volume if offered value is more than 1.0 or less than 0.
         //       It can be even 1000.0f, but it couldn't be looked like the sound.
-        if (volume > 1.f)
-            source->SetVolume(1.f);
-        else if (volume < 0.f)
-            source->SetVolume(0.f);
+        if (gain > 1.f)
+            userVolume = 1.f;
+        else if (gain < 0.f)
+            userVolume = 0.f;
         else
-            source->SetVolume(volume);
+            userVolume = gain;
+
+        // the loudness normalization of the sound is applied on top
+        if (sound)
+            sound->ApplyVolume(this);
+        else if (source)
+            source->SetVolume(userVolume);
     }
 
     float SoundObject::getVolume() const
     {
-        float volume;
-        source->GetVolume(&volume);
-        return volume;
+        return userVolume;
     }
 
-    int SoundObject::getPlaybackPosition() const
+    long long SoundObject::getPlaybackPosition() const
     {
         if (!source) 
             return 0;
@@ -220,22 +237,23 @@ namespace onesnd
         XAUDIO2_VOICE_STATE state;
         source->GetState(&state);
 
-        return (int)state.SamplesPlayed;
+        return (long long)state.SamplesPlayed;
     }
 
-    void SoundObject::setPlaybackPosition(int seekpos)
+    void SoundObject::setPlaybackPosition(long long seekpos)
     {
         if (!sound) 
             return;
 
         if (sound->IsStream()) // stream objects
             ((SoundStream*)sound.get())->Seek(this, seekpos); // seek the stream
-        else // single buffer objects
+        else if (sound->getXABuffer()) // single buffer objects, push streams have no data to seek in
         {
+            sound->CancelHead(this); // the lazy head is replaced by the data itself
             // first create a shallow copy of the xaBuffer:
             auto& shallow = state->shallow = *sound->getXABuffer();
-            shallow.PlayBegin = seekpos;
-            shallow.PlayLength = shallow.nPCMSamples - seekpos;
+            shallow.PlayBegin = (UINT32)seekpos; // a single buffer never holds more than 32-bit sizes
+            shallow.PlayLength = shallow.nPCMSamples - (UINT32)seekpos;
 
             state->isPaused = false;
             source->Stop();
@@ -250,7 +268,7 @@ namespace onesnd
             source->Start();
     }
 
-    int SoundObject::getPlaybackSize() const
+    long long SoundObject::getPlaybackSize() const
     {
         return sound ? sound->Size() : 0;
     }
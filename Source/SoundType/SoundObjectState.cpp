@@ -23,10 +23,6 @@ namespace onesnd
     void __stdcall SoundObjectState::OnBufferEnd(void* ctx)
     {
         isInitial = false;
-        if (((SoundBuffer*)ctx)->IsStream())
-        {
-            // stream fetch next buffer for this sound
-            ((SoundStream*)ctx)->StreamNext(sound);
-        }
+        ((SoundBuffer*)ctx)->OnBufferEnd(sound); // streams and lazy buffers queue their next buffer
     }
 }
\ No newline at end of file
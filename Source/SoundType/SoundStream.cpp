@@ -7,13 +7,50 @@
 #include "OneSound\SoundType\SoundStream.h"
 
 #include "OneSound\StreamType\AudioStream.h"
+#include "OneSound\VirtualFileSystem.h"
+#include "OneSound\Loudness.h"
+#include "OneSound\IOScheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 
 namespace onesnd
 {
-    SoundStream::SoundStream()
+    static std::atomic<int> streamHeadMilliseconds(250);
+
+    // size of the resident head of a stream, in whole sample blocks
+    static int headBytes(AudioStream* strm)
+    {
+        auto bytesPerSecond = strm->BytesPerSecond();
+        auto milliseconds = streamHeadMilliseconds.load();
+        if (!milliseconds)
+            return bytesPerSecond;
+
+        auto bytes = int((long long)bytesPerSecond * milliseconds / 1000);
+        bytes -= bytes % std::max(strm->FullSampleBlockSize(), 1);
+        return std::max(bytes, strm->FullSampleBlockSize());
+    }
+
+    // playback time of a queued buffer
+    static int millisecondsOf(const XABuffer* buffer)
+    {
+        return buffer ? int((long long)buffer->AudioBytes * 1000 / std::max(buffer->wf.nAvgBytesPerSec, 1ul)) : 0;
+    }
+
+    // a one-time pass over the whole stream, later loads of the same file hit the cache
+    static float normalizationOf(const fs::path& file, AudioStream* strm)
+    {
+        auto& normalizer = LoudnessNormalizer::instance();
+        return normalizer.isEnabled() ? normalizer.analyze(file, strm) : 1.0f;
+    }
+
+    SoundStream::SoundStream() :
+        alStream(nullptr)
     { }
 
-    SoundStream::SoundStream(const fs::path& file)
+    SoundStream::SoundStream(const fs::path& file) :
+        alStream(nullptr)
     {
         Load(file);
     }
@@ -24,7 +61,7 @@ namespace onesnd
             Unload();
     }
 
-    int SoundStream::Size() const
+    long long SoundStream::Size() const
     {
         return alStream ? (alStream->Size() / FullSampleSize()) : 0;
     }
@@ -35,6 +72,11 @@ namespace onesnd
     }
 
     bool SoundStream::Load(const fs::path& file)
+    {
+        return Load(file, DecodeQuality::Full);
+    }
+
+    bool SoundStream::Load(const fs::path& file, DecodeQuality quality)
     {
         if (XAudio2Device::instance().getEngine() == nullptr)
             throw std::runtime_error("Can't create sound because XAudio2 Device is not created.");
@@ -42,14 +84,56 @@ namespace onesnd
         if (xaBuffer) // is there existing data?
             return false;
 
-        if (!(alStream = createAudioStream(file.string().c_str())))
+        if (!(alStream = openAudioStream(file, quality)))
             return false; // :(
+        streamFile = file;
+        normalizationGain = normalizationOf(file, alStream);
+
+        // load the head of the stream:
+        if (!(xaBuffer = XABuffer::create(this, headBytes(alStream), alStream, 0)))
+            Release(); // not even the head could be decoded
+
+        return xaBuffer != nullptr;
+    }
+
+    bool SoundStream::LoadInMemory(const fs::path& file, DecodeQuality quality)
+    {
+        if (XAudio2Device::instance().getEngine() == nullptr)
+            throw std::runtime_error("Can't create sound because XAudio2 Device is not created.");
 
-        if (!alStream->OpenStream(file))
+        if (xaBuffer) // is there existing data?
             return false;
 
-        // load the first buffer in the stream:
-        xaBuffer = XABuffer::create(this, alStream->BytesPerSecond(), alStream, 0);
+        auto io = VirtualFileSystem::instance().open(file);
+        auto size = io.seek(io.context, 0, SEEK_END);
+        if (size > 0 && io.seek(io.context, 0, SEEK_SET) == 0)
+        {
+            encoded.resize(size_t(size));
+            encoded.resize(size_t(std::max(io.read(io.context, encoded.data(), encoded.size()), 0)));
+        }
+        closeAudioIO(io);
+
+        try
+        {
+            if (!encoded.empty())
+                alStream = openAudioStream(openMemoryIO(encoded.data(), encoded.size()), file, quality);
+        }
+        catch (const std::exception&)
+        {
+            Release(); // the file isn't kept resident for nothing
+            throw;
+        }
+        if (!alStream)
+        {
+            Release();
+            return false;
+        }
+        streamFile = file;
+        normalizationGain = normalizationOf(file, alStream);
+
+        // load the head of the stream:
+        if (!(xaBuffer = XABuffer::create(this, headBytes(alStream), alStream, 0)))
+            Release(); // not even the head could be decoded
 
         return xaBuffer != nullptr;
     }
@@ -65,12 +149,63 @@ namespace onesnd
         }
         XABuffer::destroy(xaBuffer);
 
+        Release();
+        return true;
+    }
+
+    void SoundStream::Release()
+    {
         if (alStream)
         {
             delete alStream; 
             alStream = nullptr;
         }
-        return true;
+        encoded.clear();
+        encoded.shrink_to_fit();
+        streamFile.clear();
+        normalizationGain = 1.0f;
+    }
+
+    bool SoundStream::setQuality(DecodeQuality quality)
+    {
+        if (!alStream)
+            return false; // nothing loaded
+
+        if (alStream->Quality() == quality)
+            return true;
+
+        if (referance_count > 0)
+            return false; // the voices were created for the format of the current decoder
+
+        auto* reopened = encoded.empty() ? openAudioStream(streamFile, quality)
+                                         : openAudioStream(openMemoryIO(encoded.data(), encoded.size()), streamFile, quality);
+        if (!reopened)
+            return false;
+
+        XABuffer::destroy(xaBuffer);
+        delete alStream;
+
+        // the head is decoded again in the new format
+        alStream = reopened;
+        if (!(xaBuffer = XABuffer::create(this, headBytes(alStream), alStream, 0)))
+            Release();
+
+        return xaBuffer != nullptr;
+    }
+
+    DecodeQuality SoundStream::getQuality() const
+    {
+        return alStream ? alStream->Quality() : DecodeQuality::Full;
+    }
+
+    void SoundStream::setStreamHead(int milliseconds)
+    {
+        streamHeadMilliseconds = std::max(milliseconds, 0);
+    }
+
+    int SoundStream::getStreamHead()
+    {
+        return streamHeadMilliseconds;
     }
 
     bool SoundStream::BindSource(SoundObject* so)
@@ -78,7 +213,18 @@ namespace onesnd
         if (!xaBuffer)
             return false; // no data loaded yet
 
-        alSources.emplace_back(so);				// default streamPos
+        // every object decodes with its own cursor, so refills never seek a shared decoder
+        auto* cursor = alStream->CreateCursor();
+        if (cursor && xaBuffer->AudioBytes < cursor->Size())
+        {
+            // the cold decoder is taken to the end of the head here, so the job started
+            // while the head plays only decodes and the head never waits for a seek
+            auto head = (long long)xaBuffer->AudioBytes;
+            if (!cursor->Snapshot(head))
+                cursor->Seek(head);
+        }
+
+        alSources.emplace_back(so, cursor ? cursor : alStream);	// default streamPos
         LoadStreamData(alSources.back(), 0);	// load initial stream data (2 buffers)
 
         ++referance_count;
@@ -95,6 +241,10 @@ namespace onesnd
             return false; // source doesn't exist
 
         ClearStreamData(*e); // unload all buffers
+        FinishJob(*e, true); // a cancelled job may still use the cursor
+
+        if (e->cursor != alStream)
+            delete e->cursor;
 
         alSources.erase(alSources.begin() + (e - alSources.data()));
         --referance_count;
@@ -107,6 +257,11 @@ namespace onesnd
         return ResetStream(so);
     }
 
+    void SoundStream::OnBufferEnd(SoundObject* so)
+    {
+        StreamNext(so); // stream fetch next buffer for this sound
+    }
+
     bool SoundStream::StreamNext(SoundObject* so)
     {
         if (!xaBuffer)
@@ -150,12 +305,12 @@ namespace onesnd
         return nullptr; // not found
     }
 
-    void SoundStream::Seek(SoundObject* so, int samplepos)
+    void SoundStream::Seek(SoundObject* so, long long samplepos)
     {
         if (SO_ENTRY* e = GetSOEntry(so))
         {
             // if samplepos out of bounds THEN 0 ELSE convert samplepos to bytepos
-            auto bytepos = (samplepos >= Size()) ? 0 : samplepos * xaBuffer->wf.nBlockAlign;
+            auto bytepos = (samplepos >= Size()) ? 0 : samplepos * (long long)xaBuffer->wf.nBlockAlign;
 
             ClearStreamData(*e);
             LoadStreamData(*e, bytepos);
@@ -164,18 +319,55 @@ namespace onesnd
 
     }
 
+    bool SoundStream::AddCuePoint(SoundObject* so, long long samplepos)
+    {
+        if (auto* e = GetSOEntry(so))
+        {
+            // the cursor may still decode in the background; the refills on the voice callback
+            // may run meanwhile, the cursor parks the snapshot under its own lock
+            FinishJob(*e, true);
+            return e->cursor->Snapshot(samplepos * (long long)xaBuffer->wf.nBlockAlign);
+        }
+
+        return false;
+    }
+
     bool SoundStream::StreamNext(SO_ENTRY& e)
     {
-        if (e.next >= alStream->Size()) // is EOF?
+        if (!FinishJob(e, false))
+            return false; // the job refills this buffer itself, the voice callback never waits for a decode
+
+        if (e.next >= e.cursor->Size()) // is EOF?
             return false;
 
+        e.base = e.next; // shift the base pointer forward
+        if (IsScheduled(e) || e.ahead)
+        {
+            // the queued buffers move up, the one that ended is done
+            auto* ended = e.front;
+            e.front = e.back;
+            e.back = e.ahead;
+            e.ahead = nullptr;
+            if (ended != xaBuffer)
+                XABuffer::destroy(ended);
+
+            // the scheduler decodes the buffer after the ones still queued, due when the voice has played all of them;
+            // with the scheduler off again, the voice plays the two it has and the refills go on as usual
+            if (IsScheduled(e))
+                StartJob(e, e.next, {}, false, QueuedMilliseconds(e));
+            return true;
+        }
+
         // front buffer was processed, swap buffers:
         std::swap(e.front, e.back);
 
-        e.base = e.next; // shift the base pointer forward
-        if (e.back == xaBuffer) // we can't refill xaBuffer
+        if (e.back == xaBuffer || (e.back && e.back->AudioBytes < xaBuffer->wf.nAvgBytesPerSec))
         {
-            e.back = XABuffer::create(this, xaBuffer->wf.nAvgBytesPerSec, alStream, &e.next);
+            // we can't refill xaBuffer, and a short first buffer grows to a full one
+            if (e.back != xaBuffer)
+                XABuffer::destroy(e.back);
+
+            e.back = XABuffer::create(this, xaBuffer->wf.nAvgBytesPerSec, e.cursor, &e.next);
             if (!e.back)
                 return false; // oh no...
         }
@@ -184,18 +376,18 @@ namespace onesnd
             if (!e.back) // no backbuffer. probably ClearStreamData() was called
                 return false;
 
-            XABuffer::stream(e.back, alStream, &e.next);
+            XABuffer::stream(e.back, e.cursor, &e.next);
         }
 
         e.obj->getSource()->SubmitSourceBuffer(e.back); // submit the backbuffer to the queue
         return true;
     }
 
-    bool SoundStream::LoadStreamData(SO_ENTRY& so, int streampos)
+    bool SoundStream::LoadStreamData(SO_ENTRY& so, long long streampos)
     {
         auto pos = streampos == -1 ? so.next : streampos; // -1: use next, else use streampos
-        auto streamSize = alStream->Size() - pos; // lets calculate stream size from the SEEK position
-        auto bytesPerSecond = alStream->BytesPerSecond();
+        auto streamSize = so.cursor->Size() - pos; // lets calculate stream size from the SEEK position
+        auto bytesPerSecond = so.cursor->BytesPerSecond();
         auto numBuffers = streamSize > bytesPerSecond ? 2 : 1;
         auto* source = so.obj->getSource();
 
@@ -204,16 +396,36 @@ namespace onesnd
         {
             pos += xaBuffer->AudioBytes; // update pos
             source->SubmitSourceBuffer(so.front = xaBuffer);
+            numBuffers = pos < so.cursor->Size() ? 2 : 1; // the head may be shorter than a stream buffer
+
+            if (numBuffers == 2 && so.cursor != alStream)
+            {
+                // the head plays right away, the cursor of the object decodes the rest meanwhile;
+                // it was parked right after the head when it was bound (see BindSource)
+                so.next = pos;
+                StartJob(so, pos, { bytesPerSecond }, false, millisecondsOf(xaBuffer));
+                return true;
+            }
+
+            // a shared decoder can't run in the background, the other objects read it too
+            so.cursor->Snapshot(pos);
+        }
+        else if (so.cursor != alStream)
+        {
+            // a short buffer starts the playback soon, the refills after it are full ones
+            so.next = pos;
+            StartJob(so, pos, { headBytes(so.cursor), bytesPerSecond }, false, 0); // nothing plays until it's done
+            return true;
         }
         else // load at arbitrary position
         {
-            so.front = XABuffer::create(this, bytesPerSecond, alStream, &pos);
+            so.front = XABuffer::create(this, bytesPerSecond, so.cursor, &pos);
             source->SubmitSourceBuffer(so.front);
         }
 
         if (numBuffers == 2) // also load a backbuffer
         {
-            so.back = XABuffer::create(this, bytesPerSecond, alStream, &pos);
+            so.back = XABuffer::create(this, bytesPerSecond, so.cursor, &pos);
             source->SubmitSourceBuffer(so.back);
         }
         so.next = pos;  // pos variable was updated by CreateXABuffer
@@ -221,8 +433,200 @@ namespace onesnd
         return true;
     }
 
+    void SoundStream::StartJob(SO_ENTRY& so, long long streampos, std::vector<int> sizes, bool snapshot, int deadline)
+    {
+        auto job = std::make_shared<STREAM_JOB>();
+        job->next = streampos;
+        job->queued = (so.front ? 1 : 0) + (so.back ? 1 : 0) + (so.ahead ? 1 : 0);
+        job->depth = IsScheduled(so) ? 3 : 2;
+
+        // the job only holds a weak reference, a job that was replaced counts as cancelled
+        std::weak_ptr<STREAM_JOB> weak = job;
+        auto* cursor = so.cursor;
+        auto* source = so.obj->getSource();
+        auto refill = int(xaBuffer->wf.nAvgBytesPerSec);
+
+        // returns the encoded bytes it read, the scheduler charges them to the audio bandwidth
+        auto work = [this, weak, cursor, source, streampos, sizes, snapshot, refill]() -> size_t
+        {
+            auto started = false;
+            auto start = 0ll;
+            auto next = streampos;
+            for (auto i = size_t(0);; ++i)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(restMutex);
+                    auto owner = weak.lock();
+                    if (!owner || owner->cancelled)
+                        break; // cleared meanwhile
+
+                    // after the requested buffers, the refills of the buffers that ended meanwhile:
+                    // their voice callbacks found the job running, so they were left to it
+                    auto queued = owner->queued + int(owner->submitted.size()) - owner->ended;
+                    if (next >= cursor->Size() || (i >= sizes.size() && queued >= owner->depth))
+                    {
+                        owner->finished = true; // decided under the lock, no buffer end slips in between
+                        break;
+                    }
+                }
+
+                if (!started)
+                {
+                    started = true;
+                    start = cursor->SourcePosition();
+                    if (snapshot)
+                        cursor->Snapshot(streampos);
+                }
+
+                auto* buffer = XABuffer::create(this, i < sizes.size() ? sizes[i] : refill, cursor, &next);
+                if (!buffer)
+                    break;
+
+                std::lock_guard<std::mutex> lock(restMutex);
+                auto owner = weak.lock(); // released before the lock, the caller only drops jobs under it
+                if (!owner || owner->cancelled)
+                {
+                    XABuffer::destroy(buffer);
+                    break;
+                }
+
+                source->SubmitSourceBuffer(buffer);
+                owner->submitted.push_back(buffer);
+                owner->next = next;
+            }
+            if (!started)
+                return 0; // nothing was read
+
+            // decoders that can't tell their position are charged the decoded size
+            auto end = cursor->SourcePosition();
+            return size_t(start >= 0 && end >= 0 ? std::max(end - start, 0ll) : next - streampos);
+        };
+
+        std::lock_guard<std::mutex> lock(restMutex);
+        auto previous = so.job ? so.job->done : std::shared_future<void>(); // the cursor is still used by a cancelled job
+        if (encoded.empty()) // only streams from disk compete for the bandwidth
+        {
+            auto due = IOScheduler::Clock::now() + std::chrono::milliseconds(deadline);
+            auto request = IOScheduler::instance().submit(IOClass::Audio, due, work, previous);
+            job->done = request.done;
+            job->request = request.id;
+        }
+        else
+        {
+            job->done = std::async(std::launch::async, [work, previous]
+            {
+                if (previous.valid())
+                    previous.wait();
+                work();
+            }).share();
+        }
+
+        so.job = job;
+    }
+
+    bool SoundStream::IsScheduled(const SO_ENTRY& so) const
+    {
+        // a shared decoder can't run in the background, streams from memory don't touch the disk
+        return so.cursor != alStream && encoded.empty() && IOScheduler::instance().isEnabled();
+    }
+
+    int SoundStream::QueuedMilliseconds(const SO_ENTRY& so) const
+    {
+        XAUDIO2_VOICE_STATE state;
+        so.obj->getSource()->GetState(&state);
+
+        // the voice may have run dry behind the callbacks, only the buffers it still has count;
+        // called on a buffer end, so the first of them only just started playing
+        std::vector<const XABuffer*> queued;
+        for (auto* buffer : { so.front, so.back, so.ahead })
+            if (buffer)
+                queued.push_back(buffer);
+
+        auto skip = queued.size() > state.BuffersQueued ? queued.size() - state.BuffersQueued : 0;
+        auto milliseconds = 0;
+        for (auto i = skip; i < queued.size(); ++i)
+            milliseconds += millisecondsOf(queued[i]);
+        return milliseconds;
+    }
+
+    bool SoundStream::FinishJob(SO_ENTRY& so, bool wait)
+    {
+        std::shared_ptr<STREAM_JOB> job;
+        {
+            std::lock_guard<std::mutex> lock(restMutex);
+            job = so.job;
+        }
+        if (!job)
+            return true;
+
+        if (wait)
+        {
+            if (job->request)
+                IOScheduler::instance().expedite(job->request); // don't keep the caller behind the other requests
+            job->done.wait();
+        }
+
+        std::lock_guard<std::mutex> lock(restMutex);
+        if (so.job != job)
+            return true; // taken over meanwhile
+
+        if (!wait && !job->finished && job->done.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            ++job->ended; // the job queues the refill of this buffer before it finishes
+            return false;
+        }
+
+        if (!job->cancelled)
+        {
+            // in play order: the buffers queued before the job and its own; the ones that ended meanwhile are done
+            std::vector<XABuffer*> queue;
+            for (auto* buffer : { so.front, so.back, so.ahead })
+                if (buffer)
+                    queue.push_back(buffer);
+            queue.insert(queue.end(), job->submitted.begin(), job->submitted.end());
+
+            // never more than the voice let go of, a flush ends buffers as well; a buffer end
+            // taking the job over is not queued anymore either, but the caller still swaps it out
+            auto onVoice = size_t(XABuffer::getBuffersQueued(so.obj->getSource())) + (wait ? 0 : 1);
+            auto gone = queue.size() > onVoice ? queue.size() - onVoice : 0;
+            auto ended = std::min(size_t(job->ended), gone);
+            for (auto i = size_t(0); i < ended; ++i)
+                if (queue[i] != xaBuffer)
+                    XABuffer::destroy(queue[i]);
+            queue.erase(queue.begin(), queue.begin() + ended);
+
+            so.front = queue.size() > 0 ? queue[0] : nullptr;
+            so.back = queue.size() > 1 ? queue[1] : nullptr;
+            so.ahead = queue.size() > 2 ? queue[2] : nullptr;
+            so.next = job->next;
+        }
+        so.job.reset();
+        return true;
+    }
+
+    bool SoundStream::IsPending(const SoundObject* so)
+    {
+        auto* e = GetSOEntry(so);
+        if (!e)
+            return false;
+
+        std::lock_guard<std::mutex> lock(restMutex);
+        return e->job && !e->job->cancelled && e->job->done.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+    }
+
     void SoundStream::ClearStreamData(SO_ENTRY& so)
     {
+        std::vector<XABuffer*> dropped; // buffers of a cancelled job
+        {
+            // never waits for the job, it stops before its next buffer and the queued ones are flushed with the others
+            std::lock_guard<std::mutex> lock(restMutex);
+            if (so.job && !so.job->cancelled)
+            {
+                so.job->cancelled = true;
+                dropped.swap(so.job->submitted);
+            }
+        }
+
         so.busy = true;
         auto* source = so.obj->getSource();
         source->Stop();
@@ -230,18 +634,20 @@ namespace onesnd
         if (XABuffer::getBuffersQueued(source)) // only flush if we have something to flush
             source->FlushSourceBuffers();
 
+        for (auto* buffer : dropped)
+            XABuffer::destroy(buffer);
+
         if (so.front)
         {
             if (so.front != xaBuffer)
-                delete so.front,
-                so.front = nullptr;
+                XABuffer::destroy(so.front);
+            so.front = nullptr; // the buffers of a job fill the front first
         }
         if (so.back)
-        {
-            delete so.back;
-            so.back = nullptr;
-        }
+            XABuffer::destroy(so.back);
+        if (so.ahead)
+            XABuffer::destroy(so.ahead);
 
         so.busy = false;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,670 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#include "OneSound\StreamType\AudioIO.h"
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+
+namespace onesnd
+{
+    // a cursor over a file handle shared by all the clones
+    struct FileIO
+    {
+        std::shared_ptr<void> handle;
+        unsigned long long size;
+        unsigned long long position;
+    };
+
+    static int fileio_read(void* context, void* dst, size_t size)
+    {
+        auto* io = static_cast<FileIO*>(context);
+
+        auto available = io->size - io->position;
+        if (size > available)
+            size = static_cast<size_t>(available);
+        if (!size)
+            return 0;
+
+        auto bytesRead = file_pread(io->handle.get(), dst, size, io->position);
+        io->position += bytesRead;
+
+        return bytesRead;
+    }
+
+    static long long fileio_seek(void* context, long long offset, int whence)
+    {
+        auto* io = static_cast<FileIO*>(context);
+
+        auto base = (long long)0;
+        switch (whence)
+        {
+            case SEEK_SET: base = 0; break;
+            case SEEK_CUR: base = (long long)io->position; break;
+            case SEEK_END: base = (long long)io->size; break;
+            default:
+                return -1;
+        }
+
+        auto target = base + offset;
+        if (target < 0 || (unsigned long long)target > io->size)
+            return -1;
+
+        io->position = (unsigned long long)target;
+        return target;
+    }
+
+    static long long fileio_tell(void* context)
+    {
+        return (long long)static_cast<FileIO*>(context)->position;
+    }
+
+    static int fileio_close(void* context)
+    {
+        delete static_cast<FileIO*>(context);
+        return 0;
+    }
+
+    static AudioIO fileio_clone(void* context)
+    {
+        auto* io = static_cast<FileIO*>(context);
+        return { new FileIO{ io->handle, io->size, 0 }, fileio_read, fileio_seek, fileio_tell, fileio_close, fileio_clone };
+    }
+
+    AudioIO makeFileIO(void* handle)
+    {
+        auto* io = new FileIO{ std::shared_ptr<void>(handle, file_close), file_size(handle), 0 };
+        return { io, fileio_read, fileio_seek, fileio_tell, fileio_close, fileio_clone };
+    }
+
+    AudioIO openFileIO(const fs::path& file)
+    {
+        auto* handle = file_open_ro(file.string().c_str());
+        if (!handle)
+            throw std::runtime_error("Can't open file: "s + file.string());
+
+        return makeFileIO(handle);
+    }
+
+    // the file and its mapping, shared by all the clones
+    struct MappedFile
+    {
+        HANDLE file;
+        HANDLE mapping;
+        unsigned long long size;
+
+        ~MappedFile()
+        {
+            CloseHandle(mapping);
+            CloseHandle(file);
+        }
+    };
+
+    // a cursor with its own window into the mapping
+    struct MappedIO
+    {
+        std::shared_ptr<MappedFile> file;
+        size_t window;                  // size of a mapped window
+        unsigned long long position;
+        unsigned long long viewOffset;  // file offset of the mapped window
+        size_t viewSize;                // size of the mapped window, 0 if nothing is mapped
+        const unsigned char* view;
+    };
+
+    static std::atomic<bool> mappedIO(false);
+
+    // maps the window the position falls into, the offset of a view must be aligned to the allocation granularity
+    static bool mapped_move(MappedIO* io)
+    {
+        if (io->view)
+            UnmapViewOfFile(io->view);
+
+        io->viewOffset = io->position - io->position % io->window;
+        io->viewSize = size_t(std::min<unsigned long long>(io->window, io->file->size - io->viewOffset));
+        io->view = static_cast<const unsigned char*>(MapViewOfFile(io->file->mapping, FILE_MAP_READ,
+            DWORD(io->viewOffset >> 32), DWORD(io->viewOffset), io->viewSize));
+
+        if (!io->view)
+            io->viewSize = 0;
+        return io->view != nullptr;
+    }
+
+    static int mapped_read(void* context, void* dst, size_t size)
+    {
+        auto* io = static_cast<MappedIO*>(context);
+
+        auto available = io->file->size - io->position;
+        if (size > available)
+            size = static_cast<size_t>(available);
+
+        auto* out = static_cast<unsigned char*>(dst);
+        auto total = size_t(0);
+        while (total < size)
+        {
+            if (io->position < io->viewOffset || io->position >= io->viewOffset + io->viewSize)
+            {
+                if (!mapped_move(io))
+                    break;
+            }
+
+            auto offset = size_t(io->position - io->viewOffset);
+            auto count = std::min(size - total, io->viewSize - offset);
+            memcpy(out + total, io->view + offset, count);
+            total += count;
+            io->position += count;
+        }
+        return static_cast<int>(total);
+    }
+
+    static long long mapped_seek(void* context, long long offset, int whence)
+    {
+        auto* io = static_cast<MappedIO*>(context);
+
+        auto base = (long long)0;
+        switch (whence)
+        {
+            case SEEK_SET: base = 0; break;
+            case SEEK_CUR: base = (long long)io->position; break;
+            case SEEK_END: base = (long long)io->file->size; break;
+            default:
+                return -1;
+        }
+
+        auto target = base + offset;
+        if (target < 0 || (unsigned long long)target > io->file->size)
+            return -1;
+
+        io->position = (unsigned long long)target; // the window moves on the next read
+        return target;
+    }
+
+    static long long mapped_tell(void* context)
+    {
+        return (long long)static_cast<MappedIO*>(context)->position;
+    }
+
+    static int mapped_close(void* context)
+    {
+        auto* io = static_cast<MappedIO*>(context);
+        if (io->view)
+            UnmapViewOfFile(io->view);
+
+        delete io;
+        return 0;
+    }
+
+    static AudioIO mapped_clone(void* context)
+    {
+        auto* io = static_cast<MappedIO*>(context);
+        return { new MappedIO{ io->file, io->window, 0, 0, 0, nullptr }, mapped_read, mapped_seek, mapped_tell, mapped_close, mapped_clone };
+    }
+
+    AudioIO openMappedIO(const fs::path& file, size_t window)
+    {
+        auto* handle = file_open_ro(file.string().c_str());
+        if (!handle)
+            throw std::runtime_error("Can't open file: "s + file.string());
+
+        auto size = file_size(handle);
+        if (!size)
+            return makeFileIO(handle); // a mapping can't be empty, there's nothing to read anyway
+
+        auto* mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+        {
+            file_close(handle);
+            throw std::runtime_error("Can't map file: "s + file.string());
+        }
+
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        auto granularity = size_t(info.dwAllocationGranularity);
+        window = std::max((window + granularity - 1) / granularity, size_t(1)) * granularity;
+
+        auto shared = std::shared_ptr<MappedFile>(new MappedFile{ handle, mapping, size });
+        return { new MappedIO{ shared, window, 0, 0, 0, nullptr }, mapped_read, mapped_seek, mapped_tell, mapped_close, mapped_clone };
+    }
+
+    void setMappedIO(bool enabled)
+    {
+        mappedIO = enabled;
+    }
+
+    bool isMappedIO()
+    {
+        return mappedIO;
+    }
+
+    // a plain view on the user memory, the data itself is never copied
+    struct MemoryIO
+    {
+        const unsigned char* data;
+        size_t size;
+        size_t position;
+    };
+
+    static int memory_read(void* context, void* dst, size_t size)
+    {
+        auto* mem = static_cast<MemoryIO*>(context);
+
+        auto available = mem->size - mem->position;
+        if (size > available)
+            size = available;
+
+        memcpy(dst, mem->data + mem->position, size);
+        mem->position += size;
+
+        return static_cast<int>(size);
+    }
+
+    static long long memory_seek(void* context, long long offset, int whence)
+    {
+        auto* mem = static_cast<MemoryIO*>(context);
+
+        auto base = (long long)0;
+        switch (whence)
+        {
+            case SEEK_SET: base = 0; break;
+            case SEEK_CUR: base = static_cast<long long>(mem->position); break;
+            case SEEK_END: base = static_cast<long long>(mem->size); break;
+            default:
+                return -1;
+        }
+
+        auto target = base + offset;
+        if (target < 0 || size_t(target) > mem->size)
+            return -1; // out of bounds, position is not changed
+
+        mem->position = static_cast<size_t>(target);
+        return target;
+    }
+
+    static long long memory_tell(void* context)
+    {
+        return static_cast<long long>(static_cast<MemoryIO*>(context)->position);
+    }
+
+    static int memory_close(void* context)
+    {
+        delete static_cast<MemoryIO*>(context);
+        return 0;
+    }
+
+    static AudioIO memory_clone(void* context)
+    {
+        auto* mem = static_cast<MemoryIO*>(context);
+        return openMemoryIO(mem->data, mem->size);
+    }
+
+    AudioIO openMemoryIO(const void* data, size_t size)
+    {
+        if (!data || !size)
+            throw std::runtime_error("Can't open an empty memory block.");
+
+        auto* mem = new MemoryIO{ static_cast<const unsigned char*>(data), size, 0 };
+        return { mem, memory_read, memory_seek, memory_tell, memory_close, memory_clone };
+    }
+
+    void closeAudioIO(AudioIO& io)
+    {
+        if (io.close)
+            io.close(io.context);
+
+        io = AudioIO();
+    }
+
+    AudioIO cloneAudioIO(const AudioIO& io)
+    {
+        return io.clone ? io.clone(io.context) : AudioIO();
+    }
+
+    static const size_t MinReadAhead = 64 * 1024;
+    static const size_t MaxReadAhead = 1024 * 1024;
+
+    static std::atomic<size_t> readAheadSize(0); // off, every open would pay for the buffers
+
+    static std::atomic<unsigned long long> statRequests(0);
+    static std::atomic<unsigned long long> statHits(0);
+    static std::atomic<unsigned long long> statReads(0);
+    static std::atomic<unsigned long long> statBytes(0);
+
+    struct BufferedIO
+    {
+        AudioIO source;
+        size_t readAhead;
+
+        std::unique_ptr<char[]> buffer[2]; // [0] current, [1] previous, allocated on their first fill
+        long long start[2];             // source offset of the buffered data
+        size_t length[2];               // number of bytes buffered, 0 if empty
+
+        long long position;             // logical position the decoder sees
+        long long sourcePosition;       // position of the source, -1 if unknown
+        long long size;                 // size of the source, -1 until somebody asks for it
+    };
+
+    // positions the source only if it's not there already
+    static bool buffered_sync(BufferedIO* io)
+    {
+        if (io->sourcePosition == io->position)
+            return true;
+
+        if (io->source.seek(io->source.context, io->position, SEEK_SET) == -1)
+        {
+            io->sourcePosition = -1;
+            return false;
+        }
+        io->sourcePosition = io->position;
+        return true;
+    }
+
+    static int buffered_source_read(BufferedIO* io, void* dst, size_t size)
+    {
+        if (!buffered_sync(io))
+            return 0;
+
+        ++statReads;
+        auto bytesRead = io->source.read(io->source.context, dst, size);
+        if (bytesRead <= 0)
+            return 0;
+
+        statBytes += bytesRead;
+        io->sourcePosition += bytesRead;
+        return bytesRead;
+    }
+
+    static int buffered_read(void* context, void* dst, size_t size)
+    {
+        auto* io = static_cast<BufferedIO*>(context);
+        ++statRequests;
+
+        auto* out = static_cast<char*>(dst);
+        auto total = size_t();
+        auto hit = true;
+        while (total < size)
+        {
+            // served from one of the buffers?
+            auto served = false;
+            for (auto b = 0; b < 2; ++b)
+            {
+                auto offset = io->position - io->start[b];
+                if (io->length[b] && offset >= 0 && offset < (long long)io->length[b])
+                {
+                    auto count = std::min(size - total, io->length[b] - size_t(offset));
+                    memcpy(out + total, io->buffer[b].get() + offset, count);
+                    total += count;
+                    io->position += count;
+                    served = true;
+                    break;
+                }
+            }
+            if (served)
+                continue;
+
+            hit = false;
+            if (size - total >= io->readAhead) // large reads don't need the buffers
+            {
+                auto bytesRead = buffered_source_read(io, out + total, size - total);
+                if (!bytesRead)
+                    break;
+
+                total += bytesRead;
+                io->position += bytesRead;
+                continue;
+            }
+
+            // the current buffer becomes the previous one and the old previous is refilled
+            std::swap(io->buffer[0], io->buffer[1]);
+            std::swap(io->start[0], io->start[1]);
+            std::swap(io->length[0], io->length[1]);
+
+            io->start[0] = io->position;
+            io->length[0] = 0;
+
+            if (!io->buffer[0])
+                io->buffer[0].reset(new char[io->readAhead]); // not zero-filled, only the read bytes count
+            auto bytesRead = buffered_source_read(io, io->buffer[0].get(), io->readAhead);
+            if (!bytesRead)
+                break; // end of data
+
+            io->length[0] = size_t(bytesRead);
+        }
+
+        if (hit)
+            ++statHits;
+
+        return static_cast<int>(total);
+    }
+
+    static long long buffered_seek(void* context, long long offset, int whence)
+    {
+        auto* io = static_cast<BufferedIO*>(context);
+
+        auto base = (long long)0;
+        switch (whence)
+        {
+            case SEEK_SET: base = 0; break;
+            case SEEK_CUR: base = io->position; break;
+            case SEEK_END:
+                if (io->size < 0) // only the first seek to the end reaches the source
+                {
+                    io->size = io->source.seek(io->source.context, 0, SEEK_END);
+                    io->sourcePosition = io->size;
+                    if (io->size < 0)
+                        return -1;
+                }
+                base = io->size;
+                break;
+            default:
+                return -1;
+        }
+
+        auto target = base + offset;
+        if (target < 0 || (io->size >= 0 && target > io->size))
+            return -1;
+
+        io->position = target; // the source is positioned lazily by the next read that misses
+        return target;
+    }
+
+    static long long buffered_tell(void* context)
+    {
+        return static_cast<BufferedIO*>(context)->position;
+    }
+
+    static int buffered_close(void* context)
+    {
+        auto* io = static_cast<BufferedIO*>(context);
+        closeAudioIO(io->source);
+
+        delete io;
+        return 0;
+    }
+
+    static AudioIO buffered_clone(void* context)
+    {
+        auto* io = static_cast<BufferedIO*>(context);
+
+        auto source = cloneAudioIO(io->source);
+        return source.IsValid() ? openBufferedIO(source, io->readAhead) : AudioIO();
+    }
+
+    AudioIO openBufferedIO(const AudioIO& source, size_t readAhead)
+    {
+        readAhead = std::clamp(readAhead, MinReadAhead, MaxReadAhead);
+
+        auto* io = new BufferedIO();
+        io->source = source;
+        io->readAhead = readAhead;
+        for (auto b = 0; b < 2; ++b)
+        {
+            io->start[b] = 0;
+            io->length[b] = 0;
+        }
+        io->position = source.tell ? source.tell(source.context) : 0;
+        io->sourcePosition = io->position;
+        io->size = -1;
+
+        return { io, buffered_read, buffered_seek, buffered_tell, buffered_close, buffered_clone };
+    }
+
+    void setReadAheadSize(size_t bytes)
+    {
+        readAheadSize = bytes ? std::clamp(bytes, MinReadAhead, MaxReadAhead) : 0;
+    }
+
+    size_t getReadAheadSize()
+    {
+        return readAheadSize;
+    }
+
+    IOStatistics getIOStatistics()
+    {
+        return { statRequests, statHits, statReads, statBytes };
+    }
+
+    void resetIOStatistics()
+    {
+        statRequests = 0;
+        statHits = 0;
+        statReads = 0;
+        statBytes = 0;
+    }
+
+    // the simulated device, shared by all the files opened through it
+    struct SimulatedStorage
+    {
+        using Clock = std::chrono::steady_clock;
+
+        std::mutex mutex;
+        bool enabled = false;
+        StorageProfile profile;
+        std::mt19937 random;
+        Clock::time_point busyUntil;    // end of the last read the device accepted
+        StorageStatistics stats = {};
+    };
+
+    static SimulatedStorage simulatedStorage;
+
+    // [lock held] time the data of a read arrives, the device serves the reads in order
+    static SimulatedStorage::Clock::time_point simulated_arrival(SimulatedStorage& device, size_t bytes)
+    {
+        using namespace std::chrono;
+        const auto& profile = device.profile;
+
+        auto delay = duration<double, std::milli>(profile.latency);
+        if (profile.jitter > 0)
+            delay += duration<double, std::milli>(std::uniform_real_distribution<double>(0.0, profile.jitter)(device.random));
+        if (profile.stallChance > 0.0f && std::uniform_real_distribution<float>(0.0f, 1.0f)(device.random) < profile.stallChance)
+        {
+            delay += duration<double, std::milli>(profile.stallLength);
+            ++device.stats.stalls;
+        }
+        if (profile.bandwidth)
+            delay += duration<double, std::milli>(1000.0 * double(bytes) / double(profile.bandwidth));
+
+        auto now = SimulatedStorage::Clock::now();
+        auto start = std::max(now, device.busyUntil);
+        device.busyUntil = start + duration_cast<SimulatedStorage::Clock::duration>(delay);
+
+        auto held = duration<double, std::milli>(device.busyUntil - now).count();
+        ++device.stats.reads;
+        device.stats.bytes += bytes;
+        device.stats.delay += held;
+        device.stats.maxDelay = std::max(device.stats.maxDelay, held);
+        return device.busyUntil;
+    }
+
+    static int simulated_read(void* context, void* dst, size_t size)
+    {
+        auto* source = static_cast<AudioIO*>(context);
+
+        // the data is read right away, the caller only gets it when the simulated device delivers it
+        auto bytesRead = source->read(source->context, dst, size);
+
+        auto arrival = SimulatedStorage::Clock::time_point();
+        {
+            std::lock_guard<std::mutex> lock(simulatedStorage.mutex);
+            if (!simulatedStorage.enabled)
+                return bytesRead;
+            arrival = simulated_arrival(simulatedStorage, size_t(std::max(bytesRead, 0)));
+        }
+        std::this_thread::sleep_until(arrival);
+        return bytesRead;
+    }
+
+    static long long simulated_seek(void* context, long long offset, int whence)
+    {
+        auto* source = static_cast<AudioIO*>(context);
+        return source->seek(source->context, offset, whence); // the access time is paid by the next read
+    }
+
+    static long long simulated_tell(void* context)
+    {
+        auto* source = static_cast<AudioIO*>(context);
+        return source->tell ? source->tell(source->context) : -1;
+    }
+
+    static int simulated_close(void* context)
+    {
+        auto* source = static_cast<AudioIO*>(context);
+        closeAudioIO(*source);
+
+        delete source;
+        return 0;
+    }
+
+    static AudioIO simulated_clone(void* context)
+    {
+        auto source = cloneAudioIO(*static_cast<AudioIO*>(context));
+        return source.IsValid() ? AudioIO{ new AudioIO(source), simulated_read, simulated_seek, simulated_tell, simulated_close, simulated_clone } : AudioIO();
+    }
+
+    void setSimulatedStorage(const StorageProfile& profile)
+    {
+        std::lock_guard<std::mutex> lock(simulatedStorage.mutex);
+        simulatedStorage.enabled = true;
+        simulatedStorage.profile = profile;
+        simulatedStorage.random.seed(profile.seed);
+        simulatedStorage.busyUntil = SimulatedStorage::Clock::now();
+        simulatedStorage.stats = {};
+    }
+
+    void clearSimulatedStorage()
+    {
+        std::lock_guard<std::mutex> lock(simulatedStorage.mutex);
+        simulatedStorage.enabled = false;
+    }
+
+    bool isStorageSimulated()
+    {
+        std::lock_guard<std::mutex> lock(simulatedStorage.mutex);
+        return simulatedStorage.enabled;
+    }
+
+    AudioIO openSimulatedIO(const AudioIO& io)
+    {
+        if (!io.IsValid() || !isStorageSimulated())
+            return io; // the real files pay nothing
+
+        return { new AudioIO(io), simulated_read, simulated_seek, simulated_tell, simulated_close, simulated_clone };
+    }
+
+    StorageStatistics getStorageStatistics()
+    {
+        std::lock_guard<std::mutex> lock(simulatedStorage.mutex);
+        return simulatedStorage.stats;
+    }
+
+    void resetStorageStatistics()
+    {
+        std::lock_guard<std::mutex> lock(simulatedStorage.mutex);
+        simulatedStorage.stats = {};
+    }
+}
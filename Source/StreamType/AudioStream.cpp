@@ -7,129 +7,13 @@
 #include "OneSound\StreamType\AudioStream.h"
 
 #include "OneSound\StreamType\WAVStream.h"
-#include "OneSound\StreamType\MP3Stream.h"
-#include "OneSound\StreamType\OGGStream.h"
 
-namespace onesnd
-{
-    enum AudioFileFormat
-    {
-        INVALID, WAV, MP3, OGG,
-    };
-
-    // Checks the file extension
-    static AudioFileFormat getAudioFileFormatByExtension(const fs::path& file)
-    {
-        if (!fs::exists(file))
-            throw std::runtime_error("Can't find file: "s + file.string());
-
-        if(!file.has_extension())
-            return AudioFileFormat::INVALID;
-
-        if(file.extension() == ".wav")
-            return AudioFileFormat::WAV;
-        else if (file.extension() == ".mp3")
-            return AudioFileFormat::MP3;
-        else if (file.extension() == ".ogg")
-            return AudioFileFormat::OGG;
-        else
-        {
-            printf("OneSound Warning: Unsupported file format.");
-            return AudioFileFormat::INVALID;;
-        }
-    }
-
-    static bool checkMP3Tag(void* buffer)
-    {
-    #pragma pack(push)
-    #pragma pack(1)
-        struct MP3TAGV2
-        {
-            char id3[3];
-            unsigned char vermajor;
-            unsigned char verminor;
-            unsigned char flags;
-            unsigned int size;
-        };
-    #pragma pack(pop)
-
-        auto tag = *(MP3TAGV2*)buffer; // agly, but works fine.
-        if (tag.id3[0] == 'I' && tag.id3[1] == 'D' && tag.id3[2] == '3')
-            return true;
-
-        return false; // not an mp3 header
-    }
-
-    // Checks the file header
-    static AudioFileFormat getAudioFileFormatByHeader(const char* file_name)
-    {
-        FILE** f = nullptr;
-        fopen_s(f, file_name, "rb");
-        if (!f)
-            throw std::runtime_error("Can't open file: "s + file_name);
-
-        // MP3 has a header tag that needs 10 bytes
-        // WAV has a large header with byte fields [file + 0]='RIFF' and [file + 8]='WAVE', so it needs 12 bytes
-        // OGG has a 32-bit "capture pattern" sync field 'OggS', it needs 4 bytes
-        int buffer[3]; // WAV requires most, so 12 bytes
-        fread(buffer, sizeof(buffer), 1, *f);
-        fclose(*f); 
-        f = nullptr;
-
-        if (buffer[0] == 'FFIR' && buffer[2] == 'EVAW')
-            return AudioFileFormat::WAV;
-        else if (buffer[0] == 'SggO')
-            return AudioFileFormat::OGG;
-        else if (checkMP3Tag(buffer))
-            return AudioFileFormat::MP3;
-
-        return AudioFileFormat::INVALID;
-    }
-
-    AudioStream* createAudioStream(const char* file)
-    {
-        auto fmt = getAudioFileFormatByExtension(file);
-        if (fmt == AudioFileFormat::INVALID) 
-            fmt = getAudioFileFormatByHeader(file);
+#include "OneSound\VirtualFileSystem.h"
 
-        if (fmt == AudioFileFormat::INVALID)
-            throw std::runtime_error("Invalid file header.");
-
-        switch (fmt)
-        {
-            case AudioFileFormat::WAV: return new WAVStream();
-            case AudioFileFormat::MP3: return new MP3Stream();
-            case AudioFileFormat::OGG: return new OGGStream();
-
-            default:
-                return nullptr;
-        }
-    }
-
-    bool createAudioStream(AudioStream* as, const char* file)
-    {
-        if (!as) 
-            return false;
-        as->CloseStream(); // just in case
-
-        auto fmt = getAudioFileFormatByExtension(file);
-        if (!fmt) 
-            fmt = getAudioFileFormatByHeader(file);
-        if (!fmt) 
-            return false;
-
-        switch (fmt)
-        {
-            case AudioFileFormat::WAV: new (as) WAVStream(); break;
-            case AudioFileFormat::MP3: new (as) MP3Stream(); break;
-            case AudioFileFormat::OGG: new (as) OGGStream(); break;
-            default: 
-                return false;
-        }
-
-        return true;
-    }
+#include <algorithm>
 
+namespace onesnd
+{
     struct RIFFCHUNK
     {
         union
@@ -181,22 +65,26 @@ namespace onesnd
 
     AudioStream::AudioStream() : 
         FileHandle(nullptr),
+        SourceIO(),
         stream_size(0),
         stream_position(0),
         sample_rate(0),
         NumChannels(0),
         SampleSize(0),
-        SampleBlockSize(0)
+        SampleBlockSize(0),
+        quality(DecodeQuality::Full)
     { }
 
     AudioStream::AudioStream(const fs::path& file) : 
         FileHandle(nullptr),
+        SourceIO(),
         stream_size(0),
         stream_position(0),
         sample_rate(0),
         NumChannels(0), 
         SampleSize(0), 
-        SampleBlockSize(0)
+        SampleBlockSize(0),
+        quality(DecodeQuality::Full)
     {
         OpenStream(file);
     }
@@ -208,27 +96,64 @@ namespace onesnd
 
     bool AudioStream::OpenStream(const fs::path& file_name)
     {
-        if (FileHandle) // do not allow reopen an existing stream
+        if (IsOpen()) // do not allow reopen an existing stream
             return false;
 
-        FileHandle = reinterpret_cast<decltype(FileHandle)>(file_open_ro(file_name.string().c_str()));
-        if (!FileHandle)
-            throw std::runtime_error("Can't open file: "s + file_name.string());
+        auto io = VirtualFileSystem::instance().open(file_name);
+        try
+        {
+            return OpenStream(io);
+        }
+        catch (const std::runtime_error& e)
+        {
+            throw std::runtime_error(e.what() + " in file: "s + file_name.string());
+        }
+    }
+
+    bool AudioStream::OpenStream(const void* data, size_t size)
+    {
+        if (IsOpen())
+            return false;
+
+        return OpenStream(openMemoryIO(data, size));
+    }
+
+    bool AudioStream::OpenStream(const AudioIO& io)
+    {
+        if (FileHandle) // do not allow reopen an existing stream
+        {
+            auto rejected = io;
+            closeAudioIO(rejected);
+            return false;
+        }
+        SourceIO = io; // we own the io from now on, CloseStream() releases it
 
         WAVHEADER wav;
-        if (file_read(FileHandle, &wav, sizeof(wav)) <= 0)
-            throw std::runtime_error("Failed to read WAV header from file: "s + file_name.string());
+        if (SourceIO.read(SourceIO.context, &wav, sizeof(wav)) <= 0)
+        {
+            closeAudioIO(SourceIO);
+            throw std::runtime_error("Failed to read WAV header");
+        }
 
         // != "RIFF" || != "WAVE"
         if (wav.Header.ID != (int)'FFIR' || wav.Format != (int)'EVAW')
-            throw std::runtime_error("Invalid WAV header in file: "s + file_name.string());
+        {
+            closeAudioIO(SourceIO);
+            throw std::runtime_error("Invalid WAV header");
+        }
 
         auto* dataChunk = wav.getDataChunk();
         if (!dataChunk)
-            throw std::runtime_error("Failed to find WAV <data> chunk in file: "s + file_name.string());
+        {
+            closeAudioIO(SourceIO);
+            throw std::runtime_error("Failed to find WAV <data> chunk");
+        }
+
+        // the WAV streamer reads straight from the io, so the handle is the io itself
+        FileHandle = reinterpret_cast<decltype(FileHandle)>(&SourceIO);
 
         // initialize essential variables
-        stream_size = dataChunk->Size;
+        stream_size = (unsigned int)dataChunk->Size; // RIFF sizes are unsigned
         sample_rate = static_cast<decltype(sample_rate)>(wav.SampleRate);
         NumChannels = static_cast<decltype(NumChannels)>(wav.NumChannels);
         SampleSize = static_cast<decltype(SampleSize)>(wav.BitsPerSample >> 3);	// BPS/8 => SampleSize
@@ -241,7 +166,7 @@ namespace onesnd
     {
         if (FileHandle)
         {
-            file_close(reinterpret_cast<void*>(FileHandle));
+            closeAudioIO(SourceIO);
 
             FileHandle = 0;
             stream_size = 0;
@@ -253,20 +178,56 @@ namespace onesnd
         }
     }
 
+    AudioStream* AudioStream::CreateCursor() const
+    {
+        if (!FileHandle)
+            return nullptr;
+
+        auto io = cloneAudioIO(SourceIO);
+        if (!io.IsValid())
+            return nullptr;
+
+        // the header was parsed already, the cursor only takes over the format
+        AudioStream* cursor = new WAVStream();
+        cursor->SourceIO = io;
+        cursor->FileHandle = reinterpret_cast<decltype(FileHandle)>(&cursor->SourceIO);
+        cursor->stream_size = stream_size;
+        cursor->sample_rate = sample_rate;
+        cursor->NumChannels = NumChannels;
+        cursor->SampleSize = SampleSize;
+        cursor->SampleBlockSize = SampleBlockSize;
+        cursor->Seek(0);
+
+        return cursor;
+    }
+
+    bool AudioStream::Snapshot(unsigned long long streampos)
+    {
+        return false;
+    }
+
+    bool AudioStream::ScanLength()
+    {
+        return FileHandle != nullptr;
+    }
+
+    SoundTags AudioStream::ReadTags()
+    {
+        return {};
+    }
+
     int AudioStream::ReadSome(void* dstBuffer, int dstSize)
     {
         if (!FileHandle)
             return 0; // so nothing to do here
 
-        auto count = stream_size - stream_position; // calculate available data from stream
+        auto count = int(std::min<long long>(stream_size - stream_position, dstSize)); // calculate available data from stream, at most a buffer
         if (count == 0) // if are stream available bytes are 0
             return 0; // EOS is reached
 
-        if (count > dstSize) // if stream has more data than buffer
-            count = dstSize; // set bytes to read bigger
         count -= count % SampleBlockSize; // make sure that count is aligned to blockSize
 
-        if (file_read(FileHandle, dstBuffer, count) <= 0)
+        if (SourceIO.read(SourceIO.context, dstBuffer, count) <= 0)
         {
             stream_position = stream_size; // set EOS
             return 0; // no bytes to read
@@ -277,13 +238,13 @@ namespace onesnd
 
     }
 
-    unsigned int AudioStream::Seek(unsigned int streampos)
+    unsigned long long AudioStream::Seek(unsigned long long streampos)
     {
-        if (int(streampos) >= stream_size)
+        if ((long long)streampos >= stream_size)
             streampos = 0;
 
         streampos -= streampos % SampleBlockSize; // align to PCM blocksize
-        file_seek(FileHandle, streampos + sizeof(WAVHEADER), SEEK_SET);
+        SourceIO.seek(SourceIO.context, (long long)(streampos + sizeof(WAVHEADER)), SEEK_SET);
         stream_position = streampos;
 
         return streampos;
@@ -0,0 +1,181 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#include "OneSound\StreamType\DecoderRegistry.h"
+
+#include "OneSound\StreamType\WAVStream.h"
+#include "OneSound\StreamType\MP3Stream.h"
+#include "OneSound\StreamType\OGGStream.h"
+
+#include "OneSound\VirtualFileSystem.h"
+
+#include <algorithm>
+
+namespace onesnd
+{
+    // WAV has a large header with byte fields [file + 0]='RIFF' and [file + 8]='WAVE', so it needs 12 bytes
+    static bool sniffWAV(const unsigned char* head, size_t size)
+    {
+        return size >= 12 && memcmp(head, "RIFF", 4) == 0 && memcmp(head + 8, "WAVE", 4) == 0;
+    }
+
+    // OGG has a 32-bit "capture pattern" sync field 'OggS', it needs 4 bytes
+    static bool sniffOGG(const unsigned char* head, size_t size)
+    {
+        return size >= 4 && memcmp(head, "OggS", 4) == 0;
+    }
+
+    // MP3 starts with an ID3v2 tag or straight with the sync bits of an MPEG audio frame
+    static bool sniffMP3(const unsigned char* head, size_t size)
+    {
+        if (size >= 10 && memcmp(head, "ID3", 3) == 0)
+            return true;
+
+        return size >= 2 && head[0] == 0xFF && (head[1] & 0xE0) == 0xE0 && (head[1] & 0x06) != 0; // layer bits 00 are reserved
+    }
+
+    static std::string lowerExtension(const fs::path& file)
+    {
+        auto extension = file.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+        return extension;
+    }
+
+    DecoderRegistry::DecoderRegistry()
+    {
+        // the most specific signatures are tried first, MP3 frame sync is the weakest
+        add("mp3", sniffMP3, [] { return new MP3Stream(); }, { ".mp3" });
+        add("ogg", sniffOGG, [] { return new OGGStream(); }, { ".ogg" });
+        add("wav", sniffWAV, [] { return new WAVStream(); }, { ".wav" });
+    }
+
+    void DecoderRegistry::add(const std::string& name, const Sniffer& sniff, const Factory& create,
+                              const std::vector<std::string>& extensions)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        decoders.erase(std::remove_if(decoders.begin(), decoders.end(), [&](const Decoder& d) { return d.name == name; }), decoders.end());
+        decoders.insert(decoders.begin(), Decoder{ name, sniff, create, extensions });
+    }
+
+    void DecoderRegistry::remove(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        decoders.erase(std::remove_if(decoders.begin(), decoders.end(), [&](const Decoder& d) { return d.name == name; }), decoders.end());
+    }
+
+    const DecoderRegistry::Decoder* DecoderRegistry::find(const unsigned char* head, size_t size, const fs::path& hint) const
+    {
+        for (const auto& decoder : decoders)
+            if (decoder.sniff && decoder.sniff(head, size))
+                return &decoder;
+
+        // headerless data (e.g. a raw MPEG stream with junk in front), trust the extension
+        auto extension = lowerExtension(hint);
+        if (extension.empty())
+            return nullptr;
+
+        for (const auto& decoder : decoders)
+            if (std::find(decoder.extensions.begin(), decoder.extensions.end(), extension) != decoder.extensions.end())
+                return &decoder;
+
+        return nullptr;
+    }
+
+    std::string DecoderRegistry::identify(const unsigned char* head, size_t size, const fs::path& hint) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto* decoder = find(head, size, hint);
+        return decoder ? decoder->name : std::string();
+    }
+
+    bool DecoderRegistry::knowsExtension(const fs::path& file) const
+    {
+        auto extension = lowerExtension(file);
+        if (extension.empty())
+            return false;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& decoder : decoders)
+            if (std::find(decoder.extensions.begin(), decoder.extensions.end(), extension) != decoder.extensions.end())
+                return true;
+
+        return false;
+    }
+
+    void DecoderRegistry::preload()
+    {
+        std::vector<Factory> factories;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& decoder : decoders)
+                factories.push_back(decoder.create);
+        }
+
+        // the built-in decoders load their library in the constructor
+        for (const auto& create : factories)
+        {
+            std::unique_ptr<AudioStream> stream(create ? create() : nullptr);
+        }
+    }
+
+    AudioStream* DecoderRegistry::open(const AudioIO& io, const fs::path& hint, DecodeQuality quality)
+    {
+        auto source = io;
+
+        // the sniffers see the first bytes, then the decoder starts over on the same handle
+        unsigned char head[SniffSize];
+        auto bytesRead = source.read(source.context, head, sizeof(head));
+        if (bytesRead <= 0 || source.seek(source.context, 0, SEEK_SET) != 0)
+        {
+            closeAudioIO(source);
+            return nullptr;
+        }
+
+        Factory create;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (auto* decoder = find(head, size_t(bytesRead), hint))
+                create = decoder->create;
+        }
+
+        std::unique_ptr<AudioStream> stream(create ? create() : nullptr);
+        if (!stream)
+        {
+            closeAudioIO(source);
+            return nullptr;
+        }
+
+        stream->SetQuality(quality);
+        if (!stream->OpenStream(source)) // takes over the io, even if it fails
+            return nullptr;
+
+        return stream.release();
+    }
+
+    AudioStream* DecoderRegistry::open(const fs::path& file, DecodeQuality quality)
+    {
+        auto io = VirtualFileSystem::instance().open(file);
+        try
+        {
+            return open(io, file, quality);
+        }
+        catch (const std::runtime_error& e)
+        {
+            throw std::runtime_error(e.what() + " in file: "s + file.string());
+        }
+    }
+
+    AudioStream* openAudioStream(const fs::path& file, DecodeQuality quality)
+    {
+        return DecoderRegistry::instance().open(file, quality);
+    }
+
+    AudioStream* openAudioStream(const AudioIO& io, const fs::path& hint, DecodeQuality quality)
+    {
+        return DecoderRegistry::instance().open(io, hint, quality);
+    }
+}
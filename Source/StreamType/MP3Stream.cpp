@@ -3,6 +3,12 @@
 
 #include "OneSound\StreamType\MP3Stream.h"
 
+#include "..\ThirdParty\Include\mpg123.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
 namespace onesnd
 {
 #pragma data_seg("SHARED")
@@ -23,6 +29,10 @@ namespace onesnd
     static const char** (*mpg_supported_decoders)();
     static size_t(*mpg_seek)(int* mh, size_t sampleOffset, int whence);
     static const char* (*mpg_current_decoder)(int* mh);
+    static int(*mpg_scan)(int* mh);
+    static int(*mpg_param)(int* mh, int type, long value, double fvalue);
+    static int(*mpg_meta_check)(int* mh);
+    static int(*mpg_id3)(int* mh, mpg123_id3v1** v1, mpg123_id3v2** v2);
 
     typedef int(*mpg_read_func)(void*, void*, size_t);
     typedef off_t(*mpg_seek_func)(void*, off_t, int);
@@ -30,6 +40,10 @@ namespace onesnd
     static int(*mpg_replace_reader_handle)(int* mh, mpg_read_func, mpg_seek_func, mpg_close_func);
 #pragma data_seg()
 
+    // the fastest decoder found by the calibration, passed to mpg123_new
+    static std::mutex performanceMutex;
+    static DecoderPerformance performance;
+
     template<class Proc> static inline void LoadMpgProc(Proc& outProcVar, const char* procName)
     {
         outProcVar = (Proc)GetProcAddress(mpgDll, procName);
@@ -64,6 +78,10 @@ namespace onesnd
         LoadMpgProc(mpg_supported_decoders, "mpg123_supported_decoders");
         LoadMpgProc(mpg_seek, "mpg123_seek");
         LoadMpgProc(mpg_current_decoder, "mpg123_current_decoder");
+        LoadMpgProc(mpg_scan, "mpg123_scan");
+        LoadMpgProc(mpg_param, "mpg123_param");
+        LoadMpgProc(mpg_meta_check, "mpg123_meta_check");
+        LoadMpgProc(mpg_id3, "mpg123_id3");
         LoadMpgProc(mpg_replace_reader_handle, "mpg123_replace_reader_handle");
 
         mpg_init();
@@ -71,6 +89,156 @@ namespace onesnd
         atexit(_UninitMPG);
     }
 
+    // mpg123 reader callbacks, the reader handle is the AudioIO of the stream
+    static int mpg_io_read(void* handle, void* dst, size_t size)
+    {
+        auto* io = static_cast<AudioIO*>(handle);
+        return io->read(io->context, dst, size);
+    }
+    static off_t mpg_io_seek(void* handle, off_t offset, int whence)
+    {
+        auto* io = static_cast<AudioIO*>(handle);
+        return (off_t)io->seek(io->context, offset, whence); // mpg123 is built with 32-bit offsets
+    }
+    static int mpg_io_close(void* handle)
+    {
+        closeAudioIO(*static_cast<AudioIO*>(handle)); // safe to call twice, the io is invalidated
+        return 0;
+    }
+
+    // MPEG-1 Layer III, 128 kbit/s, 44.1 kHz, stereo: 144 * 128000 / 44100 bytes per frame of 1152 samples
+    static const int ClipFrameBytes = 417;
+    static const int ClipFrameSamples = 1152;
+    static const int ClipFrames = 16;
+
+    // the clip decodes in well under a millisecond, so a run repeats it long enough for the clock
+    // and the scheduler noise not to matter, and the median run counts
+    static const auto MinRunTime = std::chrono::milliseconds(20);
+    static const int BenchmarkRuns = 3;
+
+    // frames with empty side info and no main data decode to silence, but the synthesis
+    // filter, which is what the decoders implement differently, runs exactly as for music
+    static std::vector<unsigned char> calibrationClip()
+    {
+        std::vector<unsigned char> clip(size_t(ClipFrameBytes) * ClipFrames, 0);
+        for (auto i = 0; i < ClipFrames; ++i)
+        {
+            auto* frame = &clip[size_t(i) * ClipFrameBytes];
+            frame[0] = 0xFF; // sync
+            frame[1] = 0xFB; // MPEG-1, Layer III, no CRC
+            frame[2] = 0x90; // 128 kbit/s, 44.1 kHz, no padding
+            frame[3] = 0x00; // stereo
+        }
+        return clip;
+    }
+
+    // sample frames per second the decoder gets through the clip, 0 if it can't be used
+    static double benchmarkDecoder(const char* decoder, const std::vector<unsigned char>& clip)
+    {
+        auto error = 0;
+        auto* mh = mpg_new(decoder, &error);
+        if (!mh)
+            return 0.0;
+
+        auto io = openMemoryIO(clip.data(), clip.size());
+        mpg_replace_reader_handle(mh, mpg_io_read, mpg_io_seek, mpg_io_close);
+
+        auto median = 0.0;
+        if (mpg_open_handle(mh, &io) == MPG123_OK)
+        {
+            long rate = 0;
+            int channels = 0, encoding = 0;
+            mpg_getformat(mh, &rate, &channels, &encoding);
+            auto blockSize = std::max(channels * mpg_encsize(encoding), 1);
+
+            // decodes the whole clip once, returns the PCM bytes
+            std::vector<unsigned char> pcm(size_t(ClipFrameSamples) * 4 * 4);
+            auto decodeClip = [&]
+            {
+                mpg_seek(mh, 0, SEEK_SET);
+
+                auto decoded = size_t(0);
+                for (;;)
+                {
+                    auto done = size_t(0);
+                    auto result = mpg_read(mh, pcm.data(), pcm.size(), &done);
+                    decoded += done;
+                    if (result != MPG123_OK && result != MPG123_NEW_FORMAT)
+                        break;
+                }
+                return decoded;
+            };
+
+            std::vector<double> runs;
+            if (decodeClip()) // warms up the caches and tables
+            {
+                for (auto run = 0; run < BenchmarkRuns; ++run)
+                {
+                    auto decoded = size_t(0);
+                    auto start = std::chrono::steady_clock::now();
+                    auto elapsed = std::chrono::steady_clock::duration();
+                    do
+                    {
+                        auto clipBytes = decodeClip();
+                        if (!clipBytes)
+                            break;
+                        decoded += clipBytes;
+                        elapsed = std::chrono::steady_clock::now() - start;
+                    } while (elapsed < MinRunTime);
+
+                    auto seconds = std::chrono::duration<double>(elapsed).count();
+                    if (decoded && seconds > 0.0)
+                        runs.push_back(double(decoded / blockSize) / seconds);
+                }
+            }
+
+            if (!runs.empty())
+            {
+                std::nth_element(runs.begin(), runs.begin() + runs.size() / 2, runs.end());
+                median = runs[runs.size() / 2];
+            }
+            mpg_close(mh);
+        }
+        mpg_delete(mh);
+        closeAudioIO(io); // in case mpg123 didn't get to release it
+        return median;
+    }
+
+    DecoderPerformance MP3Stream::calibrate()
+    {
+        if (!mpgDll)
+            _InitMPG();
+
+        DecoderPerformance result;
+        auto clip = calibrationClip();
+        if (mpg_supported_decoders)
+        {
+            for (auto** decoder = mpg_supported_decoders(); decoder && *decoder; ++decoder)
+            {
+                auto throughput = benchmarkDecoder(*decoder, clip);
+                if (throughput <= 0.0)
+                    continue;
+
+                result.candidates.push_back({ *decoder, throughput });
+                if (throughput > result.samplesPerSecond)
+                {
+                    result.decoder = *decoder;
+                    result.samplesPerSecond = throughput;
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(performanceMutex);
+        performance = result;
+        return result;
+    }
+
+    DecoderPerformance MP3Stream::getDecoderPerformance()
+    {
+        std::lock_guard<std::mutex> lock(performanceMutex);
+        return performance;
+    }
+
     MP3Stream::MP3Stream() : AudioStream()
     {
         if (!mpgDll) 
@@ -90,33 +258,56 @@ namespace onesnd
         CloseStream();
     }
 
-    bool MP3Stream::OpenStream(const fs::path& file_name)
+    bool MP3Stream::OpenStream(const AudioIO& io)
     {
         if (!mpgDll || FileHandle) 
-            return 0;
+        {
+            auto rejected = io;
+            closeAudioIO(rejected);
+            return false;
+        }
+        SourceIO = io; // we own the io from now on, mpg123 releases it on close
 
-        FileHandle = mpg_new(nullptr, nullptr);
-        mpg_replace_reader_handle(FileHandle, file_read, file_seek, file_close);
+        std::string decoder;
+        {
+            std::lock_guard<std::mutex> lock(performanceMutex);
+            decoder = performance.decoder;
+        }
+        FileHandle = mpg_new(decoder.empty() ? nullptr : decoder.c_str(), nullptr); // NULL is mpg123's own choice
+        mpg_replace_reader_handle(FileHandle, mpg_io_read, mpg_io_seek, mpg_io_close);
 
-        auto* iohandle = file_open_ro(file_name.string().c_str());
-        if (!iohandle)
-            throw std::runtime_error("Can't open file: "s + file_name.string());
+        // the synth runs at the reduced rate or over one channel, which is where mpg123 spends its time;
+        // a build without down sampling fails the param and decodes at the native rate
+        switch (quality)
+        {
+            case DecodeQuality::Half:       mpg_param(FileHandle, MPG123_DOWN_SAMPLE, 1, 0.0);          break;
+            case DecodeQuality::Quarter:    mpg_param(FileHandle, MPG123_DOWN_SAMPLE, 2, 0.0);          break;
+            case DecodeQuality::Mono:       mpg_param(FileHandle, MPG123_ADD_FLAGS, MPG123_MONO_MIX, 0.0); break;
+            default:                                                                                break;
+        }
 
-        mpg_open_handle(FileHandle, iohandle);
+        if (mpg_open_handle(FileHandle, &SourceIO))
+        {
+            CloseStream();
+            throw std::runtime_error("Failed to open MP3 stream");
+        }
 
         auto rate = 0;
         auto numChannels = decltype(rate)();
         auto encoding = decltype(numChannels)();
 
         if (mpg_getformat(FileHandle, reinterpret_cast<long*>(&rate), &numChannels, &encoding))
-            throw std::runtime_error("Failed to read MP3 header from file: "s + file_name.string());
+        {
+            CloseStream();
+            throw std::runtime_error("Failed to read MP3 header");
+        }
 
         auto sampleSize = mpg_encsize(encoding);
 
         // get the actual PCM data size: (NumSamples * NumChannels * SampleSize)
         SampleSize = sampleSize;
         SampleBlockSize = numChannels * sampleSize;
-        stream_size = mpg_length(FileHandle) * SampleBlockSize;
+        stream_size = (long long)mpg_length(FileHandle) * SampleBlockSize;
         sample_rate = rate;
         NumChannels = numChannels;
 
@@ -132,6 +323,7 @@ namespace onesnd
         {
             mpg_close(FileHandle);
             mpg_delete(FileHandle);
+            closeAudioIO(SourceIO); // in case mpg123 didn't get to release it
 
             FileHandle = 0;
             stream_size = 0;
@@ -148,12 +340,10 @@ namespace onesnd
         if (!mpgDll || !FileHandle)
             return 0; // mpg123 not present
 
-        auto count = stream_size - stream_position; // calc available data from stream
+        auto count = int(std::min<long long>(stream_size - stream_position, dstSize)); // calc available data from stream, at most a buffer
         if (count == 0) // if stream available bytes 0?
             return 0; // EOS reached
 
-        if (count > dstSize) // if stream has more data than buffer
-            count = dstSize; // set bytes to read bigger
         count -= count % SampleBlockSize; // make sure count is aligned to blockSize
 
         auto bytesRead = size_t();
@@ -164,17 +354,119 @@ namespace onesnd
         return bytesRead;
     }
 
-    unsigned int MP3Stream::Seek(unsigned int streampos)
+    unsigned long long MP3Stream::Seek(unsigned long long streampos)
     {
         if (!mpgDll) 
             return 0;
 
-        if (int(streampos) >= stream_size)
+        if ((long long)streampos >= stream_size)
             streampos = 0;
-        int actual = streampos / SampleBlockSize; // mpg_seek works by sample blocks, so lets select the sample
+        auto actual = (long long)(streampos / SampleBlockSize); // mpg_seek works by sample blocks, so lets select the sample
 
-        mpg_seek(FileHandle, actual, SEEK_SET);
+        mpg_seek(FileHandle, size_t(actual), SEEK_SET);
+
+        return stream_position = actual * SampleBlockSize; // finally, update the stream position
+    }
+
+    AudioStream* MP3Stream::CreateCursor() const
+    {
+        if (!mpgDll || !FileHandle)
+            return nullptr;
+
+        auto io = cloneAudioIO(SourceIO);
+        if (!io.IsValid())
+            return nullptr;
+
+        // mpg123 state can't be shared, the cursor is a plain reopen; mpg123 only needs the first frame to get going
+        auto cursor = std::make_unique<MP3Stream>();
+        cursor->SetQuality(quality); // the same output format as this stream
+        try
+        {
+            if (!cursor->OpenStream(io))
+                return nullptr; // the io was closed by the failed open
+        }
+        catch (const std::exception&)
+        {
+            return nullptr; // the caller falls back to this stream
+        }
+        if (cursor->sample_rate != sample_rate || cursor->SampleBlockSize != SampleBlockSize)
+            return nullptr;
+
+        cursor->stream_size = stream_size; // keep the length the stream buffers were sized with
+        return cursor.release();
+    }
+
+    bool MP3Stream::ScanLength()
+    {
+        if (!mpgDll || !FileHandle)
+            return false;
+
+        // mpg123 rewinds to the current position after the scan
+        if (mpg_scan(FileHandle) != MPG123_OK)
+            return false;
+
+        stream_size = (long long)mpg_length(FileHandle) * SampleBlockSize;
+        return true;
+    }
+
+    // ID3 text may end with the terminating zero or contain several zero separated strings
+    static std::string id3String(const mpg123_string* str)
+    {
+        if (!str || !str->p || !str->fill)
+            return {};
+
+        std::string text(str->p, str->fill);
+        while (!text.empty() && text.back() == '\0')
+            text.pop_back();
+        std::replace(text.begin(), text.end(), '\0', '/');
+        return text;
+    }
+
+    static std::string id3v1String(const char* field, size_t size)
+    {
+        std::string text(field, strnlen(field, size));
+        while (!text.empty() && text.back() == ' ')
+            text.pop_back();
+        return text;
+    }
+
+    SoundTags MP3Stream::ReadTags()
+    {
+        SoundTags tags;
+        if (!mpgDll || !FileHandle || !mpg_id3 || !mpg_meta_check)
+            return tags;
+
+        // mpg123 only parses the tags in front of the first frame, which was read on open
+        if (!(mpg_meta_check(FileHandle) & MPG123_ID3))
+            return tags;
+
+        mpg123_id3v1* v1 = nullptr;
+        mpg123_id3v2* v2 = nullptr;
+        if (mpg_id3(FileHandle, &v1, &v2) != MPG123_OK)
+            return tags;
+
+        if (v2 && (v2->texts || v2->comments || v2->extras))
+        {
+            for (auto i = size_t(0); i < v2->texts; ++i)
+            {
+                auto& field = v2->text[i];
+                tags.emplace_back(std::string(field.id, sizeof(field.id)), id3String(&field.text));
+            }
+            for (auto i = size_t(0); i < v2->comments; ++i)
+                tags.emplace_back("COMM", id3String(&v2->comment_list[i].text));
+            for (auto i = size_t(0); i < v2->extras; ++i) // TXXX fields are keyed by their description
+                tags.emplace_back(id3String(&v2->extra[i].description), id3String(&v2->extra[i].text));
+        }
+        else if (v1)
+        {
+            tags.emplace_back("TITLE", id3v1String(v1->title, sizeof(v1->title)));
+            tags.emplace_back("ARTIST", id3v1String(v1->artist, sizeof(v1->artist)));
+            tags.emplace_back("ALBUM", id3v1String(v1->album, sizeof(v1->album)));
+            tags.emplace_back("YEAR", id3v1String(v1->year, sizeof(v1->year)));
+            tags.emplace_back("COMMENT", id3v1String(v1->comment, sizeof(v1->comment)));
+        }
 
-        return streampos;
+        tags.erase(std::remove_if(tags.begin(), tags.end(), [](const auto& tag) { return tag.second.empty(); }), tags.end());
+        return tags;
     }
 }
\ No newline at end of file
@@ -12,6 +12,10 @@
 
 #include "..\ThirdParty\Include\Vorbis\vorbisfile.h"
 
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
 
 namespace onesnd
 {
@@ -20,6 +24,7 @@ namespace onesnd
     static int(*oggv_clear)(void* vf) = 0;
     static long(*oggv_read)(void* vf, char* buffer, int length, int bigendiannp, int word, int sgned, int* bitstream) = 0;
     static long(*oggv_pcm_seek)(void* vf, INT64 pos) = 0;
+    static int(*oggv_raw_seek)(void* vf, INT64 pos) = 0;
     static UINT64(*oggv_pcm_tell)(void* vf) = 0;
     static UINT64(*oggv_pcm_total)(void* vf, int i) = 0;
     static vorbis_info* (*oggv_info)(void* vf, int link) = 0;
@@ -27,21 +32,27 @@ namespace onesnd
     static int(*oggv_open_callbacks)(void* datasource, int* vf, char* initial, long ibytes, ov_callbacks cb) = 0;
 #pragma data_seg()
 
+    // vorbisfile callbacks, the datasource is the AudioIO of the stream
     static size_t oggv_read_func(void* ptr, size_t size, size_t nmemb, void* handle)
     {
-        return file_read(handle, ptr, size * nmemb);
+        auto* io = static_cast<AudioIO*>(handle);
+        auto bytesRead = io->read(io->context, ptr, size * nmemb);
+        return bytesRead > 0 ? size_t(bytesRead) / size : 0;
     }
     static int oggv_seek_func(void* handle, INT64 offset, int whence)
     {
-        return file_seek(handle, (long)offset, whence);
+        auto* io = static_cast<AudioIO*>(handle);
+        return io->seek(io->context, offset, whence) == -1 ? -1 : 0; // vorbisfile expects 0 on success
     }
     static int oggv_close_func(void* handle)
     {
-        return file_close(handle);
+        closeAudioIO(*static_cast<AudioIO*>(handle)); // safe to call twice, the io is invalidated
+        return 0;
     }
     static long oggv_tell_func(void* handle)
     {
-        return file_tell(handle);
+        auto* io = static_cast<AudioIO*>(handle);
+        return (long)io->tell(io->context); // vorbisfile only takes the position as long
     }
 
     template<class Proc> static inline void LoadVorbisProc(Proc* outProcVar, const char* procName)
@@ -65,6 +76,7 @@ namespace onesnd
         LoadVorbisProc(&oggv_clear, "ov_clear");
         LoadVorbisProc(&oggv_read, "ov_read");
         LoadVorbisProc(&oggv_pcm_seek, "ov_pcm_seek");
+        LoadVorbisProc(&oggv_raw_seek, "ov_raw_seek");
         LoadVorbisProc(&oggv_pcm_tell, "ov_pcm_tell");
         LoadVorbisProc(&oggv_pcm_total, "ov_pcm_total");
         LoadVorbisProc(&oggv_info, "ov_info");
@@ -74,6 +86,208 @@ namespace onesnd
         atexit(finalizeOGGVorbis);
     }
 
+    struct OggSeekTable
+    {
+        std::vector<long long> granules;    // sample position at the end of every page, ascending
+        std::vector<long long> offsets;     // byte offset of the page in the file
+    };
+
+#pragma pack(push)
+#pragma pack(1)
+    struct SEEKTABLEHEADER
+    {
+        int Magic;                      // contains the letters "OGST"
+        unsigned int Version;           // seek table file version
+        unsigned long long Key;         // content key of the OGG file
+        unsigned long long NumPages;    // number of entries that follow
+    };
+#pragma pack(pop)
+
+    static const int SeekTableMagic = (int)'TSGO';
+    static const unsigned int SeekTableVersion = 1;
+
+    // Vorbis blocks are at most 8192 samples, a page that ends this far before the target
+    // is followed by a page that decodes into the target with the overlap already primed
+    static const long long PreRollSamples = 8192;
+
+    // tables of the most recently used files stay in memory, the streams hold on to their own
+    static const size_t MaxSeekTables = 64;
+
+    struct CachedSeekTable
+    {
+        std::shared_ptr<const OggSeekTable> table;
+        unsigned long long used;    // tick of the last lookup
+    };
+
+    static std::mutex seekTableMutex;
+    static std::unordered_map<unsigned long long, CachedSeekTable> seekTables;
+    static unsigned long long seekTableTick = 0;
+    static fs::path seekTableCache;
+
+    // identifies the content without reading the whole file: size + the first pages (serial number and CRC)
+    static unsigned long long oggContentKey(AudioIO& io)
+    {
+        char head[4096];
+        auto bytesRead = io.read(io.context, head, sizeof(head));
+        auto size = io.seek(io.context, 0, SEEK_END);
+        io.seek(io.context, 0, SEEK_SET);
+
+        return bytesRead > 0 ? hash_fnv1a(head, size_t(bytesRead), hash_fnv1a(&size, sizeof(size))) : 0;
+    }
+
+    // walks the page headers only, the page bodies are skipped
+    static std::shared_ptr<OggSeekTable> scanOggPages(AudioIO& io)
+    {
+        auto table = std::make_shared<OggSeekTable>();
+
+        unsigned char header[27 + 255];
+        auto offset = (long long)0;
+        auto serial = (unsigned int)0;
+        while (io.read(io.context, header, 27) == 27)
+        {
+            if (memcmp(header, "OggS", 4) != 0)
+                return nullptr; // lost the page sync, the file is damaged
+
+            auto numSegments = header[26];
+            if (io.read(io.context, header + 27, numSegments) != numSegments)
+                break; // truncated page at the end
+
+            auto pageSerial = (unsigned int)0;
+            memcpy(&pageSerial, header + 14, sizeof(pageSerial));
+            if (offset == 0)
+                serial = pageSerial;
+            else if (pageSerial != serial)
+                return nullptr; // chained or multiplexed stream, leave it to vorbisfile
+
+            auto granule = (long long)0;
+            memcpy(&granule, header + 6, sizeof(granule));
+
+            auto bodySize = 0u;
+            for (auto i = 0u; i < numSegments; ++i)
+                bodySize += header[27 + i];
+
+            if (granule != -1) // -1 means no packet ends on this page
+            {
+                if (!table->granules.empty() && granule < table->granules.back())
+                    return nullptr; // not monotonic, can't be searched
+                table->granules.push_back(granule);
+                table->offsets.push_back(offset);
+            }
+
+            offset += 27 + numSegments + bodySize;
+            if (io.seek(io.context, offset, SEEK_SET) == -1)
+                break;
+        }
+
+        return table;
+    }
+
+    static fs::path seekTablePath(const fs::path& directory, unsigned long long key)
+    {
+        char name[32];
+        sprintf_s(name, "%016llx.ogst", key);
+        return directory / name;
+    }
+
+    static std::shared_ptr<OggSeekTable> loadSeekTable(const fs::path& directory, unsigned long long key)
+    {
+        std::ifstream in(seekTablePath(directory, key), std::ios::binary);
+        if (!in)
+            return nullptr;
+
+        SEEKTABLEHEADER header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            header.Magic != SeekTableMagic || header.Version != SeekTableVersion || header.Key != key)
+            return nullptr;
+
+        auto table = std::make_shared<OggSeekTable>();
+        table->granules.resize(static_cast<size_t>(header.NumPages));
+        table->offsets.resize(static_cast<size_t>(header.NumPages));
+        in.read(reinterpret_cast<char*>(table->granules.data()), table->granules.size() * sizeof(long long));
+        in.read(reinterpret_cast<char*>(table->offsets.data()), table->offsets.size() * sizeof(long long));
+
+        return in ? table : nullptr;
+    }
+
+    static void saveSeekTable(const fs::path& directory, unsigned long long key, const OggSeekTable& table)
+    {
+        std::error_code ec;
+        fs::create_directories(directory, ec);
+
+        std::ofstream out(seekTablePath(directory, key), std::ios::binary | std::ios::trunc);
+        if (!out)
+            return; // the cache is optional, the table still lives in memory
+
+        SEEKTABLEHEADER header = { SeekTableMagic, SeekTableVersion, key, table.granules.size() };
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(table.granules.data()), table.granules.size() * sizeof(long long));
+        out.write(reinterpret_cast<const char*>(table.offsets.data()), table.offsets.size() * sizeof(long long));
+    }
+
+    // [seekTableMutex] keeps the table and drops the least recently used one over the limit
+    static std::shared_ptr<const OggSeekTable> cacheSeekTable(unsigned long long key, std::shared_ptr<const OggSeekTable> table)
+    {
+        auto& cached = seekTables.emplace(key, CachedSeekTable{ table, 0 }).first->second;
+        cached.used = ++seekTableTick;
+
+        if (seekTables.size() > MaxSeekTables)
+        {
+            auto oldest = std::min_element(seekTables.begin(), seekTables.end(),
+                [](const auto& a, const auto& b) { return a.second.used < b.second.used; });
+            seekTables.erase(oldest);
+        }
+        return cached.table;
+    }
+
+    // memory cache -> disk cache -> page scan; an empty table means vorbisfile has to seek on its own
+    // takes ownership of the io, runs on a worker thread
+    static std::shared_ptr<const OggSeekTable> acquireSeekTable(AudioIO io)
+    {
+        static const auto empty = std::make_shared<const OggSeekTable>();
+
+        auto key = oggContentKey(io);
+        if (!key)
+        {
+            closeAudioIO(io);
+            return empty;
+        }
+
+        fs::path directory;
+        {
+            std::lock_guard<std::mutex> lock(seekTableMutex);
+            auto it = seekTables.find(key);
+            if (it != seekTables.end())
+            {
+                closeAudioIO(io);
+                it->second.used = ++seekTableTick;
+                return it->second.table;
+            }
+            directory = seekTableCache;
+        }
+
+        auto table = directory.empty() ? nullptr : loadSeekTable(directory, key);
+        if (!table)
+        {
+            // the scan is sequential, read it in large blocks even if the stream itself isn't buffered
+            io = openBufferedIO(io, 1024 * 1024);
+            table = scanOggPages(io);
+            if (table && !directory.empty())
+                saveSeekTable(directory, key, *table);
+        }
+        closeAudioIO(io);
+
+        std::shared_ptr<const OggSeekTable> result = table ? table : empty;
+
+        std::lock_guard<std::mutex> lock(seekTableMutex);
+        return cacheSeekTable(key, result);
+    }
+
+    void OGGStream::setSeekTableCache(const fs::path& directory)
+    {
+        std::lock_guard<std::mutex> lock(seekTableMutex);
+        seekTableCache = directory;
+    }
+
     OGGStream::OGGStream() : AudioStream()
     {
         if (!vfDll) 
@@ -93,22 +307,23 @@ namespace onesnd
         CloseStream();
     }
 
-    bool OGGStream::OpenStream(const fs::path& file_name)
+    bool OGGStream::OpenStream(const AudioIO& io)
     {
         if (!vfDll || FileHandle) 
+        {
+            auto rejected = io;
+            closeAudioIO(rejected);
             return false;
-
-        auto* iohandle = file_open_ro(file_name.string().c_str());
-        if (!iohandle)
-            throw std::runtime_error("Can't open file: "s + file_name.string());
+        }
+        SourceIO = io; // we own the io from now on, vorbisfile releases it on ov_clear
 
         ov_callbacks cb = {oggv_read_func, oggv_seek_func, oggv_close_func, oggv_tell_func};
         FileHandle = reinterpret_cast<decltype(FileHandle)>(malloc(sizeof(OggVorbis_File))); // filehandle is actually Vorbis handle
 
-        auto err = oggv_open_callbacks(iohandle, FileHandle, nullptr, 0, cb);
+        auto err = oggv_open_callbacks(&SourceIO, FileHandle, nullptr, 0, cb);
         if (err)
         {
-            const char* errmsg = nullptr;
+            const char* errmsg = "Failed to open OGG stream";
             switch (err)
             {
                 case OV_EREAD:		errmsg = "Error reading OGG file!";			break;
@@ -118,27 +333,20 @@ namespace onesnd
                 case OV_EFAULT:		errmsg = "Internal logic fault";			break;
             }
 
-            CloseStream();
-            throw std::runtime_error("Failed to open OGG file: "s + file_name.string());
+            // vorbisfile leaves the datasource open when the open fails
+            free(FileHandle);
+            FileHandle = 0;
+            closeAudioIO(SourceIO);
+            throw std::runtime_error(errmsg);
         }
         auto* info = oggv_info(FileHandle, -1);
         if (!info)
         {
             CloseStream();
-            throw std::runtime_error("Failed to acquire OGG stream format from file : "s + file_name.string());
+            throw std::runtime_error("Failed to acquire OGG stream format");
         }
 
         sample_rate = static_cast<decltype(sample_rate)>(info->rate);
-
-        // FIXME: Some breaks are occured beatween every stream's block.
-        if (sample_rate > 22050)
-        //  Let's warn the user.
-            printf("ONESOUND: WARNING: The stream has some troubles when do its.\n\
-          Unknown breaks are occured beatween every stream's block\n\
-          if sample rate is more than 22050. Please convert your\n\
-          OGG File to the sund with 22050 sample rate until the\n\
-          author not found a solution.\n");
-
         NumChannels = info->channels;
         SampleSize = 2;						// OGG samples are always 16-bit
         SampleBlockSize = 2 * NumChannels;	// OGG samples are always 16-bit
@@ -154,8 +362,24 @@ namespace onesnd
 
         if (FileHandle)
         {
+            if (seekTableBuild.valid())
+                seekTableBuild.wait(); // the scan reads the source of this stream
+            seekTableBuild = {};
+            seekTable.reset();
+
+            for (auto& snapshot : snapshots)
+            {
+                if (snapshot->rearming.valid())
+                    snapshot->rearming.wait();
+                oggv_clear(snapshot->decoder);
+                free(snapshot->decoder);
+                closeAudioIO(snapshot->io);
+            }
+            snapshots.clear();
+
             oggv_clear(FileHandle);
             free(FileHandle);
+            closeAudioIO(SourceIO); // in case vorbisfile didn't get to release it
 
             FileHandle = 0;
             stream_size = 0;
@@ -172,21 +396,16 @@ namespace onesnd
         if (!vfDll || !FileHandle)
             return 0;
 
-        auto count = stream_size - stream_position; // calc available data from stream
+        auto count = int(std::min<long long>(stream_size - stream_position, dstSize)); // calc available data from stream, at most a buffer
         if (count == 0) // if stream available bytes 0?
             return 0; // EOS reached
 
-        if (count > dstSize) // if stream has more data than buffer
-            count = dstSize; // set bytes to read bigger
         count -= count % SampleBlockSize; // make sure count is aligned to blockSize
 
         auto current_section = int();
         auto bytesTotal = int(); // total bytes read
         do
         {
-            // FIXME: Error when streaming one handle many times.
-            //        File handles are not shared, so creating two handles of the same stream can be chashed.
-            //        Find a way to share the stream or the data.
             int bytesRead = oggv_read(FileHandle, (char*)dstBuffer + bytesTotal,
                 (count - bytesTotal), 0, 2, 1, &current_section);
 
@@ -197,18 +416,239 @@ namespace onesnd
         } while (bytesTotal < count);
 
         stream_position += bytesTotal;
+
+        // park the consumed snapshots again, one buffer after the restart that used them;
+        // the seek and the pre-roll decode run on a worker, this read is a refill
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        for (auto& snapshot : snapshots)
+            if (snapshot->rearmIn && --snapshot->rearmIn == 0)
+                snapshot->rearming = std::async(std::launch::async, [this, parked = snapshot.get(), table = AcquireSeekTable(false)]
+                {
+                    RearmSnapshot(*parked, table.get());
+                });
+
         return bytesTotal;
     }
 
-    unsigned int OGGStream::Seek(unsigned int streampos)
+    unsigned long long OGGStream::Seek(unsigned long long streampos)
     {
         if (!vfDll) 
             return 0; // vorbis not present
 
-        if (static_cast<int>(streampos) >= stream_size) 
+        if (static_cast<long long>(streampos) >= stream_size) 
             streampos = 0; // out of bounds, set to beginning
-        oggv_pcm_seek(FileHandle, streampos / SampleBlockSize); // seek PCM samples
+
+        std::unique_lock<std::mutex> lock(snapshotMutex);
+        for (auto& snapshot : snapshots)
+        {
+            auto parked = !snapshot->rearmIn && (!snapshot->rearming.valid() ||
+                snapshot->rearming.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+            if (snapshot->position == streampos && parked)
+            {
+                // the parked decoder continues, this one gets parked again later
+                std::swap(FileHandle, snapshot->decoder);
+                snapshot->rearmIn = 2;
+
+                return stream_position = streampos;
+            }
+        }
+
+        // the start of the stream is found at once, further in the seek table saves the bisection
+        auto sample = (long long)(streampos / SampleBlockSize);
+        auto table = sample < PreRollSamples ? nullptr : AcquireSeekTable(false);
+        lock.unlock(); // the table is held, the decoder is only used by the refills
+        SeekDecoder(FileHandle, sample, table.get()); // seek PCM samples
 
         return stream_position = streampos; // finally, update the stream position
     }
+
+    bool OGGStream::Snapshot(unsigned long long streampos)
+    {
+        if (!vfDll || !FileHandle)
+            return false;
+
+        streampos -= streampos % SampleBlockSize;
+        if (static_cast<long long>(streampos) >= stream_size)
+            return false;
+
+        auto parkedAt = [this, streampos]
+        {
+            for (auto& snapshot : snapshots)
+                if (snapshot->position == streampos)
+                    return true;
+            return false;
+        };
+
+        std::shared_ptr<const OggSeekTable> table;
+        {
+            std::lock_guard<std::mutex> lock(snapshotMutex);
+            if (parkedAt())
+                return true; // already parked there
+            table = AcquireSeekTable(false);
+        }
+
+        // opened and parked without the lock, the refills go on meanwhile
+        auto snapshot = std::make_unique<DecoderSnapshot>();
+        snapshot->position = streampos;
+        snapshot->rearmIn = 0;
+        snapshot->io = cloneAudioIO(SourceIO);
+        if (!snapshot->io.IsValid())
+            return false;
+
+        ov_callbacks cb = {oggv_read_func, oggv_seek_func, oggv_close_func, oggv_tell_func};
+        snapshot->decoder = reinterpret_cast<int*>(malloc(sizeof(OggVorbis_File)));
+        if (oggv_open_callbacks(&snapshot->io, snapshot->decoder, nullptr, 0, cb))
+        {
+            free(snapshot->decoder);
+            closeAudioIO(snapshot->io);
+            return false;
+        }
+
+        RearmSnapshot(*snapshot, table.get());
+
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        if (parkedAt())
+        {
+            // parked there by another call meanwhile
+            oggv_clear(snapshot->decoder);
+            free(snapshot->decoder);
+            closeAudioIO(snapshot->io);
+            return true;
+        }
+        snapshots.push_back(std::move(snapshot));
+
+        return true;
+    }
+
+    void OGGStream::RearmSnapshot(DecoderSnapshot& snapshot, const OggSeekTable* table)
+    {
+        // the seek leaves the decoder primed, the next read starts exactly at the position
+        SeekDecoder(snapshot.decoder, (long long)(snapshot.position / SampleBlockSize), table);
+    }
+
+    std::shared_ptr<const OggSeekTable> OGGStream::AcquireSeekTable(bool wait)
+    {
+        if (!seekTable)
+        {
+            if (!seekTableBuild.valid())
+            {
+                auto io = cloneAudioIO(SourceIO); // the decoder keeps its position
+                if (!io.IsValid())
+                    return nullptr;
+                seekTableBuild = std::async(std::launch::async, acquireSeekTable, io).share();
+            }
+
+            if (!wait && seekTableBuild.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                return nullptr; // the seek bisects meanwhile
+            seekTable = seekTableBuild.get();
+        }
+        return seekTable;
+    }
+
+    bool OGGStream::BuildSeekTable()
+    {
+        if (!vfDll || !FileHandle)
+            return false;
+
+        // waits without the lock, the refills seek by bisection meanwhile
+        std::shared_future<std::shared_ptr<const OggSeekTable>> build;
+        {
+            std::lock_guard<std::mutex> lock(snapshotMutex);
+            if (!AcquireSeekTable(false))
+                build = seekTableBuild;
+        }
+        if (build.valid())
+            build.wait();
+
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        auto table = AcquireSeekTable(false);
+        return table && !table->granules.empty();
+    }
+
+    bool OGGStream::SeekDecoder(int* decoder, long long sample, const OggSeekTable* table)
+    {
+        if (table && !table->granules.empty())
+        {
+            // the first page that ends after the pre-roll limit, the page before it ends safely before the target
+            const auto& granules = table->granules;
+            auto it = std::upper_bound(granules.begin(), granules.end(), sample - PreRollSamples);
+            if (it != granules.begin() && it != granules.end() &&
+                oggv_raw_seek(decoder, table->offsets[it - granules.begin()]) == 0)
+            {
+                // one read of the page, then decode the pre-roll away
+                auto skip = (sample - (long long)oggv_pcm_tell(decoder)) * SampleBlockSize;
+
+                char scratch[16 * 1024];
+                auto current_section = int();
+                while (skip > 0)
+                {
+                    auto bytesRead = oggv_read(decoder, scratch, (int)std::min<long long>(skip, sizeof(scratch)),
+                                               0, 2, 1, &current_section);
+                    if (bytesRead <= 0)
+                        break;
+                    skip -= bytesRead;
+                }
+
+                if (skip == 0)
+                    return true;
+            }
+        }
+
+        return oggv_pcm_seek(decoder, sample) == 0; // no table or the page didn't fit, bisect
+    }
+
+    AudioStream* OGGStream::CreateCursor() const
+    {
+        if (!vfDll || !FileHandle)
+            return nullptr;
+
+        auto io = cloneAudioIO(SourceIO);
+        if (!io.IsValid())
+            return nullptr;
+
+        // vorbisfile state can't be shared, the cursor is a plain reopen: the headers are parsed again
+        auto cursor = std::make_unique<OGGStream>();
+        try
+        {
+            if (!cursor->OpenStream(io))
+                return nullptr; // the io was closed by the failed open
+        }
+        catch (const std::exception&)
+        {
+            return nullptr; // the caller falls back to this stream
+        }
+        if (cursor->sample_rate != sample_rate || cursor->SampleBlockSize != SampleBlockSize)
+            return nullptr;
+
+        cursor->stream_size = stream_size; // keep the length the stream buffers were sized with
+        cursor->seekTable = seekTable;
+        cursor->seekTableBuild = seekTableBuild; // a running scan is shared as well
+        return cursor.release();
+    }
+
+    SoundTags OGGStream::ReadTags()
+    {
+        SoundTags tags;
+        if (!vfDll || !FileHandle)
+            return tags;
+
+        // the comment header was read on open, no audio is decoded
+        auto* comment = oggv_comment(FileHandle, -1);
+        if (!comment)
+            return tags;
+
+        for (auto i = 0; i < comment->comments; ++i)
+        {
+            std::string field(comment->user_comments[i], size_t(comment->comment_lengths[i]));
+            auto separator = field.find('=');
+            if (separator == std::string::npos || separator == 0)
+                continue;
+
+            // field names are case insensitive ASCII
+            auto name = field.substr(0, separator);
+            std::transform(name.begin(), name.end(), name.begin(), [](char c) { return (char)toupper((unsigned char)c); });
+            tags.emplace_back(name, field.substr(separator + 1));
+        }
+        return tags;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,354 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#include "OneSound\VirtualFileSystem.h"
+
+#include "OneSound\AsyncIO.h"
+
+#include <algorithm>
+#include <fstream>
+#include <unordered_set>
+
+namespace onesnd
+{
+#pragma pack(push)
+#pragma pack(1)
+    struct PACKHEADER
+    {
+        int Magic;                      // contains the letters "OSPK"
+        unsigned int Version;           // pack format version
+        unsigned int NumFiles;          // number of entries in the index
+        unsigned int IndexSize;         // size of the index in bytes
+        unsigned long long IndexOffset; // offset of the index from the beginning of the pack
+    };
+#pragma pack(pop)
+
+    static const int PackMagic = (int)'KPSO';
+    static const unsigned int PackVersion = 1;
+
+    PackFile::PackFile(const fs::path& pack) :
+        handle(file_open_ro(pack.string().c_str())),
+        modified(0)
+    {
+        if (!handle)
+            throw std::runtime_error("Can't open pack: "s + pack.string());
+
+        std::error_code error;
+        auto time = fs::last_write_time(pack, error);
+        if (!error)
+            modified = time.time_since_epoch().count();
+
+        PACKHEADER header;
+        if (file_pread(handle, &header, sizeof(header), 0) != sizeof(header) ||
+            header.Magic != PackMagic || header.Version != PackVersion)
+        {
+            file_close(handle);
+            throw std::runtime_error("Invalid pack header in: "s + pack.string());
+        }
+
+        // the whole index is loaded with a single read
+        std::vector<char> data(header.IndexSize);
+        if (file_pread(handle, data.data(), data.size(), header.IndexOffset) != int(data.size()))
+        {
+            file_close(handle);
+            throw std::runtime_error("Failed to read pack index from: "s + pack.string());
+        }
+
+        index.reserve(header.NumFiles);
+
+        auto* ptr = data.data();
+        auto* end = ptr + data.size();
+        for (auto i = 0u; i < header.NumFiles; ++i)
+        {
+            unsigned short nameLength;
+            if (ptr + sizeof(nameLength) > end)
+                break;
+            memcpy(&nameLength, ptr, sizeof(nameLength));
+            ptr += sizeof(nameLength);
+
+            Entry entry;
+            if (ptr + nameLength + sizeof(entry) > end)
+                break;
+            std::string name(ptr, nameLength);
+            ptr += nameLength;
+
+            memcpy(&entry, ptr, sizeof(entry));
+            ptr += sizeof(entry);
+
+            index.emplace(std::move(name), entry);
+        }
+
+        if (index.size() != header.NumFiles)
+        {
+            file_close(handle);
+            throw std::runtime_error("Corrupted pack index in: "s + pack.string());
+        }
+    }
+
+    PackFile::~PackFile()
+    {
+        if (handle)
+            file_close(handle);
+    }
+
+    const PackFile::Entry* PackFile::find(const fs::path& name) const
+    {
+        auto it = index.find(normalizeName(name));
+        return it != index.end() ? &it->second : nullptr;
+    }
+
+    std::string PackFile::normalizeName(const fs::path& name)
+    {
+        auto str = name.string();
+        std::replace(str.begin(), str.end(), '\\', '/');
+        std::transform(str.begin(), str.end(), str.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+
+        // "./sound/a.wav" and "/sound/a.wav" are the same file in the pack
+        while (!str.empty() && (str[0] == '/' || str.compare(0, 2, "./") == 0))
+            str.erase(0, str[0] == '/' ? 1 : 2);
+
+        return str;
+    }
+
+    // the name of a file in a pack: its path relative to the root, compared component by component
+    // so the root "Sound" doesn't strip "SoundFX/..."
+    static std::string packNameOf(const fs::path& file, const fs::path& root)
+    {
+        auto it = file.begin();
+        for (const auto& part : root)
+        {
+            if (part.empty() || part == ".")
+                continue; // trailing separator
+            if (it == file.end() || *it != part)
+                return PackFile::normalizeName(file); // not under the root
+            ++it;
+        }
+
+        fs::path relative;
+        for (; it != file.end(); ++it)
+            relative /= *it;
+        return PackFile::normalizeName(relative);
+    }
+
+    void PackFile::create(const fs::path& pack, const fs::path& root, const std::vector<fs::path>& files)
+    {
+        // the reader can't mount a pack with duplicate or truncated names, so nothing is written for those
+        std::vector<std::string> names;
+        std::unordered_set<std::string> unique;
+        for (const auto& file : files)
+        {
+            auto name = packNameOf(file, root);
+            if (name.size() > 0xFFFF)
+                throw std::runtime_error("File name too long for a pack: "s + file.string());
+            if (!unique.insert(name).second)
+                throw std::runtime_error("Duplicate file name in pack: "s + name);
+            names.push_back(std::move(name));
+        }
+
+        std::ofstream out(pack, std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("Can't create pack: "s + pack.string());
+
+        PACKHEADER header = {};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header)); // rewritten at the end
+
+        std::vector<char> indexData;
+        std::vector<char> fileData;
+        for (auto i = size_t(0); i < files.size(); ++i)
+        {
+            const auto& file = files[i];
+            std::ifstream in(file, std::ios::binary | std::ios::ate);
+            if (!in)
+                throw std::runtime_error("Can't open file: "s + file.string());
+
+            fileData.resize(static_cast<size_t>(in.tellg()));
+            in.seekg(0);
+            in.read(fileData.data(), fileData.size());
+
+            Entry entry;
+            entry.offset = static_cast<unsigned long long>(out.tellp());
+            entry.size = fileData.size();
+            out.write(fileData.data(), fileData.size());
+
+            const auto& name = names[i];
+            auto nameLength = static_cast<unsigned short>(name.size());
+
+            auto at = indexData.size();
+            indexData.resize(at + sizeof(nameLength) + nameLength + sizeof(entry));
+            memcpy(&indexData[at], &nameLength, sizeof(nameLength));
+            memcpy(&indexData[at + sizeof(nameLength)], name.data(), nameLength);
+            memcpy(&indexData[at + sizeof(nameLength) + nameLength], &entry, sizeof(entry));
+        }
+
+        header.Magic = PackMagic;
+        header.Version = PackVersion;
+        header.NumFiles = static_cast<unsigned int>(files.size());
+        header.IndexSize = static_cast<unsigned int>(indexData.size());
+        header.IndexOffset = static_cast<unsigned long long>(out.tellp());
+        out.write(indexData.data(), indexData.size());
+
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        if (!out)
+            throw std::runtime_error("Failed to write pack: "s + pack.string());
+    }
+
+    // a single file inside of a pack, every stream gets its own read position
+    struct PackIO
+    {
+        std::shared_ptr<PackFile> pack;
+        unsigned long long offset;
+        unsigned long long size;
+        unsigned long long position;
+    };
+
+    static int pack_read(void* context, void* dst, size_t size)
+    {
+        auto* io = static_cast<PackIO*>(context);
+
+        auto available = io->size - io->position;
+        if (size > available)
+            size = static_cast<size_t>(available);
+        if (!size)
+            return 0;
+
+        auto bytesRead = file_pread(io->pack->getHandle(), dst, size, io->offset + io->position);
+        io->position += bytesRead;
+
+        return bytesRead;
+    }
+
+    static long long pack_seek(void* context, long long offset, int whence)
+    {
+        auto* io = static_cast<PackIO*>(context);
+
+        auto base = (long long)0;
+        switch (whence)
+        {
+            case SEEK_SET: base = 0; break;
+            case SEEK_CUR: base = (long long)io->position; break;
+            case SEEK_END: base = (long long)io->size; break;
+            default:
+                return -1;
+        }
+
+        auto target = base + offset;
+        if (target < 0 || (unsigned long long)target > io->size)
+            return -1; // out of bounds, position is not changed
+
+        io->position = (unsigned long long)target;
+        return target;
+    }
+
+    static long long pack_tell(void* context)
+    {
+        return (long long)static_cast<PackIO*>(context)->position;
+    }
+
+    static int pack_close(void* context)
+    {
+        delete static_cast<PackIO*>(context);
+        return 0;
+    }
+
+    static AudioIO pack_clone(void* context)
+    {
+        auto* io = static_cast<PackIO*>(context);
+        return { new PackIO{ io->pack, io->offset, io->size, 0 }, pack_read, pack_seek, pack_tell, pack_close, pack_clone };
+    }
+
+    void VirtualFileSystem::mount(const fs::path& pack)
+    {
+        auto packFile = std::make_shared<PackFile>(pack); // index is loaded once, here
+
+        std::lock_guard<std::mutex> lock(mutex);
+        packs.push_back(packFile);
+
+        // merge the index, so opening a file costs a single hash lookup
+        for (const auto& entry : packFile->getIndex())
+            files[entry.first] = PackedFile{ packFile, entry.second };
+    }
+
+    void VirtualFileSystem::unmountAll()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        files.clear();
+        packs.clear();
+    }
+
+    bool VirtualFileSystem::findPacked(const fs::path& file, PackedFile& out) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (files.empty())
+            return false;
+
+        auto it = files.find(PackFile::normalizeName(file));
+        if (it == files.end())
+            return false;
+
+        out = it->second;
+        return true;
+    }
+
+    bool VirtualFileSystem::isPacked(const fs::path& file) const
+    {
+        PackedFile packed;
+        return findPacked(file, packed);
+    }
+
+    bool VirtualFileSystem::exists(const fs::path& file) const
+    {
+        return isPacked(file) || fs::exists(file);
+    }
+
+    bool VirtualFileSystem::stat(const fs::path& file, unsigned long long& size, long long& modified) const
+    {
+        PackedFile packed;
+        if (findPacked(file, packed))
+        {
+            size = packed.entry.size;
+            modified = packed.pack->getModified();
+            return true;
+        }
+
+        std::error_code error;
+        size = fs::file_size(file, error);
+        if (error)
+            return false;
+
+        auto time = fs::last_write_time(file, error);
+        if (error)
+            return false;
+
+        modified = time.time_since_epoch().count();
+        return true;
+    }
+
+    AudioIO VirtualFileSystem::open(const fs::path& file) const
+    {
+        auto& async = AsyncIOService::instance();
+        auto readAhead = getReadAheadSize();
+
+        PackedFile packed;
+        if (!findPacked(file, packed))
+        {
+            // the simulated storage, if any, sits right on top of the file
+            if (isMappedIO())
+                return openSimulatedIO(openMappedIO(file)); // the reads are served from the mapping
+
+            if (async.isEnabled())
+                return openSimulatedIO(async.open(file)); // reads ahead on its own
+
+            auto io = openSimulatedIO(openFileIO(file));
+            return readAhead ? openBufferedIO(io, readAhead) : io;
+        }
+
+        AudioIO io = { new PackIO{ packed.pack, packed.entry.offset, packed.entry.size, 0 }, pack_read, pack_seek, pack_tell, pack_close, pack_clone };
+        io = openSimulatedIO(io);
+        return readAhead ? openBufferedIO(io, readAhead) : io;
+    }
+}
@@ -0,0 +1,368 @@
+/*
+ * OneSound - Modern C++17 audio library for Windows OS with XAudio2 API
+ * Copyright ⓒ 2018 Valentyn Bondarenko. All rights reserved.
+ * License: https://github.com/weelhelmer/OneSound/master/LICENSE
+ */
+
+#include "OneSound\Waveform.h"
+
+#include "OneSound\StreamType\AudioStream.h"
+#include "OneSound\VirtualFileSystem.h"
+#include "OneSound\XAudio2Device.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <fstream>
+
+#include <emmintrin.h>
+
+namespace onesnd
+{
+#pragma pack(push)
+#pragma pack(1)
+    struct WAVEFORMHEADER
+    {
+        int Magic;                  // contains the letters "OSWF"
+        unsigned int Version;       // waveform file version
+        unsigned int BinFrames;     // sample frames per bin of level 0
+        unsigned short Channels;
+        unsigned short Reserved;
+        unsigned int Frequency;
+        unsigned long long Frames;  // level 0 follows the header, one WaveformPoint per bin and channel
+        unsigned long long SourceSize;  // size and last write time of the sound file, both 0 if unknown
+        long long SourceModified;
+    };
+#pragma pack(pop)
+
+    static const int WaveformMagic = (int)'FWSO';
+    static const unsigned int WaveformVersion = 2;
+
+    static WaveformPoint merge(const WaveformPoint& a, const WaveformPoint& b)
+    {
+        auto rms = sqrt((double(a.rms) * a.rms + double(b.rms) * b.rms) / 2.0);
+        return { std::min(a.min, b.min), std::max(a.max, b.max), (unsigned short)std::min(rms + 0.5, 65535.0) };
+    }
+
+    WaveformPyramid::WaveformPyramid(int channels, int frequency) :
+        channels(std::max(channels, 1)),
+        frequency(std::max(frequency, 1)),
+        frames(0),
+        levels(1),
+        binMin(size_t(this->channels), SHRT_MAX),
+        binMax(size_t(this->channels), SHRT_MIN),
+        binSquares(size_t(this->channels), 0.0),
+        binFill(0)
+    { }
+
+    void WaveformPyramid::Append(const short* samples, int count)
+    {
+        while (count > 0)
+        {
+            auto run = std::min(count, BinFrames - binFill);
+            Scan(samples, run);
+            samples += size_t(run) * channels;
+            count -= run;
+
+            if (binFill == BinFrames)
+                CloseBin();
+        }
+    }
+
+    void WaveformPyramid::Append(const void* data, int bytes, const WAVEFORMATEX& wf)
+    {
+        if (wf.nChannels != channels || !wf.nBlockAlign)
+            return;
+
+        auto count = bytes / wf.nBlockAlign;
+        if (wf.wFormatTag != WAVE_FORMAT_IEEE_FLOAT && wf.wBitsPerSample == 16)
+        {
+            Append(static_cast<const short*>(data), count);
+            return;
+        }
+
+        // the other formats are converted to 16-bit in chunks
+        std::vector<short> converted(size_t(std::min(count, 4096)) * channels);
+        for (auto done = 0; done < count; )
+        {
+            auto run = std::min(count - done, 4096);
+            auto samples = size_t(run) * channels;
+            auto first = size_t(done) * channels;
+            if (wf.wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+            {
+                auto* in = static_cast<const float*>(data) + first;
+                for (auto i = size_t(0); i < samples; ++i)
+                    converted[i] = short(std::max(std::min(in[i] * 32767.0f, 32767.0f), -32768.0f));
+            }
+            else // 8-bit PCM is unsigned
+            {
+                auto* in = static_cast<const unsigned char*>(data) + first;
+                for (auto i = size_t(0); i < samples; ++i)
+                    converted[i] = short((in[i] - 128) << 8);
+            }
+            Append(converted.data(), run);
+            done += run;
+        }
+    }
+
+    void WaveformPyramid::Scan(const short* samples, int count)
+    {
+        auto total = count * channels;
+        auto i = 0;
+
+        // 8 samples at once; for 1, 2 and 4 channels every lane keeps to one channel
+        if (4 % channels == 0)
+        {
+            auto vmin = _mm_set1_epi16(SHRT_MAX);
+            auto vmax = _mm_set1_epi16(SHRT_MIN);
+            auto vsquares = _mm_setzero_ps();
+            for (; i + 8 <= total; i += 8)
+            {
+                auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+                vmin = _mm_min_epi16(vmin, v);
+                vmax = _mm_max_epi16(vmax, v);
+
+                auto lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)); // sign extend
+                auto hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+                vsquares = _mm_add_ps(vsquares, _mm_add_ps(_mm_mul_ps(lo, lo), _mm_mul_ps(hi, hi)));
+            }
+
+            short mins[8], maxs[8];
+            float squares[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(mins), vmin);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(maxs), vmax);
+            _mm_storeu_ps(squares, vsquares);
+            for (auto lane = 0; lane < 8; ++lane)
+            {
+                binMin[lane % channels] = std::min(binMin[lane % channels], mins[lane]);
+                binMax[lane % channels] = std::max(binMax[lane % channels], maxs[lane]);
+            }
+            for (auto lane = 0; lane < 4; ++lane)
+                binSquares[lane % channels] += squares[lane];
+        }
+
+        for (; i < total; ++i)
+        {
+            auto c = i % channels;
+            binMin[c] = std::min(binMin[c], samples[i]);
+            binMax[c] = std::max(binMax[c], samples[i]);
+            binSquares[c] += double(samples[i]) * samples[i];
+        }
+
+        binFill += count;
+        frames += count;
+    }
+
+    void WaveformPyramid::CloseBin()
+    {
+        for (auto c = 0; c < channels; ++c)
+        {
+            auto rms = sqrt(binSquares[c] / binFill);
+            levels[0].push_back({ binMin[c], binMax[c], (unsigned short)std::min(rms + 0.5, 65535.0) });
+
+            binMin[c] = SHRT_MAX;
+            binMax[c] = SHRT_MIN;
+            binSquares[c] = 0.0;
+        }
+        binFill = 0;
+    }
+
+    void WaveformPyramid::Finish()
+    {
+        if (binFill)
+            CloseBin();
+
+        // every level halves the one below, down to a single bin
+        levels.resize(1);
+        while (levels.back().size() > size_t(channels))
+        {
+            const auto& below = levels.back();
+            auto bins = below.size() / channels;
+
+            std::vector<WaveformPoint> level;
+            level.reserve((bins + 1) / 2 * channels);
+            for (auto bin = size_t(0); bin < bins; bin += 2)
+            {
+                for (auto c = 0; c < channels; ++c)
+                {
+                    const auto& a = below[bin * channels + c];
+                    level.push_back(bin + 1 < bins ? merge(a, below[(bin + 1) * channels + c]) : a);
+                }
+            }
+            levels.push_back(std::move(level));
+        }
+    }
+
+    int WaveformPyramid::Query(int channel, double begin, double end, int pixels, WaveformPoint* points) const
+    {
+        if (pixels <= 0)
+            return 0;
+        memset(points, 0, sizeof(WaveformPoint) * pixels);
+
+        if (channel < 0 || channel >= channels || levels[0].empty() || end <= begin)
+            return 0;
+
+        auto first = begin * frequency;
+        auto framesPerPixel = (end - begin) * frequency / pixels;
+
+        // the coarsest level whose bins are still no wider than a pixel
+        auto level = 0;
+        while (level + 1 < Levels() && double(BinFrames) * (1ll << (level + 1)) <= framesPerPixel)
+            ++level;
+
+        const auto& bins = levels[level];
+        auto binCount = (long long)(bins.size() / channels);
+        auto binFrames = double(BinFrames) * (1ll << level);
+
+        auto covered = 0;
+        for (auto p = 0; p < pixels; ++p)
+        {
+            auto from = (long long)floor((first + p * framesPerPixel) / binFrames);
+            auto to = (long long)ceil((first + (p + 1) * framesPerPixel) / binFrames);
+            from = std::max(from, 0ll);
+            to = std::min(std::max(to, from + 1), binCount);
+            if (from >= to)
+                continue; // outside the sound
+
+            // a pixel spans less than two bins of its level, plus the partial ones at its edges
+            auto point = bins[size_t(from) * channels + channel];
+            auto squares = double(point.rms) * point.rms;
+            for (auto bin = from + 1; bin < to; ++bin)
+            {
+                const auto& next = bins[size_t(bin) * channels + channel];
+                point.min = std::min(point.min, next.min);
+                point.max = std::max(point.max, next.max);
+                squares += double(next.rms) * next.rms;
+            }
+            point.rms = (unsigned short)std::min(sqrt(squares / double(to - from)) + 0.5, 65535.0);
+
+            points[p] = point;
+            ++covered;
+        }
+        return covered;
+    }
+
+    bool WaveformPyramid::Save(const fs::path& file, const fs::path& source) const
+    {
+        auto size = 0ull;
+        auto modified = 0ll;
+        if (!source.empty() && !VirtualFileSystem::instance().stat(source, size, modified))
+            return false; // a cache that can't be checked against its file is never loaded
+
+        std::ofstream out(file, std::ios::binary);
+        if (!out)
+            return false;
+
+        WAVEFORMHEADER header;
+        header.Magic = WaveformMagic;
+        header.Version = WaveformVersion;
+        header.BinFrames = BinFrames;
+        header.Channels = (unsigned short)channels;
+        header.Reserved = 0;
+        header.Frequency = (unsigned int)frequency;
+        header.Frames = (unsigned long long)frames;
+        header.SourceSize = size;
+        header.SourceModified = modified;
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(levels[0].data()), levels[0].size() * sizeof(WaveformPoint));
+        return bool(out);
+    }
+
+    std::shared_ptr<WaveformPyramid> WaveformPyramid::Load(const fs::path& file, const fs::path& source)
+    {
+        std::ifstream in(file, std::ios::binary);
+        WAVEFORMHEADER header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+            return nullptr;
+
+        if (header.Magic != WaveformMagic || header.Version != WaveformVersion ||
+            header.BinFrames != (unsigned int)BinFrames || !header.Channels)
+            return nullptr; // another version or not a waveform at all
+
+        if (!source.empty())
+        {
+            // the sound file was edited or replaced since, the waveform is built again
+            auto size = 0ull;
+            auto modified = 0ll;
+            if (!VirtualFileSystem::instance().stat(source, size, modified) ||
+                header.SourceSize != size || header.SourceModified != modified)
+                return nullptr;
+        }
+
+        // the header has to match the length of the file before it sizes anything, a truncated cache is built again
+        in.seekg(0, std::ios::end);
+        auto payload = (unsigned long long)in.tellg() - sizeof(header);
+        auto point = (unsigned long long)header.Channels * sizeof(WaveformPoint);
+        auto bins = header.Frames / BinFrames + (header.Frames % BinFrames ? 1 : 0);
+        if (payload % point || payload / point != bins)
+            return nullptr;
+        in.seekg(sizeof(header));
+
+        auto pyramid = std::make_shared<WaveformPyramid>(header.Channels, int(header.Frequency));
+        pyramid->levels[0].resize(size_t(bins) * header.Channels);
+        if (!in.read(reinterpret_cast<char*>(pyramid->levels[0].data()), pyramid->levels[0].size() * sizeof(WaveformPoint)))
+            return nullptr;
+
+        pyramid->frames = (long long)header.Frames;
+        pyramid->Finish();
+        return pyramid;
+    }
+
+    std::shared_ptr<WaveformPyramid> buildWaveform(AudioStream* strm)
+    {
+        if (!strm || !strm->FullSampleBlockSize())
+            return nullptr;
+
+        auto wf = XABuffer::formatOf(strm);
+        auto pyramid = std::make_shared<WaveformPyramid>(wf.nChannels, int(wf.nSamplesPerSec));
+
+        // whole bins per read, so the decoded data goes straight into the scan
+        std::vector<char> chunk(size_t(wf.nBlockAlign) * WaveformPyramid::BinFrames * 64);
+        auto bytesRead = 0;
+        while ((bytesRead = strm->ReadSome(chunk.data(), int(chunk.size()))) > 0)
+            pyramid->Append(chunk.data(), bytesRead - bytesRead % wf.nBlockAlign, wf);
+
+        pyramid->Finish();
+        return pyramid;
+    }
+
+    std::shared_ptr<WaveformPyramid> buildWaveform(const XABuffer* buffer)
+    {
+        if (!buffer || !buffer->wf.nBlockAlign)
+            return nullptr;
+
+        auto pyramid = std::make_shared<WaveformPyramid>(buffer->wf.nChannels, int(buffer->wf.nSamplesPerSec));
+        pyramid->Append(buffer->pAudioData, int(buffer->AudioBytes), buffer->wf);
+        pyramid->Finish();
+        return pyramid;
+    }
+
+    std::future<std::shared_ptr<WaveformPyramid>> buildWaveformAsync(const fs::path& file, const fs::path& cache)
+    {
+        return std::async(std::launch::async, [file, cache]() -> std::shared_ptr<WaveformPyramid>
+        {
+            if (!cache.empty())
+            {
+                if (auto cached = WaveformPyramid::Load(cache, file))
+                    return cached;
+            }
+
+            std::shared_ptr<WaveformPyramid> pyramid;
+            try
+            {
+                std::unique_ptr<AudioStream> strm(openAudioStream(file));
+                pyramid = buildWaveform(strm.get());
+            }
+            catch (const std::exception&)
+            {
+                return nullptr; // a file that can't be opened or decoded has no waveform
+            }
+
+            if (pyramid && !cache.empty())
+                pyramid->Save(cache, file);
+
+            return pyramid;
+        });
+    }
+}
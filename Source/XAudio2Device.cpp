@@ -21,15 +21,23 @@ namespace onesnd
         flags |= 0;
     #endif
 
-        XAudio2Create(&xEngine, flags);
-        xEngine->CreateMasteringVoice(&xMaster, XAUDIO2_DEFAULT_CHANNELS, XAUDIO2_DEFAULT_SAMPLERATE);
+        if (FAILED(XAudio2Create(&xEngine, flags)))
+        {
+            xEngine = nullptr;
+            return; // no XAudio2 runtime, getEngine() stays NULL
+        }
+
+        if (FAILED(xEngine->CreateMasteringVoice(&xMaster, XAUDIO2_DEFAULT_CHANNELS, XAUDIO2_DEFAULT_SAMPLERATE)))
+            xMaster = nullptr; // no audio device, getMaster() stays NULL
         X3DAudioInitialize(SPEAKER_STEREO, X3DAUDIO_SPEED_OF_SOUND, x3DAudioHandle);
     }
 
     void XAudio2Device::finalize()
     {
-        xMaster->DestroyVoice();
-        xEngine->Release();
+        if (xMaster)
+            xMaster->DestroyVoice();
+        if (xEngine)
+            xEngine->Release();
 
         if (xMaster != nullptr)
             xMaster = nullptr;
@@ -38,16 +46,26 @@ namespace onesnd
             xEngine = nullptr;
     }
 
-    XABuffer* XABuffer::create(SoundBuffer* ctx, int size, AudioStream* strm, int* pos)
+    int XAudio2Device::getMasterRate() const
     {
-        if (pos) 
+        if (!xMaster)
+            return 0;
+
+        XAUDIO2_VOICE_DETAILS details;
+        xMaster->GetVoiceDetails(&details);
+        return int(details.InputSampleRate);
+    }
+
+    XABuffer* XABuffer::create(SoundBuffer* ctx, int size, AudioStream* strm, long long* pos)
+    {
+        if (pos && *pos != strm->Position()) // sequential reads don't need to seek the decoder
             strm->Seek(*pos); // seek to specified pos, let the AudioStream handle error conditions
         if (strm->IsEOS()) 
             return nullptr; // EOS(), failed!
 
-        int bytesToRead = strm->Available();
-        if (size < bytesToRead) 
-            bytesToRead = size;
+        auto bytesToRead = size;
+        if (strm->Available() < bytesToRead) 
+            bytesToRead = int(strm->Available());
 
         auto* buffer = (XABuffer*)malloc(sizeof(XABuffer) + bytesToRead);
         if (!buffer) 
@@ -68,28 +86,39 @@ namespace onesnd
         buffer->LoopLength = 0;		// number of samples to loop
         buffer->LoopCount = 0;		// how many times to loop the region
         buffer->pContext = ctx;		// context of the buffer
+        buffer->mapping = nullptr;
 
+        buffer->nBytesPerSample = strm->SingleSampleSize();
+        buffer->wf = formatOf(strm);
+        buffer->nPCMSamples = bytesRead / buffer->wf.nBlockAlign;
+        buffer->wfHash = hashFormat(buffer->wf);
+        return buffer;
+    }
+
+    WAVEFORMATEX XABuffer::formatOf(AudioStream* strm)
+    {
         auto sampleSize = strm->SingleSampleSize();
-        buffer->nBytesPerSample = sampleSize;
 
-        auto& wf = buffer->wf;
+        WAVEFORMATEX wf;
         wf.wFormatTag = WAVE_FORMAT_PCM;
         wf.nChannels = strm->Channels();
-        buffer->nPCMSamples = bytesRead / (sampleSize * wf.nChannels);
         wf.nSamplesPerSec = strm->Frequency();
         wf.wBitsPerSample = sampleSize * 8;
         wf.nBlockAlign = (wf.nChannels * sampleSize);
         wf.nAvgBytesPerSec = wf.nBlockAlign * wf.nSamplesPerSec;
         wf.cbSize = sizeof(WAVEFORMATEX);
+        return wf;
+    }
 
+    unsigned XABuffer::hashFormat(const WAVEFORMATEX& wf)
+    {
         // this is enough to create an somewhat unique pseudo-hash:
-        buffer->wfHash = wf.nSamplesPerSec + (wf.nChannels * 25) + (wf.wBitsPerSample * 7);
-        return buffer;
+        return wf.nSamplesPerSec + (wf.nChannels * 25) + (wf.wBitsPerSample * 7) + (wf.wFormatTag * 1031);
     }
 
-    void XABuffer::stream(XABuffer* buffer, AudioStream* strm, int* pos)
+    void XABuffer::stream(XABuffer* buffer, AudioStream* strm, long long* pos)
     {
-        if (pos) 
+        if (pos && *pos != strm->Position()) // sequential reads don't need to seek the decoder
             strm->Seek(*pos); // seek to specified pos, let the AudioStream handle error conditions
 
         buffer->AudioBytes = strm->ReadSome((void*)buffer->pAudioData, buffer->AudioBytes);
@@ -101,8 +130,56 @@ namespace onesnd
             *pos += buffer->AudioBytes; // update position
     }
 
+    XABuffer* XABuffer::create(SoundBuffer* ctx, const WAVEFORMATEX& wf, const void* data, int size)
+    {
+        auto* buffer = (XABuffer*)malloc(sizeof(XABuffer) + size);
+        if (!buffer)
+            return nullptr; // out of memory
+
+        memset(buffer, 0, sizeof(XABuffer));
+        auto* copy = (BYTE*)buffer + sizeof(XABuffer); // sound data follows after the XABuffer header
+        memcpy(copy, data, size);
+
+        buffer->Flags = XAUDIO2_END_OF_STREAM;
+        buffer->AudioBytes = size;
+        buffer->pAudioData = copy;
+        buffer->pContext = ctx;
+        buffer->mapping = nullptr;
+
+        buffer->wf = wf;
+        buffer->wf.cbSize = sizeof(WAVEFORMATEX);
+        buffer->nBytesPerSample = wf.wBitsPerSample / 8;
+        buffer->nPCMSamples = size / wf.nBlockAlign;
+        buffer->wfHash = hashFormat(buffer->wf);
+        return buffer;
+    }
+
+    XABuffer* XABuffer::createMapped(SoundBuffer* ctx, const WAVEFORMATEX& wf, void* view, const void* data, int size)
+    {
+        auto* buffer = (XABuffer*)malloc(sizeof(XABuffer));
+        if (!buffer)
+            return nullptr; // out of memory
+
+        memset(buffer, 0, sizeof(XABuffer));
+        buffer->Flags = XAUDIO2_END_OF_STREAM;
+        buffer->AudioBytes = size;
+        buffer->pAudioData = (const BYTE*)data; // the data stays in the mapped view
+        buffer->pContext = ctx;
+        buffer->mapping = view;
+
+        buffer->wf = wf;
+        buffer->wf.cbSize = sizeof(WAVEFORMATEX);
+        buffer->nBytesPerSample = wf.wBitsPerSample / 8;
+        buffer->nPCMSamples = size / wf.nBlockAlign;
+        buffer->wfHash = hashFormat(buffer->wf);
+        return buffer;
+    }
+
     void XABuffer::destroy(XABuffer*& buffer)
     {
+        if (buffer && buffer->mapping)
+            UnmapViewOfFile(buffer->mapping);
+
         free(reinterpret_cast<void*>(buffer));
         buffer = nullptr;
     }